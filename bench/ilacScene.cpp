@@ -0,0 +1,433 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacScene.h"
+#include "ilacUndistort.h"
+#include "error.h"
+#include <math.h>
+
+/*{{{ ILAC_Scene*/
+/*
+ * Same order as the samples of ILAC_Median_CC. Printed colors are tints: a
+ * full blue is as dark as the black squares to findChessboardCorners.
+ */
+const Scalar ILAC_Scene::sampleColors[] = {
+  Scalar(90,90,255), Scalar(90,255,255), Scalar(90,255,90),
+  Scalar(255,255,90), Scalar(255,90,90), Scalar(255,90,255) };
+const Scalar ILAC_Scene::sphereColor = Scalar(60,190,60);
+const Scalar ILAC_Scene::paperColor = Scalar(235,235,235);
+const Scalar ILAC_Scene::soilColor = Scalar(45,75,100);
+const size_t ILAC_Scene::idSquares;
+
+ILAC_Scene::ILAC_Scene ( const Size &boardSize, const int sqrSideUU,
+                         const int sphDiamUU )
+  :sqrSideUU(sqrSideUU), sphDiamUU(sphDiamUU), plotW(100*sqrSideUU),
+   plotRatio(1.5), keystone(0.1), rotation(0), noise(0), seed(0)
+{
+  this->dimension.width = max ( boardSize.width, boardSize.height );
+  this->dimension.height = min ( boardSize.width, boardSize.height );
+  if ( this->dimension.height % 2 == this->dimension.width % 2 )
+    throw ILACExSymmetricalChessboard();
+  if ( this->getDataSize() < 1 )
+    throw ILACExChessboardTooSmall();
+
+  /* All data squares red */
+  this->id.resize ( (this->getDataSize() + idSquares - 1) / idSquares, 0 );
+}
+
+/*
+ * Square r,c between the inner corners is colored, not black. Like
+ * ILAC_Chessboard, which toggles isBlack once per square and not at the
+ * start of every row.
+ */
+bool
+ILAC_Scene::isColored ( const int r, const int c )
+{ return ( r*(this->dimension.width-1) + c ) % 2 == 1; }
+
+size_t
+ILAC_Scene::getDataSize ()
+{
+  size_t colored = 0;
+  for ( int r = 0 ; r < this->dimension.height-1 ; r++ )
+    for ( int c = 0 ; c < this->dimension.width-1 ; c++ )
+      if ( this->isColored ( r, c ) )
+        colored++;
+
+  /* Minus the samples and the sphere square */
+  return colored > 7 ? colored - 7 : 0;
+}
+
+/*
+ * calcID shifts 2 bits per data square into the id, idSquares squares per
+ * short. Red is 0, magenta (blue bit) 1 and yellow (green bit) 2. There is
+ * no square for 3.
+ */
+void
+ILAC_Scene::setID ( const vector<unsigned short> &id )
+{
+  size_t datas = this->getDataSize();
+  if ( id.size() != (datas + idSquares - 1) / idSquares )
+    throw ILACExOutOfBounds();
+
+  for ( size_t i = 0 ; i < id.size() ; i++ )
+  {
+    size_t squares = min ( idSquares, datas - idSquares*i );
+    if ( squares < idSquares && id[i] >> (2*squares) != 0 )
+      throw ILACExOutOfBounds();
+    for ( size_t j = 0 ; j < squares ; j++ )
+      if ( ((id[i] >> (2*j)) & 3) == 3 )
+        throw ILACExOutOfBounds();
+  }
+  this->id = id;
+}
+
+void
+ILAC_Scene::setRandomID ( RNG &rng )
+{
+  size_t datas = this->getDataSize();
+  vector<unsigned short> id ( (datas + idSquares - 1) / idSquares, 0 );
+  for ( size_t i = 0 ; i < datas ; i++ )
+    id[i/idSquares] = ( id[i/idSquares] << 2 )
+                      | (unsigned short)rng.uniform ( 0, 3 );
+  this->setID ( id );
+}
+
+void
+ILAC_Scene::setPlotSize ( const double plotW, const double ratio )
+{
+  this->plotW = plotW;
+  this->plotRatio = ratio;
+}
+
+void
+ILAC_Scene::setKeystone ( const double keystone )
+{ this->keystone = min ( 0.5, max ( 0.0, keystone ) ); }
+
+void
+ILAC_Scene::setRotation ( const double rotation )
+{ this->rotation = rotation; }
+
+void
+ILAC_Scene::setLens ( const Mat &camMat, const Mat &disMat )
+{
+  this->camMat = camMat;
+  this->disMat = disMat;
+}
+
+void
+ILAC_Scene::setNoise ( const double noise, const uint64 seed )
+{
+  this->noise = max ( 0.0, noise );
+  this->seed = seed;
+}
+
+vector<unsigned short>
+ILAC_Scene::getID () { return this->id; }
+
+Size //static method
+ILAC_Scene::getSize ( const double megapixels )
+{
+  int width = 2 * cvRound ( sqrt ( megapixels * 1e6 * 1.5 ) / 2 );
+  return Size ( width, 2 * cvRound ( width / 3.0 ) );
+}
+
+/* Color of data square offset */
+Scalar
+ILAC_Scene::getDataColor ( const size_t offset )
+{
+  size_t datas = this->getDataSize();
+  size_t first = offset - offset%idSquares;
+  size_t squares = min ( idSquares, datas - first );
+  int digit = ( this->id[offset/idSquares]
+                >> (2*(squares - 1 - offset%idSquares)) ) & 3;
+
+  switch ( digit )
+  {
+    case 1:
+      return sampleColors[5]; /* magenta */
+    case 2:
+      return sampleColors[1]; /* yellow */
+    default:
+      return sampleColors[0]; /* red */
+  }
+}
+
+/*
+ * Plot (UU) -> image (pixels). The plot, with room for the chessboard and
+ * the spheres around it, fills the image and its far (top) side is keystone
+ * narrower than the near side.
+ */
+Mat
+ILAC_Scene::calcTrans ( const Size &size )
+{
+  double plotH = this->plotW / this->plotRatio;
+  double boardW = (this->dimension.width + 1) * this->sqrSideUU;
+  double boardH = (this->dimension.height + 1) * this->sqrSideUU;
+  double margin = max ( sqrt ( boardW*boardW + boardH*boardH ) / 2,
+                        (double)this->sphDiamUU ) + this->sqrSideUU;
+
+  Point2f src[4] = {
+    Point2f ( -margin, -margin ),
+    Point2f ( this->plotW + margin, -margin ),
+    Point2f ( this->plotW + margin, plotH + margin ),
+    Point2f ( -margin, plotH + margin ) };
+
+  /* Keep the aspect of the plot, 5% from the image borders */
+  double regionW = this->plotW + 2*margin, regionH = plotH + 2*margin;
+  double scale = 0.9 * min ( size.width / regionW, size.height / regionH );
+  double x0 = ( size.width - regionW*scale ) / 2;
+  double y0 = ( size.height - regionH*scale ) / 2;
+  double inset = this->keystone * regionW * scale / 2;
+  Point2f dst[4] = {
+    Point2f ( x0 + inset, y0 ),
+    Point2f ( x0 + regionW*scale - inset, y0 ),
+    Point2f ( x0 + regionW*scale, y0 + regionH*scale ),
+    Point2f ( x0, y0 + regionH*scale ) };
+
+  /* Rotate around the center and shrink until it fits again */
+  Point2f center ( size.width / 2.0, size.height / 2.0 );
+  double angle = this->rotation * CV_PI / 180;
+  double left = size.width, right = 0, top = size.height, bottom = 0;
+  for ( int i = 0 ; i < 4 ; i++ )
+  {
+    Point2f d = dst[i] - center;
+    dst[i] = Point2f ( d.x*cos(angle) - d.y*sin(angle),
+                       d.x*sin(angle) + d.y*cos(angle) );
+    left = min ( left, (double)dst[i].x );
+    right = max ( right, (double)dst[i].x );
+    top = min ( top, (double)dst[i].y );
+    bottom = max ( bottom, (double)dst[i].y );
+  }
+  double shrink = min ( 1.0, 0.95 * min ( size.width / (right - left),
+                                          size.height / (bottom - top) ) );
+  for ( int i = 0 ; i < 4 ; i++ )
+    dst[i] = center + dst[i] * shrink;
+
+  return getPerspectiveTransform ( src, dst );
+}
+
+/* Antialiased, with 4 bits of subpixel precision */
+void
+ILAC_Scene::fillQuad ( Mat &img, const Mat &trans, const Point2f quad[4],
+                       const Scalar &color )
+{
+  vector<Point2f> uu ( quad, quad + 4 ), pix;
+  perspectiveTransform ( uu, pix, trans );
+
+  Point pts[4];
+  for ( int i = 0 ; i < 4 ; i++ )
+    pts[i] = Point ( cvRound ( pix[i].x * 16 ), cvRound ( pix[i].y * 16 ) );
+  fillConvexPoly ( img, pts, 4, color, CV_AA, 4 );
+}
+
+/*
+ * 1. RENDER WHAT AN IDEAL LENS SEES
+ * 2. DISTORT AND ADD NOISE, A STRIP AT A TIME
+ */
+Mat
+ILAC_Scene::render ( const Size &size )
+{
+  /* 1. RENDER WHAT AN IDEAL LENS SEES */
+  Mat ideal = this->renderIdeal ( size );
+  if ( this->camMat.empty() && this->noise == 0 )
+    return ideal;
+
+  /* 2. DISTORT AND ADD NOISE, A STRIP AT A TIME */
+  Mat img;
+  if ( this->camMat.empty() )
+    img = ideal;
+  else
+    img.create ( size, CV_8UC3 );
+
+  RNG rng ( this->seed );
+  Mat noiseStrip;
+  for ( int row = 0 ; row < size.height ; row += stripRows )
+  {
+    Mat strip = img.rowRange ( row, min ( row + stripRows, size.height ) );
+    if ( !this->camMat.empty() )
+      this->applyLens ( ideal, strip );
+
+    if ( this->noise > 0 )
+    {
+      noiseStrip.create ( strip.size(), CV_16SC3 );
+      rng.fill ( noiseStrip, RNG::NORMAL, Scalar::all(0),
+                 Scalar::all(this->noise) );
+      add ( strip, noiseStrip, strip, Mat(), CV_8U );
+    }
+  }
+
+  return img;
+}
+
+/*
+ * strip is a range of rows of the raw image. Every raw pixel takes the color
+ * of the undistorted position it comes from.
+ */
+void
+ILAC_Scene::applyLens ( const Mat &ideal, Mat &strip )
+{
+  Size wholeSize;
+  Point offset;
+  strip.locateROI ( wholeSize, offset );
+
+  ILAC_LensModel lens ( this->camMat, this->disMat );
+  Mat mapX ( strip.size(), CV_32F ), mapY ( strip.size(), CV_32F );
+  vector<Point2f> raw ( strip.cols );
+  for ( int r = 0 ; r < strip.rows ; r++ )
+  {
+    for ( int c = 0 ; c < strip.cols ; c++ )
+      raw[c] = Point2f ( c, offset.y + r );
+    vector<Point2f> undistorted = lens.undistort ( raw );
+    for ( int c = 0 ; c < strip.cols ; c++ )
+    {
+      mapX.at<float>(r,c) = undistorted[c].x;
+      mapY.at<float>(r,c) = undistorted[c].y;
+    }
+  }
+
+  remap ( ideal, strip, mapX, mapY, INTER_LINEAR, BORDER_CONSTANT,
+          soilColor );
+}
+
+/* Ideal (undistorted) pixels -> raw pixels */
+vector<Point2f>
+ILAC_Scene::toRaw ( const vector<Point2f> &points )
+{
+  if ( this->camMat.empty() )
+    return points;
+
+  ILAC_LensModel lens ( this->camMat, this->disMat );
+  vector<Point2f> raw;
+  for ( size_t i = 0 ; i < points.size() ; i++ )
+    raw.push_back ( lens.distort ( points[i].x, points[i].y ) );
+  return raw;
+}
+
+/* Row by row from the first inner corner, like ILAC_Chessboard reads them */
+vector<Point2f>
+ILAC_Scene::getCorners ( const Size &size )
+{
+  double sqr = this->sqrSideUU;
+  double boardW = (this->dimension.width + 1) * sqr;
+  double boardH = (this->dimension.height + 1) * sqr;
+
+  vector<Point2f> uu, pix;
+  for ( int r = 1 ; r <= this->dimension.height ; r++ )
+    for ( int c = 1 ; c <= this->dimension.width ; c++ )
+      uu.push_back ( Point2f ( -boardW/2 + c*sqr, -boardH/2 + r*sqr ) );
+  perspectiveTransform ( uu, pix, this->calcTrans ( size ) );
+  return this->toRaw ( pix );
+}
+
+vector<Vec3f>
+ILAC_Scene::getSpheres ( const Size &size )
+{ return this->calcSpheres ( size, true ); }
+
+/* In raw pixels through the lens, or in ideal pixels */
+vector<Vec3f>
+ILAC_Scene::calcSpheres ( const Size &size, const bool raw )
+{
+  double plotH = this->plotW / this->plotRatio;
+  vector<Point2f> uu, pix;
+  uu.push_back ( Point2f ( this->plotW, 0 ) );
+  uu.push_back ( Point2f ( this->plotW, plotH ) );
+  uu.push_back ( Point2f ( 0, plotH ) );
+  for ( size_t i = 0 ; i < 3 ; i++ )
+    uu.push_back ( uu[i] + Point2f ( this->sphDiamUU / 2.0, 0 ) );
+  perspectiveTransform ( uu, pix, this->calcTrans ( size ) );
+
+  /* Balls look round from any angle. Only their size changes. */
+  vector<Point2f> centers ( pix.begin(), pix.begin() + 3 );
+  if ( raw )
+    centers = this->toRaw ( centers );
+  vector<Vec3f> spheres;
+  for ( size_t i = 0 ; i < 3 ; i++ )
+  {
+    Point2f edge = pix[i+3] - pix[i];
+    spheres.push_back ( Vec3f ( centers[i].x, centers[i].y,
+                                sqrt ( edge.x*edge.x + edge.y*edge.y ) ) );
+  }
+  return spheres;
+}
+
+/*
+ * 1. SOIL AND PAPER
+ * 2. CHESSBOARD SQUARES
+ * 3. SPHERES
+ */
+Mat
+ILAC_Scene::renderIdeal ( const Size &size )
+{
+  Mat trans = this->calcTrans ( size );
+  double sqr = this->sqrSideUU;
+  double boardW = (this->dimension.width + 1) * sqr;
+  double boardH = (this->dimension.height + 1) * sqr;
+
+  /* 1. SOIL AND PAPER */
+  Mat img ( size, CV_8UC3, soilColor );
+  Point2f paper[4] = {
+    Point2f ( -boardW/2 - sqr/2, -boardH/2 - sqr/2 ),
+    Point2f ( boardW/2 + sqr/2, -boardH/2 - sqr/2 ),
+    Point2f ( boardW/2 + sqr/2, boardH/2 + sqr/2 ),
+    Point2f ( -boardW/2 - sqr/2, boardH/2 + sqr/2 ) };
+  this->fillQuad ( img, trans, paper, paperColor );
+
+  /*
+   * 2. CHESSBOARD SQUARES
+   * The outer squares are black and white. Between the inner corners the
+   * white squares are colored in the order ILAC_Chessboard reads them.
+   */
+  size_t colored = 0;
+  for ( int r = 0 ; r <= this->dimension.height ; r++ )
+    for ( int c = 0 ; c <= this->dimension.width ; c++ )
+    {
+      Scalar color;
+      bool inner = r > 0 && c > 0
+                   && r < this->dimension.height && c < this->dimension.width;
+      bool black = inner ? !this->isColored ( r-1, c-1 ) : (r+c) % 2 == 0;
+      if ( black )
+        color = Scalar ( 20, 20, 20 );
+      else if ( !inner )
+        color = paperColor;
+      else if ( colored < 6 )
+        color = sampleColors[colored++];
+      else if ( colored++ == 6 )
+        color = sphereColor;
+      else
+        color = this->getDataColor ( colored - 8 );
+
+      double x = -boardW/2 + c*sqr, y = -boardH/2 + r*sqr;
+      Point2f square[4] = { Point2f ( x, y ), Point2f ( x + sqr, y ),
+                            Point2f ( x + sqr, y + sqr ),
+                            Point2f ( x, y + sqr ) };
+      this->fillQuad ( img, trans, square, color );
+    }
+
+  /* 3. SPHERES */
+  vector<Vec3f> spheres = this->calcSpheres ( size, false );
+  for ( size_t i = 0 ; i < spheres.size() ; i++ )
+  {
+    Point center ( cvRound ( spheres[i][0] * 16 ),
+                   cvRound ( spheres[i][1] * 16 ) );
+    circle ( img, center, cvRound ( spheres[i][2] * 16 ), sphereColor, -1,
+             CV_AA, 4 );
+  }
+
+  return img;
+}
+/*}}} ILAC_Scene*/
@@ -0,0 +1,113 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_SCENE_H
+#define ILAC_SCENE_H
+
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+
+/*
+ * Renders a plot the way our rigs see it: the chessboard (6 samples, the
+ * sphere square and the id in the data squares) at one corner and the
+ * spheres at the other three, seen with some perspective, through a lens and
+ * with sensor noise. Everything is computed, so the same arguments (and
+ * noise seed) give the same image.
+ *
+ * The plot is measured in UU, like sqrSideUU and sphDiamUU of ILAC_Image.
+ * The chessboard center is at (0,0) and the plot is plotW x plotW/ratio.
+ *
+ * getCorners and getSpheres are the ground truth of render: what
+ * ILAC_Chessboard and ILAC_SphereFinder should find in the image.
+ */
+class ILAC_Scene{
+  public:
+    /* boardSize, sqrSideUU, sphDiamUU. Same arguments as ILAC_Image */
+    ILAC_Scene ( const Size&, const int, const int );
+
+    /* The id calcID should find. Throws ILACExOutOfBounds if it can not */
+    void setID ( const vector<unsigned short>& );
+    /* A random one: red, magenta or yellow in every data square */
+    void setRandomID ( RNG& );
+    void setPlotSize ( const double, const double = 1.5 );
+
+    /* How much narrower the far side of the plot looks, 0 to 0.5 */
+    void setKeystone ( const double );
+    /* Of the whole view around the image center, in degrees */
+    void setRotation ( const double );
+
+    /*
+     * camMat, disMat of the camera at the rendered size. The image is
+     * distorted the way ILAC_LensModel undistorts it. No lens by default.
+     */
+    void setLens ( const Mat&, const Mat& );
+
+    /* Gaussian noise of sigma gray levels, seeded. 0 is no noise. */
+    void setNoise ( const double, const uint64 = 0 );
+
+    Mat render ( const Size& );
+
+    /* Inner corners in the order of findChessboardCorners, raw pixels */
+    vector<Point2f> getCorners ( const Size& );
+    /* Center (raw pixels) and radius of the far, near and board side ball */
+    vector<Vec3f> getSpheres ( const Size& );
+    vector<unsigned short> getID ();
+
+    /* Data squares of the board, 2 bits of the id each */
+    size_t getDataSize ();
+
+    /* A 3:2 image with about megapixels million pixels */
+    static Size getSize ( const double );
+
+  private:
+    Size dimension; /* Inner corners, long side first */
+    int sqrSideUU;
+    int sphDiamUU;
+    vector<unsigned short> id;
+    double plotW;
+    double plotRatio;
+    double keystone;
+    double rotation;
+    Mat camMat;
+    Mat disMat;
+    double noise;
+    uint64 seed;
+
+    static const Scalar sampleColors[]; /* red ... magenta, in BGR */
+    static const Scalar sphereColor;
+    static const Scalar paperColor;
+    static const Scalar soilColor;
+
+    /* Rows of the image distorted and noised at once */
+    static const int stripRows = 256;
+
+    /* Data squares per id element, like short_size of calcID */
+    static const size_t idSquares = 8*sizeof(unsigned short);
+
+    bool isColored ( const int, const int );
+    Mat calcTrans ( const Size& );
+    Scalar getDataColor ( const size_t );
+    void fillQuad ( Mat&, const Mat&, const Point2f[4], const Scalar& );
+    Mat renderIdeal ( const Size& );
+    void applyLens ( const Mat&, Mat& );
+    vector<Point2f> toRaw ( const vector<Point2f>& );
+    vector<Vec3f> calcSpheres ( const Size&, const bool );
+};
+
+#endif /* ILAC_SCENE_H */
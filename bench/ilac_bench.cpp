@@ -0,0 +1,421 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Benchmarks of ILAC on the images given and on synthetic ILAC_Scene images
+ * of 4, 12, 24 and 50 megapixels. For every image:
+ *
+ * micro: each stage alone, ITERATIONS times. hue (ILAC_Hue::convert),
+ *   squares (corners and squares of the chessboard, with the chess_* parts),
+ *   classify (ILAC_Median_CC), spheres (ILAC_SphereFinder), warp
+ *   (ILAC_Normalizer to 5000x3333) and exif_read/exif_write (copying the
+ *   EXIF of the first image given into a JPEG in memory).
+ * image: ILAC_Image from the file to the normalized JPEG, ITERATIONS times,
+ *   with the ILAC_Stats of the image and the total.
+ * batch: BATCH copies of the image through ILAC_Pipeline.
+ *
+ * The output is JSON, with the ILAC_StatsSummary (n, mean, p50, p90, p99,
+ * max, milliseconds) of every value. Synthetic images are always the same,
+ * so runs of different versions can be compared. The lens is taken as
+ * undistorted: the cost of undistorting does not depend on the
+ * coefficients. The board is 5x6, with 10 UU squares and 40 UU spheres.
+ *
+ * ilac_bench [-n ITERATIONS] [-b BATCH] [-m MEGAPIXELS,...|0] [-o FILE] [-t]
+ *            [IMAGE ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <opencv2/opencv.hpp>
+#include "ilacConfig.h"
+#include "ilacImage.h"
+#include "ilacPipeline.h"
+#include "ilacNormalize.h"
+#include "ilacHue.h"
+#include "ilacCodec.h"
+#include "ilacCache.h"
+#include "ilacStats.h"
+#include "ilacArena.h"
+#include "ilacScene.h"
+
+static const Size boardSize ( 5, 6 );
+static const int sqrSideUU = 10;
+static const int sphDiamUU = 40;
+static const Size normSize ( 5000, 3333 );
+
+struct ILAC_BenchSet{
+  string name;
+  string file;
+  Size size;
+  size_t errors;
+  ILAC_StatsSummary micro;
+  ILAC_StatsSummary image;
+  size_t batchImages;
+  double batchSeconds;
+};
+
+static string
+baseName ( const string &file )
+{
+  size_t slash = file.rfind ( '/' );
+  return slash == string::npos ? file : file.substr ( slash + 1 );
+}
+
+/* A pinhole camera for size */
+static Mat
+benchCamMat ( const Size &size )
+{
+  Mat camMat = Mat::eye ( 3, 3, CV_64F );
+  camMat.at<double>(0,0) = camMat.at<double>(1,1) = size.width;
+  camMat.at<double>(0,2) = size.width / 2.0;
+  camMat.at<double>(1,2) = size.height / 2.0;
+  return camMat;
+}
+
+/*
+ * 1. STAGES THAT DO NOT NEED A CHESSBOARD
+ * 2. STAGES ON THE SQUARES OF THE CHESSBOARD
+ */
+static void
+runMicro ( ILAC_BenchSet &set, const int iterations,
+           const vector<uchar> &exif )
+{
+  Mat img = imread ( set.file );
+  if ( img.empty() )
+  {
+    set.errors++;
+    return;
+  }
+  set.size = img.size();
+
+  /* A plot seen with some perspective, inside the image */
+  float w = img.cols, h = img.rows;
+  Point2f tvsrc[4] = { Point2f(0.10*w, 0.15*h), Point2f(0.92*w, 0.05*h),
+                       Point2f(0.85*w, 0.95*h), Point2f(0.05*w, 0.80*h) };
+  Point2f tvdst[4] = { Point2f(0,0), Point2f(normSize.width,0),
+                       Point2f(normSize.width,normSize.height),
+                       Point2f(0,normSize.height) };
+  ILAC_Normalizer normalizer ( getPerspectiveTransform ( tvsrc, tvdst ),
+                               benchCamMat ( img.size() ),
+                               Mat::zeros ( 1, 5, CV_64F ) );
+
+  vector<uchar> jpeg, exifJpeg;
+  if ( !exif.empty() )
+  {
+    imencode ( ".jpg", img, jpeg );
+    exifJpeg = jpeg;
+    ILAC_Codec::addExif ( exifJpeg, exif );
+  }
+
+  Size dimension ( max ( boardSize.width, boardSize.height ),
+                   min ( boardSize.width, boardSize.height ) );
+  for ( int i = 0 ; i < iterations ; i++ )
+  {
+    ILAC_Stats stats;
+    ILAC_StatsScope scope ( &stats );
+
+    /* 1. STAGES THAT DO NOT NEED A CHESSBOARD */
+    {
+      ILAC_Timer timer ( "hue" );
+      Mat hue;
+      ILAC_Hue::convert ( img, hue );
+    }
+    {
+      ILAC_Timer timer ( "warp" );
+      Mat normImg;
+      normalizer.warp ( img, normImg, normSize );
+    }
+    if ( !exif.empty() )
+    {
+      vector<uchar> blob, out = jpeg;
+      {
+        ILAC_Timer timer ( "exif_read" );
+        blob = ILAC_Codec::readExif ( exifJpeg );
+      }
+      ILAC_Codec::addExif ( out, blob );
+    }
+
+    /* 2. STAGES ON THE SQUARES OF THE CHESSBOARD */
+    try
+    {
+      ILAC_Chessboard cb;
+      {
+        ILAC_Timer timer ( "squares" );
+        cb = ILAC_Chessboard ( img, dimension );
+      }
+
+      /* Samples, the sphere square and the data, see ILAC_Chess_SSD */
+      vector<ILAC_Square> samples, datas;
+      double sideAccum = 0;
+      for ( size_t j = 0 ; j < cb.getSquaresSize() ; j++ )
+      {
+        if ( j < ILAC_Chessboard::numSamples )
+          samples.push_back ( cb.getSquare(j) );
+        else if ( j > ILAC_Chessboard::numSamples )
+          datas.push_back ( cb.getSquare(j) );
+        sideAccum += cb.getSquare(j).getSize().width
+                     + cb.getSquare(j).getSize().height;
+      }
+      ILAC_Median_CC cc ( samples, datas );
+      cc.classify ();
+
+      double pixPerUU = sideAccum / (2 * cb.getSquaresSize() * sqrSideUU);
+      ILAC_SphereFinder sf;
+      sf.findSpheres ( cb.getSquare ( ILAC_Chessboard::numSamples ), img,
+                       sphDiamUU * pixPerUU );
+    }catch(std::exception){
+      set.errors++;
+    }
+
+    set.micro.add ( stats );
+  }
+}
+
+/* From the file to the normalized JPEG, like a user of ILAC_Image */
+static void
+runImage ( ILAC_BenchSet &set, const int iterations, const string &outDir )
+{
+  if ( set.size.area() == 0 )
+    return;
+
+  Mat camMat = benchCamMat ( set.size );
+  Mat disMat = Mat::zeros ( 1, 5, CV_64F );
+  for ( int i = 0 ; i < iterations ; i++ )
+  {
+    int64 begin = getTickCount();
+    try
+    {
+      ILAC_Image image ( set.file, boardSize, camMat, disMat,
+                         sqrSideUU, sphDiamUU, true );
+      image.saveNormalized ( outDir + "/" + set.name + ".jpg", true );
+
+      ILAC_Stats stats = image.getStats();
+      stats.addTime ( "total", (getTickCount() - begin) * 1000
+                               / getTickFrequency() );
+      set.image.add ( stats );
+    }catch(std::exception){
+      set.errors++;
+    }
+  }
+}
+
+/* batch links to the file, through all the stages of ILAC_Pipeline */
+static void
+runBatch ( ILAC_BenchSet &set, const size_t batch, const string &workDir )
+{
+  if ( set.size.area() == 0 || batch == 0 )
+    return;
+
+  char cwd[4096];
+  string target = set.file;
+  if ( target[0] != '/' && getcwd ( cwd, sizeof(cwd) ) != NULL )
+    target = string(cwd) + "/" + target;
+
+  vector<string> files;
+  for ( size_t i = 0 ; i < batch ; i++ )
+  {
+    files.push_back ( workDir + "/" + format ( "batch%03lu_",
+                                               (unsigned long)i )
+                      + set.name + ".jpg" );
+    if ( symlink ( target.data(), files.back().data() ) != 0 )
+    {
+      set.errors++;
+      return;
+    }
+  }
+
+  ILAC_Pipeline pipeline ( boardSize, benchCamMat ( set.size ),
+                           Mat::zeros ( 1, 5, CV_64F ),
+                           sqrSideUU, sphDiamUU );
+  vector<ILAC_PipelineResult> results = pipeline.run ( files,
+                                                       workDir + "/out" );
+  for ( size_t i = 0 ; i < results.size() ; i++ )
+    if ( !results[i].error.empty() )
+      set.errors++;
+  set.batchImages = batch;
+  set.batchSeconds = pipeline.getSeconds();
+
+  for ( size_t i = 0 ; i < files.size() ; i++ )
+    unlink ( files[i].data() );
+}
+
+static int
+removeEntry ( const char *path, const struct stat*, int, struct FTW* )
+{ return remove ( path ); }
+
+static void
+printText ( FILE *out, const vector<ILAC_BenchSet> &sets )
+{
+  for ( size_t i = 0 ; i < sets.size() ; i++ )
+  {
+    fprintf ( out, "== %s %dx%d, %lu errors\n", sets[i].name.data(),
+              sets[i].size.width, sets[i].size.height,
+              (unsigned long)sets[i].errors );
+    fprintf ( out, "-- micro (ms)\n%s", sets[i].micro.toText().data() );
+    fprintf ( out, "-- image (ms)\n%s", sets[i].image.toText().data() );
+    if ( sets[i].batchSeconds > 0 )
+      fprintf ( out, "-- batch: %lu images in %.3f s, %.2f images/s\n",
+                (unsigned long)sets[i].batchImages, sets[i].batchSeconds,
+                sets[i].batchImages / sets[i].batchSeconds );
+  }
+  fprintf ( out, "== peak rss %lu MB\n",
+            (unsigned long)( ILAC_Arena::getPeakRSS() >> 20 ) );
+}
+
+static void
+printJson ( FILE *out, const vector<ILAC_BenchSet> &sets,
+            const int iterations )
+{
+  fprintf ( out, "{\"version\": \"%d.%d\", \"iterations\": %d,"
+            " \"board\": [%d, %d], \"sqrSideUU\": %d, \"sphDiamUU\": %d,"
+            " \"datasets\": [", ILAC_VER_MAJOR, ILAC_VER_MINOR, iterations,
+            boardSize.width, boardSize.height, sqrSideUU, sphDiamUU );
+  for ( size_t i = 0 ; i < sets.size() ; i++ )
+  {
+    double ips = sets[i].batchSeconds > 0
+                 ? sets[i].batchImages / sets[i].batchSeconds : 0;
+    fprintf ( out, "%s\n  {\"name\": %s, \"width\": %d, \"height\": %d,"
+              " \"errors\": %lu,\n   \"micro\": %s,\n   \"image\": %s,\n"
+              "   \"batch\": {\"images\": %lu, \"seconds\": %g,"
+              " \"images_per_sec\": %g}}",
+              i > 0 ? "," : "",
+              ILAC_StatsLog::jsonString ( sets[i].name ).data(),
+              sets[i].size.width, sets[i].size.height,
+              (unsigned long)sets[i].errors,
+              sets[i].micro.toJson().data(), sets[i].image.toJson().data(),
+              (unsigned long)sets[i].batchImages, sets[i].batchSeconds, ips );
+  }
+  fprintf ( out, "\n ],\n \"peak_rss\": %lu}\n",
+            (unsigned long)ILAC_Arena::getPeakRSS() );
+}
+
+/*
+ * 1. PARSE THE ARGUMENTS
+ * 2. RENDER THE SYNTHETIC IMAGES
+ * 3. RUN THE BENCHMARKS
+ * 4. WRITE THE RESULTS
+ */
+int
+main ( int argc, char **argv )
+{
+  /* 1. PARSE THE ARGUMENTS */
+  int iterations = 3;
+  size_t batch = 8;
+  string megapixels = "4,12,24,50";
+  const char *outFile = NULL;
+  bool text = false;
+  int opt;
+  while ( ( opt = getopt ( argc, argv, "n:b:m:o:t" ) ) != -1 )
+    switch ( opt )
+    {
+      case 'n': iterations = max ( 1, atoi ( optarg ) ); break;
+      case 'b': batch = max ( 0, atoi ( optarg ) ); break;
+      case 'm': megapixels = optarg; break;
+      case 'o': outFile = optarg; break;
+      case 't': text = true; break;
+      default:
+        fprintf ( stderr, "Usage: %s [-n ITERATIONS] [-b BATCH]"
+                  " [-m MEGAPIXELS,...|0] [-o FILE] [-t] [IMAGE ...]\n",
+                  argv[0] );
+        return 1;
+    }
+
+  char workTmpl[] = "/tmp/ilac_bench.XXXXXX";
+  if ( mkdtemp ( workTmpl ) == NULL )
+  {
+    fprintf ( stderr, "Could not create a work directory\n" );
+    return 1;
+  }
+  string workDir = workTmpl;
+
+  /* Every image the same way: no hints from the previous image */
+  ILAC_Image::setAutoHint ( false );
+
+  /* The EXIF of the first image is copied around */
+  vector<ILAC_BenchSet> sets;
+  vector<uchar> exif;
+  for ( int i = optind ; i < argc ; i++ )
+  {
+    ILAC_BenchSet set;
+    set.name = baseName ( argv[i] );
+    set.file = argv[i];
+    set.errors = set.batchImages = 0;
+    set.batchSeconds = 0;
+    sets.push_back ( set );
+
+    if ( exif.empty() )
+      try{
+        vector<uchar> fileData;
+        ILAC_DetectCache::readFile ( argv[i], fileData );
+        exif = ILAC_Codec::readExif ( fileData );
+      }catch(std::exception){}
+  }
+
+  /* 2. RENDER THE SYNTHETIC IMAGES */
+  ILAC_Scene scene ( boardSize, sqrSideUU, sphDiamUU );
+  scene.setID ( vector<unsigned short> ( 1, 24 ) );
+  for ( char *mp = strtok ( &megapixels[0], "," ) ; mp != NULL ;
+        mp = strtok ( NULL, "," ) )
+  {
+    if ( atof ( mp ) <= 0 )
+      continue;
+
+    ILAC_BenchSet set;
+    set.name = format ( "synthetic_%gmp", atof ( mp ) );
+    set.file = workDir + "/" + set.name + ".jpg";
+    set.errors = set.batchImages = 0;
+    set.batchSeconds = 0;
+    Mat img = scene.render ( ILAC_Scene::getSize ( atof ( mp ) ) );
+    if ( !imwrite ( set.file, img ) )
+    {
+      fprintf ( stderr, "Could not write %s\n", set.file.data() );
+      return 1;
+    }
+    ILAC_Codec::addExif ( set.file, exif );
+    sets.push_back ( set );
+  }
+
+  /* 3. RUN THE BENCHMARKS */
+  for ( size_t i = 0 ; i < sets.size() ; i++ )
+  {
+    fprintf ( stderr, "%s\n", sets[i].name.data() );
+    runMicro ( sets[i], iterations, exif );
+    runImage ( sets[i], iterations, workDir );
+    runBatch ( sets[i], batch, workDir );
+  }
+  nftw ( workDir.data(), removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+
+  /* 4. WRITE THE RESULTS */
+  FILE *out = outFile == NULL ? stdout : fopen ( outFile, "w" );
+  if ( out == NULL )
+  {
+    fprintf ( stderr, "Could not open %s\n", outFile );
+    return 1;
+  }
+  if ( text )
+    printText ( out, sets );
+  else
+    printJson ( out, sets, iterations );
+  if ( out != stdout )
+    fclose ( out );
+
+  return 0;
+}
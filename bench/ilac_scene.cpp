@@ -0,0 +1,192 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Writes COUNT synthetic ILAC_Scene images into OUTDIR with a random id,
+ * keystone and rotation each, and a ground truth sidecar next to every
+ * image: NAME.json with the id, the inner corners and the spheres (raw
+ * pixels), and the camMat/disMat to process it with. The same SEED gives the
+ * same images.
+ *
+ * ilac_scene [-n COUNT] [-m MEGAPIXELS] [-s SEED] [-b BOARD (5x6)]
+ *            [-k MAXKEYSTONE] [-r MAXROTATION] [-N NOISE] [-q QUALITY]
+ *            [-c fx,fy,cx,cy -d k1,k2,p1,p2[,k3]] OUTDIR
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+#include "ilacScene.h"
+#include "error.h"
+
+static const int sqrSideUU = 10;
+static const int sphDiamUU = 40;
+
+/* Comma separated numbers */
+static vector<double>
+parseList ( const char *list )
+{
+  vector<double> values;
+  char *end;
+  for ( const char *p = list ; *p != '\0' ; p = *end == ',' ? end + 1 : end )
+  {
+    values.push_back ( strtod ( p, &end ) );
+    if ( end == p )
+      return vector<double>();
+  }
+  return values;
+}
+
+static void
+writeTruth ( const string &file, const string &image, ILAC_Scene &scene,
+             const Size &size, const Size &boardSize, const double keystone,
+             const double rotation, const double noise,
+             const Mat &camMat, const Mat &disMat )
+{
+  FILE *out = fopen ( file.data(), "w" );
+  if ( out == NULL )
+    throw ILACExFileError();
+
+  fprintf ( out, "{\"file\": \"%s\", \"width\": %d, \"height\": %d,"
+            " \"board\": [%d, %d], \"sqrSideUU\": %d, \"sphDiamUU\": %d,"
+            " \"keystone\": %g, \"rotation\": %g, \"noise\": %g,\n",
+            image.data(), size.width, size.height, boardSize.width,
+            boardSize.height, sqrSideUU, sphDiamUU, keystone, rotation,
+            noise );
+
+  vector<unsigned short> id = scene.getID();
+  fprintf ( out, " \"id\": [" );
+  for ( size_t i = 0 ; i < id.size() ; i++ )
+    fprintf ( out, "%s%u", i > 0 ? ", " : "", id[i] );
+
+  fprintf ( out, "],\n \"camMat\": [" );
+  for ( int r = 0 ; r < 3 ; r++ )
+    fprintf ( out, "%s[%.10g, %.10g, %.10g]", r > 0 ? ", " : "",
+              camMat.at<double>(r,0), camMat.at<double>(r,1),
+              camMat.at<double>(r,2) );
+  fprintf ( out, "],\n \"disMat\": [" );
+  for ( int i = 0 ; i < disMat.cols ; i++ )
+    fprintf ( out, "%s%.10g", i > 0 ? ", " : "", disMat.at<double>(0,i) );
+
+  vector<Point2f> corners = scene.getCorners ( size );
+  fprintf ( out, "],\n \"corners\": [" );
+  for ( size_t i = 0 ; i < corners.size() ; i++ )
+    fprintf ( out, "%s[%.3f, %.3f]", i > 0 ? ", " : "",
+              corners[i].x, corners[i].y );
+
+  vector<Vec3f> spheres = scene.getSpheres ( size );
+  fprintf ( out, "],\n \"spheres\": [" );
+  for ( size_t i = 0 ; i < spheres.size() ; i++ )
+    fprintf ( out, "%s[%.3f, %.3f, %.3f]", i > 0 ? ", " : "",
+              spheres[i][0], spheres[i][1], spheres[i][2] );
+  fprintf ( out, "]}\n" );
+
+  fclose ( out );
+}
+
+/*
+ * 1. PARSE THE ARGUMENTS
+ * 2. RENDER EVERY SCENE WITH ITS GROUND TRUTH
+ */
+int
+main ( int argc, char **argv )
+{
+  /* 1. PARSE THE ARGUMENTS */
+  int count = 10, quality = 95;
+  double megapixels = 12, maxKeystone = 0.2, maxRotation = 5, noise = 2;
+  uint64 seed = 1;
+  Size boardSize ( 5, 6 );
+  vector<double> cam, dis;
+  bool usage = false;
+  int opt;
+  while ( ( opt = getopt ( argc, argv, "n:m:s:b:k:r:N:q:c:d:" ) ) != -1 )
+    switch ( opt )
+    {
+      case 'n': count = atoi ( optarg ); break;
+      case 'm': megapixels = atof ( optarg ); break;
+      case 's': seed = strtoull ( optarg, NULL, 10 ); break;
+      case 'b':
+        sscanf ( optarg, "%dx%d", &boardSize.width, &boardSize.height );
+        break;
+      case 'k': maxKeystone = atof ( optarg ); break;
+      case 'r': maxRotation = atof ( optarg ); break;
+      case 'N': noise = atof ( optarg ); break;
+      case 'q': quality = atoi ( optarg ); break;
+      case 'c': cam = parseList ( optarg ); break;
+      case 'd': dis = parseList ( optarg ); break;
+      default: usage = true;
+    }
+  if ( usage || optind != argc - 1 || megapixels <= 0
+       || ( !cam.empty() && cam.size() != 4 )
+       || ( !dis.empty() && ( cam.empty() || dis.size() < 4 ) ) )
+  {
+    fprintf ( stderr, "Usage: %s [-n COUNT] [-m MEGAPIXELS] [-s SEED]"
+              " [-b BOARD] [-k MAXKEYSTONE] [-r MAXROTATION] [-N NOISE]"
+              " [-q QUALITY] [-c fx,fy,cx,cy -d k1,k2,p1,p2[,k3]] OUTDIR\n",
+              argv[0] );
+    return 1;
+  }
+  string outDir = argv[optind];
+
+  /* Without -c the images are processed with a pinhole camera */
+  Size size = ILAC_Scene::getSize ( megapixels );
+  Mat camMat = Mat::eye ( 3, 3, CV_64F );
+  camMat.at<double>(0,0) = cam.empty() ? size.width : cam[0];
+  camMat.at<double>(1,1) = cam.empty() ? size.width : cam[1];
+  camMat.at<double>(0,2) = cam.empty() ? size.width / 2.0 : cam[2];
+  camMat.at<double>(1,2) = cam.empty() ? size.height / 2.0 : cam[3];
+  Mat disMat = Mat::zeros ( 1, 5, CV_64F );
+  for ( size_t i = 0 ; i < dis.size() && i < 5 ; i++ )
+    disMat.at<double>(0,i) = dis[i];
+
+  /* 2. RENDER EVERY SCENE WITH ITS GROUND TRUTH */
+  try{
+    ILAC_Scene scene ( boardSize, sqrSideUU, sphDiamUU );
+    if ( !dis.empty() )
+      scene.setLens ( camMat, disMat );
+
+    RNG rng ( seed );
+    vector<int> params;
+    params.push_back ( CV_IMWRITE_JPEG_QUALITY );
+    params.push_back ( quality );
+    for ( int i = 0 ; i < count ; i++ )
+    {
+      double keystone = rng.uniform ( 0.0, maxKeystone );
+      double rotation = rng.uniform ( -maxRotation, maxRotation );
+      scene.setRandomID ( rng );
+      scene.setKeystone ( keystone );
+      scene.setRotation ( rotation );
+      scene.setNoise ( noise, seed + i );
+
+      string name = format ( "scene_%05d", i );
+      if ( !imwrite ( outDir + "/" + name + ".jpg", scene.render ( size ),
+                      params ) )
+        throw ILACExFileError();
+      writeTruth ( outDir + "/" + name + ".json", name + ".jpg", scene,
+                   size, boardSize, keystone, rotation, noise,
+                   camMat, disMat );
+      fprintf ( stderr, "%s\n", name.data() );
+    }
+  }catch(std::exception &e){
+    fprintf ( stderr, "%s\n", e.what() );
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Compares ILAC_Normalizer with the single warpPerspective call that
+ * normalize used to make. Both take the same image to a 5000 wide output
+ * through the same perspective transform. The lens model has no distortion
+ * so the outputs can be compared pixel by pixel.
+ *
+ * normalize_bench IMAGE [ITERATIONS] [THREADS]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <opencv2/opencv.hpp>
+#include "ilacNormalize.h"
+
+static const int normWidth = 5000;
+static const int normHeight = 3333;
+
+/* Milliseconds of the fastest of iterations runs. */
+class ILAC_BenchTimer{
+  public:
+    ILAC_BenchTimer ():best(-1){}
+    void start () { this->begin = getTickCount(); }
+    void stop ()
+    {
+      double ms = (getTickCount() - this->begin) * 1000 / getTickFrequency();
+      if ( this->best < 0 || ms < this->best )
+        this->best = ms;
+    }
+    double getBest () { return this->best; }
+
+  private:
+    int64 begin;
+    double best;
+};
+
+/* Largest per channel difference, ignoring a border of 2 pixels */
+static int
+maxDiff ( const Mat &a, const Mat &b )
+{
+  Mat diff;
+  absdiff ( a, b, diff );
+  diff = diff ( Rect ( 2, 2, diff.cols - 4, diff.rows - 4 ) );
+  double maxVal;
+  minMaxLoc ( diff.reshape(1), NULL, &maxVal );
+  return (int)maxVal;
+}
+
+int
+main ( int argc, char **argv )
+{
+  if ( argc < 2 )
+  {
+    fprintf ( stderr, "Usage: %s IMAGE [ITERATIONS] [THREADS]\n", argv[0] );
+    return 1;
+  }
+  int iterations = argc > 2 ? atoi ( argv[2] ) : 5;
+  int threads = argc > 3 ? atoi ( argv[3] ) : 0;
+
+  Mat src = imread ( argv[1] );
+  if ( src.empty() )
+  {
+    fprintf ( stderr, "Could not read %s\n", argv[1] );
+    return 1;
+  }
+
+  /* A plot seen with some perspective, inside the image */
+  float w = src.cols, h = src.rows;
+  Point2f tvsrc[4] = { Point2f(0.10*w, 0.15*h), Point2f(0.92*w, 0.05*h),
+                       Point2f(0.85*w, 0.95*h), Point2f(0.05*w, 0.80*h) };
+  Point2f tvdst[4] = { Point2f(0,0), Point2f(normWidth,0),
+                       Point2f(normWidth,normHeight), Point2f(0,normHeight) };
+  Mat persTrans = getPerspectiveTransform ( tvsrc, tvdst );
+  Size endSize ( normWidth, normHeight );
+
+  Mat camMat = Mat::eye ( 3, 3, CV_64F );
+  camMat.at<double>(0,0) = camMat.at<double>(1,1) = w;
+  camMat.at<double>(0,2) = w/2;
+  camMat.at<double>(1,2) = h/2;
+  Mat disMat = Mat::zeros ( 1, 5, CV_64F );
+
+  printf ( "%s: %dx%d -> %dx%d, best of %d\n", argv[1], src.cols, src.rows,
+           normWidth, normHeight, iterations );
+
+  Mat reference;
+  ILAC_BenchTimer refTimer;
+  for ( int i = 0 ; i < iterations ; i++ )
+  {
+    refTimer.start ();
+    warpPerspective ( src, reference, persTrans, endSize );
+    refTimer.stop ();
+  }
+  printf ( "%-28s %9.1f ms\n", "warpPerspective", refTimer.getBest() );
+
+  const int inters[] = { INTER_NEAREST, INTER_LINEAR, INTER_CUBIC };
+  const char *names[] = { "nearest", "linear", "cubic" };
+  for ( int j = 0 ; j < 3 ; j++ )
+  {
+    ILAC_Normalizer normalizer ( persTrans, camMat, disMat );
+    normalizer.setInterpolation ( inters[j] );
+    normalizer.setThreads ( threads );
+
+    Mat normImg;
+    ILAC_BenchTimer timer;
+    for ( int i = 0 ; i < iterations ; i++ )
+    {
+      timer.start ();
+      normalizer.warp ( src, normImg, endSize );
+      timer.stop ();
+    }
+
+    string label = string("ILAC_Normalizer ") + names[j];
+    printf ( "%-28s %9.1f ms  x%.2f", label.data(), timer.getBest(),
+             refTimer.getBest() / timer.getBest() );
+    if ( inters[j] == INTER_LINEAR )
+      printf ( "  max diff %d", maxDiff ( reference, normImg ) );
+    printf ( "\n" );
+  }
+
+  return 0;
+}
@@ -16,8 +16,11 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
+#ifndef ILAC_ERROR_H
+#define ILAC_ERROR_H
 
 #include <exception>
+#include <string>
 
 class ILACExInvalidResizeScale:public std::exception{
   virtual const char* what() const throw()
@@ -84,3 +87,16 @@ class ILACExCouldNotCreateQuadType:public std::exception{
 class ILACExOutOfBounds:public std::exception{
   virtual const char* what() const throw(){return "Out of bounds exception.";}
 };
+
+/* A task of an ILAC_ThreadPool threw. Carries the what() of that exception. */
+class ILACExTaskFailed:public std::exception{
+  public:
+    ILACExTaskFailed ( const std::string &message ):message(message){}
+    virtual ~ILACExTaskFailed () throw(){}
+    virtual const char* what() const throw(){return this->message.c_str();}
+
+  private:
+    std::string message;
+};
+
+#endif /* ILAC_ERROR_H */
@@ -0,0 +1,102 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_ARENA_H
+#define ILAC_ARENA_H
+
+#include <opencv2/opencv.hpp>
+#include <pthread.h>
+#include <map>
+
+using namespace cv;
+using std::map;
+
+/*
+ * Per thread cache of image buffers. Consecutive images of a camera have
+ * the same size, and so do their undistorted and normalized images. A buffer
+ * the last image is done with is handed out again to the next one, instead
+ * of going back to the system and being faulted in again.
+ *
+ * A buffer is free when the arena holds its only reference: whoever got it
+ * lets it go by releasing the Mat, in any thread. The capacity bounds the
+ * arenas of all threads together, buffers in use included: free buffers,
+ * ours first, are dropped while a new one would take the total over it.
+ * Only the buffers in use can take it over the capacity.
+ *
+ * The arena also has scratch slots for the temporaries of the labeler. A
+ * slot is one buffer that grows to the largest size asked of it and is
+ * never given back, so once the first images are done nothing is
+ * allocated for them anymore.
+ */
+class ILAC_Arena{
+  public:
+    /*
+     * A size x type Mat, from the arena of the calling thread. Counted in
+     * the current ILAC_Stats as arena_reuse, or as an allocation.
+     */
+    static Mat get ( const Size&, const int );
+
+    /* Bytes of all the arenas. 0 drops buffers as soon as we can */
+    static void setCapacity ( const size_t );
+    static size_t getCapacity ();
+
+    /* Bytes of the arenas of all threads, free, in use and scratch */
+    static size_t getBytes ();
+
+    /* Drops the free buffers of the calling thread */
+    static void trim ();
+
+    /* Largest resident set size of the process so far, in bytes */
+    static size_t getPeakRSS ();
+
+    enum { SCRATCH_SMALL, SCRATCH_HUE, SCRATCH_MASK, SCRATCH_SLOTS };
+
+    /*
+     * A size x type Mat on scratch slot of the calling thread. It only
+     * borrows the slot: it is good until the slot is asked for again and
+     * must not be kept. Growing a slot is counted in the current ILAC_Stats
+     * as scratch_allocs, and as an allocation.
+     */
+    static Mat getScratch ( const int, const Size&, const int );
+
+    /* MORPH_ELLIPSE structuring element of side x side, made once a thread */
+    static Mat getEllipse ( const int );
+
+  private:
+    vector<Mat> buffers; /* Oldest first */
+    Mat scratch[SCRATCH_SLOTS]; /* 1 row of bytes */
+    map<int, Mat> ellipses;
+
+    ~ILAC_Arena ();
+    void drop ( const size_t );
+    void dropFree ( const size_t );
+    static bool isFree ( const Mat& );
+
+    static ILAC_Arena* current ();
+    static void destroy ( void* );
+    static void createKey ();
+    static pthread_key_t key;
+    static pthread_once_t keyOnce;
+
+    static size_t capacity;
+    static size_t bytes;
+    static vector<ILAC_Arena*> arenas; /* Of all threads */
+    static Mutex lock; /* bytes, arenas and the buffers of every arena */
+};
+
+#endif /* ILAC_ARENA_H */
@@ -0,0 +1,81 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_CACHE_H
+#define ILAC_CACHE_H
+
+#include <opencv2/opencv.hpp>
+#include <map>
+#include <stdio.h>
+
+using namespace cv;
+using std::map;
+
+/* What we know about an image. Empty vectors were not calculated. */
+struct ILAC_CacheEntry{
+  vector<unsigned short> id;
+  vector<Point2f> corners; /* Chessboard corners */
+  vector<Point2f> centers; /* Sphere centers */
+  Size size; /* Image size */
+};
+
+/*
+ * Process wide detection cache that lives in a file. The key is the hash of
+ * the image file content plus everything the detection depends on, so a
+ * renamed image is still found and a different camera or board is not. The
+ * file is an append only log: entries are read once when the cache is opened
+ * and every new entry is appended. Later entries win.
+ */
+class ILAC_DetectCache{
+  public:
+    /* Opens or creates the cache file. An empty path disables the cache. */
+    static void open ( const string& );
+    static bool isOpen ();
+
+    /* FNV-1a of a buffer. Second arg is the hash to continue from. */
+    static uint64 hash ( const void*, const size_t,
+                         const uint64 = fnvOffset );
+    static uint64 hash ( const vector<uchar>& );
+
+    /*
+     * content hash, board size, camMat, disMat, detection mode and, for the
+     * spheres, square side, sphere diameter and sphere method
+     */
+    static uint64 makeKey ( const uint64, const Size&,
+                            const Mat&, const Mat&, const int,
+                            const int = 0, const int = 0, const int = 0 );
+
+    static bool lookup ( const uint64, ILAC_CacheEntry& );
+    static void store ( const uint64, const ILAC_CacheEntry& );
+
+    /* Reads the whole file. Throws ILACExFileError. */
+    static void readFile ( const string&, vector<uchar>& );
+
+  private:
+    static const uint64 fnvOffset = 14695981039346656037ULL;
+    static const uint64 fnvPrime = 1099511628211ULL;
+
+    static map<uint64, ILAC_CacheEntry> entries;
+    static FILE *file;
+    static Mutex lock;
+
+    static bool readEntry ( FILE*, uint64&, ILAC_CacheEntry& );
+    static void writeEntry ( FILE*, const uint64, const ILAC_CacheEntry& );
+};
+
+#endif /* ILAC_CACHE_H */
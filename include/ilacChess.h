@@ -16,31 +16,54 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
+#ifndef ILAC_CHESS_H
+#define ILAC_CHESS_H
+
 #include <opencv2/opencv.hpp>
+#include <map>
 #include "ilacLabeler.h"
+#include "ilacStats.h"
 #include "error.h"
 
 using namespace cv;
+using std::map;
 
 class ILAC_Chessboard{
   public:
     enum { CB_MEDIAN, CB_MAXLIKELIHOOD };
 
+    /*
+     * DETECT_FULL searches the corners in the full resolution image.
+     * DETECT_PYRAMID searches in a 1/8 (then 1/4) downscaled image and refines
+     * the corners at full resolution. Falls back to DETECT_FULL on failure.
+     */
+    enum { DETECT_FULL, DETECT_PYRAMID };
+
     ILAC_Chessboard ();
-    ILAC_Chessboard ( const Mat&, const Size& );
+    /* The Rect is an optional hint of where the chessboard should be */
+    ILAC_Chessboard ( const Mat&, const Size&, const int = DETECT_FULL,
+                      const Rect& = Rect() );
 
     vector<Point2f> getPoints ();
+    Rect getBoundingRect ();
 
     size_t getSquaresSize ();
     static size_t getSamplesSize ();
     size_t getDatasSize ();
 
-    ILAC_Square getSquare ( const size_t );
-    ILAC_Square getSampleSquare ( const size_t );
-    ILAC_Square getDataSquare ( const size_t );
+    ILAC_Square& getSquare ( const size_t );
+    ILAC_Square& getSampleSquare ( const size_t );
+    ILAC_Square& getDataSquare ( const size_t );
 
     vector<int> getAssociation ();
 
+    /*
+     * Finds and refines the corners of a dimension sized chessboard in a gray
+     * image. The stages are timed in the current ILAC_Stats.
+     */
+    static bool findCorners ( const Mat&, const Size&, vector<Point2f>&,
+                              const int = DETECT_FULL );
+
     static const size_t numSamples = 6;
 
   protected:
@@ -50,22 +73,36 @@ class ILAC_Chessboard{
   private:
     Size dimension;
     vector<Point2f> cbPoints;
+
+    /* Downscale levels for DETECT_PYRAMID: 1/(2^maxPyrLevel) first. */
+    static const int maxPyrLevel = 3;
+    static const int minPyrLevel = 2;
+
+    /* Do not search in downscaled images with a side smaller than this. */
+    static const int minPyrSide = 320;
+
+    static bool findPyramidCorners ( const Mat&, const Size&,
+                                     vector<Point2f>& );
 };
 
 /* ILAC Chessboard Sampels and Data (SD) */
 class ILAC_Chess_SD:public ILAC_Chessboard{
   public:
     ILAC_Chess_SD ();
-    ILAC_Chess_SD ( const Mat&, const Size&, const int );
+    ILAC_Chess_SD ( const Mat&, const Size&, const int,
+                    const int = DETECT_FULL, const Rect& = Rect() );
 };
 
 /* ILAC Chessboard Sample, Shpere, Data (SSD) */
 class ILAC_Chess_SSD:public ILAC_Chessboard{
   public:
     ILAC_Chess_SSD ();
-    ILAC_Chess_SSD ( const Mat&, const Size&, const int );
+    ILAC_Chess_SSD ( const Mat&, const Size&, const int,
+                     const int = DETECT_FULL, const Rect& = Rect() );
 
     size_t getDatasSize ();
-    ILAC_Square getDataSquare ( const size_t );
+    ILAC_Square& getDataSquare ( const size_t );
     ILAC_Square& getSphereSquare ();
 };
+
+#endif /* ILAC_CHESS_H */
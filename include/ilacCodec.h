@@ -0,0 +1,108 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_CODEC_H
+#define ILAC_CODEC_H
+
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+
+/*
+ * Image decoding that imread can not do for us. libjpeg can decode a JPEG at
+ * 1/2, 1/4 or 1/8 of its size while it does the inverse DCT, which is much
+ * faster than decoding the whole image and resizing it.
+ */
+class ILAC_Codec{
+  public:
+    /* True if the buffer is a JPEG. Its size goes into the Size. */
+    static bool jpegSize ( const vector<uchar>&, Size& );
+
+    /*
+     * Decodes to a BGR image. JPEGs are decoded at 1/scale (1, 2, 4 or 8).
+     * Other formats are decoded with imdecode at full size. An empty Mat on
+     * error.
+     */
+    static Mat decode ( const vector<uchar>&, const int = 1 );
+
+    /*
+     * Same, at full size, into the Mat. A JPEG goes straight into its buffer
+     * when it already has the image size and CV_8UC3 (e.g. from
+     * ILAC_Arena::get). False on error.
+     */
+    static bool decode ( const vector<uchar>&, Mat& );
+
+    /*
+     * EXIF of an encoded image, as the TIFF structure of an Exif APP1
+     * segment. Empty if the image has none or Exiv2 can not read it.
+     */
+    static vector<uchar> readExif ( const vector<uchar>& );
+
+    /*
+     * Puts the EXIF from readExif into an encoded image, in memory. The
+     * image is left as it is if Exiv2 can not write to its format.
+     */
+    static void addExif ( vector<uchar>&, const vector<uchar>& );
+
+    /* Same, for formats we can only write to a file. Rewrites the file. */
+    static void addExif ( const string&, const vector<uchar>& );
+
+    /* Writes the buffer to a file in one go. Throws ILACExFileError */
+    static void writeFile ( const string&, const vector<uchar>& );
+};
+
+struct ILAC_JpegState; /* libjpeg state, see ilacCodec.cpp */
+
+/*
+ * Writes a JPEG a few rows at a time, so the whole image never has to be in
+ * memory. Same settings as imwrite. The EXIF from ILAC_Codec::readExif is
+ * written as the APP1 segment, so the file does not have to be rewritten to
+ * add it. Throws ILACExFileError.
+ */
+class ILAC_JpegWriter{
+  public:
+    ILAC_JpegWriter ();
+    ~ILAC_JpegWriter ();
+
+    /* Call before open. All off by default, like imwrite. */
+    void setProgressive ( const bool );
+    void setOptimize ( const bool ); /* Huffman tables for this image */
+    void setFastDct ( const bool ); /* Less accurate integer DCT */
+
+    /* file name, image size, quality, EXIF */
+    void open ( const string&, const Size&, const int = 95,
+                const vector<uchar>& = vector<uchar>() );
+
+    /* CV_8UC3 BGR rows, from top to bottom */
+    void write ( const Mat& );
+
+    /* Fails if not all the rows were written */
+    void close ();
+
+  private:
+    ILAC_JpegState *state;
+    bool progressive;
+    bool optimize;
+    bool fastDct;
+
+    /* Not copyable */
+    ILAC_JpegWriter ( const ILAC_JpegWriter& );
+    ILAC_JpegWriter& operator= ( const ILAC_JpegWriter& );
+};
+
+#endif /* ILAC_CODEC_H */
@@ -0,0 +1,123 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_ENCODER_H
+#define ILAC_ENCODER_H
+
+#include <opencv2/opencv.hpp>
+#include "ilacCodec.h"
+#include "ilacThread.h"
+
+using namespace cv;
+
+/*
+ * How normalized images are written. The format comes from the file
+ * extension unless it is set. The defaults give the same output as imwrite;
+ * the presets trade size for speed:
+ *   "fast"    JPEG 85 with the integer DCT, PNG level 1
+ *   "archive" JPEG 98 progressive with optimized tables, PNG level 9
+ * TIFF is always LZW. RAW is a binary PPM, without compression or EXIF, for
+ * tools that just want the pixels.
+ */
+class ILAC_Encoder{
+  public:
+    enum { FMT_AUTO, FMT_JPEG, FMT_PNG, FMT_TIFF, FMT_RAW };
+
+    ILAC_Encoder ();
+
+    /* "default", "fast" or "archive". Throws ILACExUnknownError */
+    static ILAC_Encoder getPreset ( const string& );
+
+    /* "jpeg", "png", "tiff" or "raw". Throws ILACExUnknownError */
+    static int getFormat ( const string& );
+
+    void setFormat ( const int );
+    void setJpegQuality ( const int );
+    void setJpegProgressive ( const bool );
+    void setJpegOptimize ( const bool );
+    void setJpegFastDct ( const bool );
+    void setPngLevel ( const int );
+
+    /* The format a file will be written with. FMT_AUTO if unknown */
+    int resolveFormat ( const string& ) const;
+
+    /* Extension of the set format (".jpg", ...). Empty with FMT_AUTO */
+    string getExtension () const;
+
+    /* JPEGs can be written a few rows at a time, see ILAC_JpegWriter */
+    bool canStream ( const string& ) const;
+    void openJpeg ( ILAC_JpegWriter&, const string&, const Size&,
+                    const vector<uchar>& ) const;
+
+    /*
+     * Writes a BGR image with the EXIF from ILAC_Codec::readExif. Throws
+     * ILACExFileError.
+     */
+    void save ( const Mat&, const string&, const vector<uchar>& ) const;
+
+  private:
+    int format;
+    int jpegQuality;
+    bool jpegProgressive;
+    bool jpegOptimize;
+    bool jpegFastDct;
+    int pngLevel;
+};
+
+/*
+ * Encodes images in its own threads, so the caller can go on with the next
+ * image. submit blocks when too many images are waiting, which keeps the
+ * memory bounded.
+ */
+class ILAC_EncodePool{
+  public:
+    /* 0 threads means one thread per cpu */
+    ILAC_EncodePool ( const size_t = 0 );
+    ~ILAC_EncodePool ();
+
+    /* image, file name, EXIF, encoder. The image data is not copied. */
+    void submit ( const Mat&, const string&, const vector<uchar>&,
+                  const ILAC_Encoder& );
+
+    /* Waits for everything submitted. Returns the files that failed. */
+    vector<string> finish ();
+
+  private:
+    struct Job{
+      Mat img;
+      string fileName;
+      vector<uchar> exif;
+      ILAC_Encoder encoder;
+    };
+
+    ILAC_Queue<Job*> jobs;
+    vector<pthread_t> threads;
+    pthread_mutex_t lock;
+    pthread_cond_t idleCond; /* pending went to 0 */
+    size_t pending; /* Submitted and not written yet */
+    vector<string> failed;
+
+    static void* worker ( void* );
+    void work ();
+
+    /* Not copyable */
+    ILAC_EncodePool ( const ILAC_EncodePool& );
+    ILAC_EncodePool& operator= ( const ILAC_EncodePool& );
+};
+
+#endif /* ILAC_ENCODER_H */
@@ -0,0 +1,49 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_HUE_H
+#define ILAC_HUE_H
+
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+
+/*
+ * BGR -> hue. We only ever use the hue of CV_BGR2HSV_FULL, so this writes the
+ * hue plane directly instead of converting to HSV and splitting. The values
+ * are exactly the ones cvtColor gives. There are SSE4.1 and AVX2 versions that
+ * are selected at runtime.
+ */
+class ILAC_Hue{
+  public:
+    enum { PATH_SCALAR, PATH_SSE41, PATH_AVX2 };
+
+    /* CV_8UC3 BGR image -> CV_8UC1 hue image */
+    static void convert ( const Mat&, Mat& );
+
+    /* Converts a row of pixels: bgr source, hue destination, pixels */
+    static void convertRow ( const uchar*, uchar*, const int );
+
+    /* Best path the cpu supports, or the one forced with setPath. */
+    static int getPath ();
+
+    /* Force a path. False if the cpu does not support it. */
+    static bool setPath ( const int );
+};
+
+#endif /* ILAC_HUE_H */
@@ -16,7 +16,11 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
+#ifndef ILAC_IMAGE_H
+#define ILAC_IMAGE_H
+
 #include "ilacChess.h"
+#include "ilacEncoder.h"
 #include <opencv2/opencv.hpp>
 
 using namespace cv;
@@ -27,27 +31,134 @@ class ILAC_Image{
     ILAC_Image ( const string&, const Size&,
                  const Mat&, const Mat&,
                  const int, const int,
-                 const bool = true );
+                 const bool = true, const bool = false,
+                 const int = ILAC_Chessboard::DETECT_FULL );
+    /* Same as above but with an already decoded image */
+    ILAC_Image ( const Mat&, const string&, const Size&,
+                 const Mat&, const Mat&,
+                 const int, const int,
+                 const bool = true, const bool = false,
+                 const int = ILAC_Chessboard::DETECT_FULL );
     ~ILAC_Image ();
 
     vector<unsigned short> getID ();
+
+    /*
+     * What this image cost so far. getTimings are the times only, in
+     * milliseconds. Published to ILAC_StatsLog when the image is deleted.
+     */
+    map<string, double> getTimings ();
+    ILAC_Stats& getStats ();
+
+    /*
+     * Where the chessboard is expected. Must be called before the chessboard
+     * is initialized. With autoHint the last chessboard position of the same
+     * camera is used when no hint is given.
+     */
+    void setChessHint ( const Rect& );
+    static void setAutoHint ( const bool );
+
+    /*
+     * Id only mode for lazy images: JPEGs are decoded at 1/2, 1/4 or 1/8 of
+     * their size, as long as the squares of the last image of the same camera
+     * still have minSquarePix pixels at that size. Falls back to the full
+     * size if the id can not be found. Must be set before the image is
+     * decoded; normalize decodes the full size again.
+     */
+    void setIdOnly ( const bool );
+    static void setMinSquarePix ( const int );
+
+    /*
+     * ILAC_SphereFinder::SF_* method used by calcRefPoints. Plot corners
+     * found, or cached, with another method are dropped.
+     */
+    void setSphereMethod ( const int );
+    /*
+     * Reads the file of the image now. Otherwise it is read when it is first
+     * decoded, or, with the detection cache, when the image is made.
+     */
+    void loadFile ();
+
     void initChess ();
     void calcPixPerUU ();
     void calcID ();
     void calcRefPoints ();
+
+    /*
+     * Plot corners from a full size image: chessboard, pixPerUU and
+     * calcRefPoints, unless the cache had the corners. What normalize needs.
+     */
+    void fullScalePlot ();
     void normalize ();
 
+    /* Normalizes if needed. Shares the data with the image. */
+    Mat getNormalized ();
+
     void saveNormalized ( const string&, const bool = false );
-    /* Calculate image intrinsics */
+
+    /*
+     * EXIF for saveNormalized, from ILAC_Codec::readExif. Images made from a
+     * file read it when they decode the file; images decoded by the caller
+     * get it from here.
+     */
+    void setExif ( const vector<uchar>& );
+
+    /*
+     * Format and settings of saveNormalized. With an encode pool
+     * saveNormalized only normalizes and leaves the writing to the pool; the
+     * pool is not ours and must outlive the call. NULL writes here.
+     */
+    void setEncoder ( const ILAC_Encoder& );
+    void setEncodePool ( ILAC_EncodePool* );
+
+    /*
+     * Size of the normalized image. A positive width (the long side) gives a
+     * width x width/ratio image. Width 0 measures the plot in the image and
+     * scales it to pixPerUU output pixels per UU, or keeps the resolution of
+     * the image if pixPerUU is 0. Nothing is upsampled for nothing.
+     */
+    void setNormSize ( const int, const double = 1.5, const double = 0 );
+
+    /*
+     * saveNormalized of JPEG files warps and encodes in strips. The whole
+     * normalized image is never in memory.
+     */
+    void setStreaming ( const bool );
+
+    /* INTER_NEAREST for quick previews, INTER_LINEAR or INTER_CUBIC */
+    void setInterpolation ( const int );
+
+    /* Threads of the warp, see ILAC_Normalizer::setThreads. Default 0 */
+    void setWarpThreads ( const size_t );
+
+    /*
+     * Memory bounded mode. Buffers are let go as soon as their stage is
+     * done: the undistorted image once the spheres are found, the decoded
+     * image once it is normalized and the normalized image once it is
+     * saved. The file is decoded once. The decoded, undistorted and
+     * normalized images come from the ILAC_Arena of the thread.
+     */
+    void setMemoryBounded ( const bool );
+
+    /*
+     * Calculate image intrinsics. The corners of the images are searched in
+     * parallel (0 threads is one per cpu), with an ILAC_Chessboard::DETECT_*
+     * method. If errors is not NULL it gets the RMS reprojection error of
+     * every image, -1 for the images that were not used.
+     */
     static void calcIntr ( const vector<string>, //image
                            const unsigned int, //size1
                            const unsigned int, //size2
-                           Mat&, Mat& );
+                           Mat&, Mat&,
+                           const int = ILAC_Chessboard::DETECT_FULL,
+                           vector<double>* = NULL, //errors
+                           const size_t = 0 ); //threads
 
   private:
     ILAC_Chess_SSD *cb;
     string image_file;
-    Mat img; //Original image
+    Mat img; //Undistorted image. Made when needed, released after normalize.
+    Mat rawImg; //Decoded image. normalize samples it directly.
     Mat normImg; //Normalized image
     Mat camMat; //Camera intrinsics
     Mat disMat; //Distortion intrinsics.
@@ -55,6 +166,38 @@ class ILAC_Image{
     vector<Point2f> plotCorners;
     Size dimension;
 
+    /*
+     * In lazy mode we do not undistort the whole image. Chessboard and spheres
+     * are detected on the raw image and only their points are undistorted.
+     */
+    bool lazy;
+    int chessDetect; /* ILAC_Chessboard::DETECT_* */
+    Rect chessHint;
+    int sphereMethod;
+
+    /*
+     * Last chessboard position and square side (pixels) per camera and image
+     * size. Our cameras are on fixed rigs, so the board is in almost the same
+     * place and has the same size in every image. Full size coordinates.
+     */
+    struct HintEntry{
+      Mat camMat;
+      Mat disMat;
+      Size size;
+      Rect rect;
+      double squarePix;
+    };
+    static vector<HintEntry> hints;
+    static Mutex hintsLock;
+    static bool autoHint;
+    static int minSquarePix;
+    static const size_t maxHints = 16;
+
+    HintEntry* findHint ();
+    Rect lookupHint ();
+    void storeHint ( const Rect&, const double );
+    int lookupScale ();
+
     /*
      * Pixels per millimeter. Has errors regarding perspective
      * and overall distortion. We will use it to hint at the
@@ -65,22 +208,65 @@ class ILAC_Image{
     int sqrSideUU; /* size of square in same UNIT as diamUU */
 
     /*
-     * The normWidth variable is the width of the normalized image. It can
-     * become non-static in the future. The number 5000 is selected in hope that
-     * most images will have a smaller width. For large images, the normalization
-     * process will not lose resolution. For smaller images, it will replace
-     * non-existing pixels with extrapolations.
+     * The normWidth variable is the width of the normalized image. The default
+     * 5000 is selected in hope that most images will have a smaller width.
+     * For large images, the normalization process will not lose resolution.
+     * For smaller images, it will replace non-existing pixels with
+     * extrapolations. 0 derives the size from the plot, see setNormSize.
      */
-    static const int normWidth = 5000;
+    int normWidth;
 
     /*
      * The relation between width and height in the normalized image. This does
      * not have to do much with the camera and more to do with the shape of the
      * plot. Best case scenario: the plot has normRatio as well.
      */
-    static const int normRatio = 1.5;
+    double normRatio;
+    double normPixPerUU; /* Output pixels per UU when normWidth is 0 */
 
+    bool streaming;
+    bool bounded; /* See setMemoryBounded */
+    int normInter; /* Interpolation of the normalized image */
+    size_t warpThreads;
+    static const int streamRows = 256; /* Rows warped and encoded at once */
+
+    Mat calcNormTrans ( Size& );
+    void streamNormalized ( const string& );
+
+    void init ( const bool );
     static void check_input ( const string&, Size& );
+    friend class ILAC_IntrTask;
+    static bool findIntrCorners ( const string&, const Size&, const int,
+                                  vector<Point2f>&, Size& );
     int calcAngle ( const Point2f&, const Point2f&, const Point2f& );
     Point2f calcChessCenter ( const vector<Point2f> points );
+    Mat& getDetectImg ();
+    Mat& getRawImg ();
+    Mat& getNormSource ( Mat& );
+    void setRefPoints ( const vector<Point2f>&, const vector<Point2f>& );
+
+    /*
+     * With the detection cache the file is read and hashed, but only decoded
+     * when the cache does not have what we need.
+     */
+    bool useCache;
+    uint64 fileHash;
+    uint64 cacheKey;
+    bool fileRead; /* There is nothing more to read into fileData */
+    vector<uchar> fileData;
+    vector<uchar> exif; /* Of the source, see ILAC_Codec::readExif */
+    ILAC_Encoder encoder;
+    ILAC_EncodePool *encodePool;
+    ILAC_Stats stats;
+    void storeCached ( const vector<Point2f>& );
+    void makeCacheKey ();
+    void lookupCached ();
+
+    bool idOnly;
+    int idScale; /* rawImg is 1/idScale of the image */
+    Size fullSize;
+    void toFullScale ();
+    vector<Point2f> toUndistorted ( const vector<Point2f>& );
 };
+
+#endif /* ILAC_IMAGE_H */
@@ -16,6 +16,9 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
+#ifndef ILAC_LABELER_H
+#define ILAC_LABELER_H
+
 #include <opencv2/opencv.hpp>
 #include <math.h>
 
@@ -28,14 +31,29 @@ using namespace cv;
   ceil ( max ( max(p1,p2), max(p3,p4) ) ) \
   - floor ( min ( min(p1,p2), min(p3,p4) ) )
 
+/*
+ * A square is a view into the image it was found in. We keep the four corners
+ * and a reference to the image (no pixels are copied) and sample the pixels
+ * inside the quadrilateral when they are needed. The image must outlive the
+ * square. A released image behaves like an empty square.
+ */
 class ILAC_Square{
 public:
   ILAC_Square ( const Point2f, const Point2f, const Point2f, const Point2f,
               const Mat& );
-  Mat& getImg ();
+
+  Rect getRect (); /* Enclosing rectangle in image coordinates */
+  Size getSize ();
+
+  /* First and last pixel of row that are inside the square. */
+  bool getSpan ( const int, int&, int& );
+
+  /* Hue histogram (256 bins, CV_BGR2HSV_FULL hue) of the inside pixels. */
+  void calcHueHist ( unsigned long* );
 
 private:
-  Mat img; /* RGB image of the square*/
+  const Mat *img; /* BGR image the square was found in. */
+  Point2f corners[4]; /* ul, ur, lr, ll */
 };
 
 class ILAC_ColorClassifier{
@@ -63,28 +81,66 @@ class ILAC_Median_CC : public ILAC_ColorClassifier{
     virtual void classify ();
 
   private:
+    /* hueLut[hue] is the class (offset in samples) of a pixel with hue */
+    uchar hueLut[256];
+
+    void calcHueLut ();
     int calcHueMedian ( ILAC_Square& );
+    int calcHueMedian ( const unsigned long* );
 };
 
 class ILAC_Sphere{
   public:
     ILAC_Sphere ();
-    ILAC_Sphere ( const Mat*, const Point, const int );
+    ILAC_Sphere ( const Point, const int );
 
-    Mat* getImg ();
     Point getCenter ();
     int getRadius ();
 
   private:
-    Mat *img;
     Point center;
     int radius;
 };
 
 class ILAC_SphereFinder{
   public:
-    ILAC_SphereFinder();
+    /*
+     * SF_FULL runs morphology and HoughCircles on the whole image.
+     * SF_ROI finds sphere like blobs in a downscaled mask first and only runs
+     * morphology and HoughCircles around them. Falls back to SF_FULL unless
+     * it finds exactly three sphere sized circles apart from each other.
+     * SF_ROI is the default.
+     * SF_PYRAMID downscales the image until the sphere is 16 to 32 pixels
+     * wide, runs morphology and HoughCircles there and refines the centers at
+     * full resolution with the centroid of the blob of each circle. Falls
+     * back to SF_FULL.
+     */
+    enum { SF_FULL, SF_ROI, SF_PYRAMID };
+
+    ILAC_SphereFinder( const int = SF_ROI );
 
     /* Might be a good idea to virtualize in the future */
     vector<ILAC_Sphere> findSpheres ( ILAC_Square&, Mat&, const size_t );
+
+  private:
+    int method;
+
+    /* Sphere diameter, in pixels, in the downscaled candidate mask. */
+    static const int minCandDiam = 8;
+
+    /* Minimum 4*pi*area/perimeter^2 of a candidate blob. 1 is a circle */
+    static const double minCircularity;
+
+    /* Smallest sphere diameter, in pixels, at the SF_PYRAMID level. */
+    static const int minPyrDiam = 16;
+
+    vector<Rect> findCandidates ( const Mat&, const Scalar&, const Scalar&,
+                                  const size_t );
+    static bool validRoiCircles ( const vector<Vec3f>&, const size_t );
+    void findCircles ( const Mat&, const Scalar&, const Scalar&,
+                       const size_t, const Point, vector<Vec3f>& );
+    void findPyramidCircles ( const Mat&, const Scalar&, const Scalar&,
+                              const size_t, vector<Vec3f>& );
 };
+
+#endif /* ILAC_LABELER_H */
@@ -0,0 +1,85 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_NORMALIZE_H
+#define ILAC_NORMALIZE_H
+
+#include <opencv2/opencv.hpp>
+#include "ilacUndistort.h"
+#include "ilacThread.h"
+
+using namespace cv;
+
+/*
+ * Takes the raw (distorted) image straight to the normalized image. For every
+ * normalized pixel we go through the inverse perspective transform to the
+ * undistorted space and through the lens model to the raw image.
+ *
+ * The normalized image is cut in tiles. The map of a tile and the part of the
+ * raw image it reads (its footprint) are small enough to stay in the cache,
+ * and tiles outside of the raw image are not interpolated at all. The tiles
+ * are processed on a work stealing ILAC_ThreadPool. The pool belongs to the
+ * calling thread and is kept for the next normalizers of that thread, so
+ * nothing is started or joined per image.
+ */
+class ILAC_Normalizer{
+  public:
+    /* perspective transform (undistorted -> normalized), camMat, disMat */
+    ILAC_Normalizer ( const Mat&, const Mat&, const Mat& );
+
+    /*
+     * INTER_NEAREST, INTER_LINEAR (default) or INTER_CUBIC. Nearest is
+     * several times faster and good enough for previews.
+     */
+    void setInterpolation ( const int );
+
+    /* 0 threads means one thread per cpu, 1 warps in the calling thread */
+    void setThreads ( const size_t );
+
+    /* Normalize the whole raw image into a Size sized image. */
+    void warp ( const Mat&, Mat&, const Size& );
+
+    /* Normalize only the rows of dst. Second arg is the first row of dst. */
+    void warpBlock ( const Mat&, Mat&, const int );
+
+    /* Normalize one tile in this thread. dst starts at (firstCol, firstRow) */
+    void warpTile ( const Mat&, Mat&, const int, const int );
+
+  private:
+    Mat invTrans; /* normalized -> undistorted */
+    ILAC_LensModel lens;
+    int interpolation;
+    size_t numThreads;
+
+    /*
+     * A 64x64 tile has a 32K map and, for 1:1 scales, a footprint of about
+     * 12K pixels. Both fit in L2 together with the output tile.
+     */
+    static const int tileSide = 64;
+
+    void buildMap ( Mat&, const int, const int );
+
+    /* Pool of the calling thread with numThreads threads */
+    static ILAC_ThreadPool* getPool ( const size_t );
+    static void destroyPool ( void* );
+    static void createPoolKey ();
+    static pthread_key_t poolKey;
+    static pthread_once_t poolOnce;
+};
+
+#endif /* ILAC_NORMALIZE_H */
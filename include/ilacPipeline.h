@@ -0,0 +1,122 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_PIPELINE_H
+#define ILAC_PIPELINE_H
+
+#include "ilacImage.h"
+#include "ilacThread.h"
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+
+struct ILAC_PipelineResult{
+  string file;
+  string outFile; /* Empty if there was an error */
+  vector<unsigned short> id;
+  string error; /* Empty if there was no error */
+};
+
+/*
+ * Normalizes and classifies a list of images. Every image goes through
+ * decode -> detect (chessboard, id, spheres) -> warp -> encode. Each stage has
+ * its own threads and a bounded queue in front of it, so reading and writing
+ * the disk overlap with the cpu heavy stages and no stage runs away from the
+ * others.
+ */
+class ILAC_Pipeline{
+  public:
+    enum { STAGE_DECODE, STAGE_DETECT, STAGE_WARP, STAGE_ENCODE,
+           STAGE_COUNT };
+
+    /* boardSize, camMat, disMat, sqrSize, sphSize */
+    ILAC_Pipeline ( const Size&, const Mat&, const Mat&,
+                    const int, const int );
+
+    /*
+     * Threads of a stage. 0 means one per cpu. These are all the threads a
+     * stage gets: the warp of every image runs in its warp (or, streaming,
+     * encode) thread only.
+     */
+    void setThreads ( const int, const size_t );
+    /* Images waiting in front of each stage */
+    void setQueueSize ( const size_t );
+    void setLazy ( const bool );
+    void setChessDetect ( const int );
+    /* See ILAC_Image::setNormSize and setStreaming */
+    void setNormSize ( const int, const double = 1.5, const double = 0 );
+    void setStreaming ( const bool );
+
+    /* A set format also gives the output files its extension */
+    void setEncoder ( const ILAC_Encoder& );
+
+    /*
+     * Images in ILAC_Image::setMemoryBounded mode. The decode stage only
+     * reads the files, so the queues hold file contents, not images.
+     */
+    void setMemoryBounded ( const bool );
+
+    /*
+     * Processes files into outDir/<id>/<file name>. Returns one result per
+     * file in the order of files.
+     */
+    vector<ILAC_PipelineResult> run ( const vector<string>&, const string& );
+
+    /* Of the last run */
+    double getSeconds ();
+    double getImagesPerSec ();
+
+  private:
+    Size boardSize;
+    Mat camMat;
+    Mat disMat;
+    int sqrSize;
+    int sphSize;
+    bool lazy;
+    int chessDetect;
+    int normWidth;
+    double normRatio;
+    double normPixPerUU;
+    bool streaming; /* The warp is done while encoding */
+    bool bounded;
+    ILAC_Encoder encoder;
+    size_t threads[STAGE_COUNT];
+    size_t queueSize;
+
+    /* State of a run. Images are passed between stages by index */
+    string outDir;
+    vector<string> files;
+    vector<ILAC_Image*> images;
+    vector<ILAC_PipelineResult> results;
+    vector< ILAC_Queue<size_t>* > queues; /* queues[s] feeds stage s */
+    size_t running[STAGE_COUNT]; /* Threads of each stage still running */
+    pthread_mutex_t runningLock;
+    double seconds;
+    size_t processed;
+
+    struct Worker{
+      ILAC_Pipeline *pipeline;
+      int stage;
+    };
+    static void* work ( void* );
+    void workStage ( const int );
+    void process ( const int, const size_t );
+    void decode ( const size_t );
+};
+
+#endif /* ILAC_PIPELINE_H */
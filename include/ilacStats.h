@@ -0,0 +1,150 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_STATS_H
+#define ILAC_STATS_H
+
+#include <opencv2/opencv.hpp>
+#include <pthread.h>
+#include <stdio.h>
+#include <map>
+
+using namespace cv;
+using std::map;
+
+/*
+ * Where the time of one image goes. Times are milliseconds, counters are
+ * whatever they count (pixels, allocations, bytes). Every thread has a
+ * current ILAC_Stats, set with ILAC_StatsScope; ILAC_Timer and count add to
+ * it. Threads without one record nothing, so the instrumented code costs
+ * almost nothing when nobody is looking. ILAC_ThreadPool tasks record into
+ * the stats of the thread that called run.
+ */
+class ILAC_Stats{
+  public:
+    void addTime ( const string&, const double );
+    void addCount ( const string&, const double );
+    void merge ( const ILAC_Stats& );
+    bool empty () const;
+
+    map<string, double> getTimes () const;
+    map<string, double> getCounts () const;
+
+    /* Times with a "_ms" suffix and counters, in one map */
+    map<string, double> getAll () const;
+
+    /* Stats of the calling thread, NULL if none */
+    static ILAC_Stats* current ();
+
+    /* Adds to the counter of the current stats, if any */
+    static void count ( const string&, const double = 1 );
+
+    /*
+     * A frame buffer of the Mat's size that we make, or that a call we make
+     * allocates. Counted in frame_allocs and frame_alloc_bytes. Not every
+     * allocation: the temporaries inside OpenCV are not seen.
+     */
+    static void countAlloc ( const Mat& );
+
+  private:
+    map<string, double> times;
+    map<string, double> counts;
+
+    friend class ILAC_StatsScope;
+    static pthread_key_t key;
+    static pthread_once_t keyOnce;
+    static void createKey ();
+    static void setCurrent ( ILAC_Stats* );
+};
+
+/* Makes stats the current of this thread while it lives. Scopes nest. */
+class ILAC_StatsScope{
+  public:
+    ILAC_StatsScope ( ILAC_Stats* );
+    ~ILAC_StatsScope ();
+
+  private:
+    ILAC_Stats *previous;
+};
+
+/*
+ * Adds the time between construction and destruction to name in the current
+ * stats. Does not read the clock when there are no current stats.
+ */
+class ILAC_Timer{
+  public:
+    ILAC_Timer ( const char* );
+    ~ILAC_Timer ();
+
+  private:
+    ILAC_Stats *stats;
+    const char *name;
+    int64 start;
+};
+
+/* Percentiles of the stats of many images, value by value. */
+class ILAC_StatsSummary{
+  public:
+    void add ( const ILAC_Stats& );
+    void clear ();
+    bool empty () const;
+
+    /* Names in getAll form */
+    vector<string> getNames () const;
+    size_t getCount ( const string& ) const;
+    double getMean ( const string& ) const;
+
+    /* Nearest rank percentile, 0 to 100. 0 for unknown names */
+    double getPercentile ( const string&, const double ) const;
+
+    /* name n mean p50 p90 p99 max, one value per line */
+    string toText () const;
+    string toJson () const;
+
+  private:
+    map<string, vector<double> > values;
+};
+
+/*
+ * Where finished images go: optionally a process wide summary and a sink
+ * file with one line per image, text or (for *.json files) JSON.
+ */
+class ILAC_StatsLog{
+  public:
+    /* file name, stats of the image. Called when the image is done. */
+    static void publish ( const string&, const ILAC_Stats& );
+
+    /* Start (clears it) or stop the summary */
+    static void setSummary ( const bool );
+    static ILAC_StatsSummary getSummary ();
+
+    /* Empty path closes it. Throws ILACExFileError */
+    static void openSink ( const string& );
+
+    /* JSON string of s, quotes included */
+    static string jsonString ( const string& );
+
+  private:
+    static Mutex lock;
+    static bool collect;
+    static ILAC_StatsSummary summary;
+    static FILE *sink;
+    static bool jsonSink;
+};
+
+#endif /* ILAC_STATS_H */
@@ -0,0 +1,170 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_THREAD_H
+#define ILAC_THREAD_H
+
+#include "ilacStats.h"
+#include <pthread.h>
+#include <vector>
+#include <deque>
+#include <string>
+
+using std::vector;
+using std::deque;
+using std::string;
+
+/* Work for ILAC_ThreadPool. run is called once for every item offset. */
+class ILAC_Task{
+  public:
+    virtual ~ILAC_Task ();
+
+    /*
+     * Called from the pool threads, several at the same time. What it
+     * records in ILAC_Stats goes to the stats of the caller of
+     * ILAC_ThreadPool::run. The first exception stops the run: the items not
+     * started yet are skipped and run throws ILACExTaskFailed with its
+     * message.
+     */
+    virtual void run ( const size_t ) = 0;
+};
+
+class ILAC_ThreadPool{
+  public:
+    /* 0 threads means one thread per cpu */
+    ILAC_ThreadPool ( const size_t = 0 );
+    ~ILAC_ThreadPool ();
+
+    /*
+     * Runs task.run(0) ... task.run(size-1) and waits until all are done.
+     * Items are handed out one by one from a shared counter. With steal
+     * every thread starts with its own contiguous range of items and, when
+     * it runs out, takes half of what is left in the largest range of
+     * another thread. Neighbouring items stay in the same thread, which is
+     * what we want when they share input (e.g. image tiles). Throws
+     * ILACExTaskFailed once all threads are out if a task.run threw.
+     */
+    void run ( ILAC_Task&, const size_t, const bool = false );
+
+    size_t getNumThreads ();
+    static size_t getNumCpus ();
+
+  private:
+    vector<pthread_t> threads;
+    pthread_mutex_t lock;
+    pthread_cond_t workCond; /* There is new work, or we quit */
+    pthread_cond_t doneCond; /* The last item of the work is done */
+
+    ILAC_Task *task;
+    ILAC_Stats *stats; /* Current stats of the caller of run, or NULL */
+    size_t next; /* Next item offset to hand out */
+    size_t size; /* Number of items */
+    size_t done; /* Finished items */
+    unsigned long generation; /* Incremented for every run */
+    bool quit;
+    bool failed; /* A task.run of the current run threw */
+    string error; /* what() of the first exception */
+
+    /* Items [begin, end) not taken yet. One per thread. */
+    struct StealRange{
+      pthread_mutex_t lock;
+      size_t begin;
+      size_t end;
+    };
+    vector<StealRange*> ranges;
+    bool steal;
+    size_t started; /* Threads that got their range offset */
+    size_t active; /* Threads working on the current run */
+
+    static void* worker ( void* );
+    void work ();
+    size_t workStealing ( const size_t );
+    void runItem ( ILAC_Task*, const size_t );
+    bool takeItem ( const size_t, size_t& );
+};
+
+/*
+ * Bounded FIFO between threads. push blocks while the queue is full and pop
+ * blocks while it is empty. This gives us back-pressure: a fast stage waits
+ * for the slow one instead of filling the memory. After close, pop returns
+ * false once the queue is empty.
+ */
+template <typename T>
+class ILAC_Queue{
+  public:
+    ILAC_Queue ( const size_t capacity )
+      :capacity(capacity > 0 ? capacity : 1), closed(false)
+    {
+      pthread_mutex_init ( &this->lock, NULL );
+      pthread_cond_init ( &this->notEmpty, NULL );
+      pthread_cond_init ( &this->notFull, NULL );
+    }
+
+    ~ILAC_Queue ()
+    {
+      pthread_cond_destroy ( &this->notFull );
+      pthread_cond_destroy ( &this->notEmpty );
+      pthread_mutex_destroy ( &this->lock );
+    }
+
+    void push ( const T &item )
+    {
+      pthread_mutex_lock ( &this->lock );
+      while ( this->items.size() >= this->capacity )
+        pthread_cond_wait ( &this->notFull, &this->lock );
+      this->items.push_back ( item );
+      pthread_cond_signal ( &this->notEmpty );
+      pthread_mutex_unlock ( &this->lock );
+    }
+
+    bool pop ( T &item )
+    {
+      pthread_mutex_lock ( &this->lock );
+      while ( this->items.empty() && !this->closed )
+        pthread_cond_wait ( &this->notEmpty, &this->lock );
+
+      bool popped = !this->items.empty();
+      if ( popped )
+      {
+        item = this->items.front();
+        this->items.pop_front();
+        pthread_cond_signal ( &this->notFull );
+      }
+      pthread_mutex_unlock ( &this->lock );
+      return popped;
+    }
+
+    /* No more pushes. Wakes up everybody waiting in pop. */
+    void close ()
+    {
+      pthread_mutex_lock ( &this->lock );
+      this->closed = true;
+      pthread_cond_broadcast ( &this->notEmpty );
+      pthread_mutex_unlock ( &this->lock );
+    }
+
+  private:
+    deque<T> items;
+    size_t capacity;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+};
+
+#endif /* ILAC_THREAD_H */
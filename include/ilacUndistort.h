@@ -0,0 +1,89 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef ILAC_UNDISTORT_H
+#define ILAC_UNDISTORT_H
+
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+
+/*
+ * Process wide cache of undistortion maps. cv::undistort recalculates the
+ * rectification map for every call. Our images come from a handful of
+ * cameras, so we calculate the map once per (camMat, disMat, image size) and
+ * remap every image after that.
+ */
+class ILAC_UndistortCache{
+  public:
+    static void undistort ( const Mat&, Mat&, const Mat&, const Mat& );
+
+    /*
+     * Fixed point maps (CV_16SC2) use less memory bandwidth in remap, but the
+     * interpolation is quantized. Float maps give the same result as
+     * cv::undistort.
+     */
+    static void setFixedPoint ( const bool );
+    static bool getFixedPoint ();
+    static void clear ();
+
+    /* True if both matrices hold exactly the same values */
+    static bool sameMat ( const Mat&, const Mat& );
+
+  private:
+    struct MapEntry{
+      Mat camMat;
+      Mat disMat;
+      Size size;
+      bool fixedPoint;
+      Mat map1;
+      Mat map2;
+    };
+
+    static vector<MapEntry> maps;
+    static Mutex mapsLock;
+    static bool fixedPoint;
+
+    /* Oldest map is dropped when we see more cameras than this. */
+    static const size_t maxMaps = 8;
+};
+
+/*
+ * The camera model from camMat and disMat. We use it when we skip the full
+ * frame undistortion and work on the raw image instead: points are taken
+ * from the raw image to the undistorted space and undistorted pixel positions
+ * are taken back to the raw image.
+ */
+class ILAC_LensModel{
+  public:
+    ILAC_LensModel ( const Mat&, const Mat& );
+
+    /* Undistorted pixel -> raw pixel. Same model as initUndistortRectifyMap */
+    Point2f distort ( const double, const double ) const;
+
+    /* Raw pixels -> undistorted pixels. */
+    vector<Point2f> undistort ( const vector<Point2f>& ) const;
+
+  private:
+    Mat camMat;
+    Mat disMat;
+    double fx, fy, cx, cy, skew;
+    double k[8]; /* k1, k2, p1, p2, k3, k4, k5, k6. Missing ones are 0 */
+};
+
+#endif /* ILAC_UNDISTORT_H */
@@ -34,9 +34,11 @@ def ilac_classify_file( from_file_name, size1, size2, to_dir, camMat, disMat,
     ilaclog.debug( "ilac_classify_file, from_file:%s, to_dir:%s" \
             % (from_file_name, to_dir) )
 
-    # Let the exception go to the caller.
+    # Let the exception go to the caller. We only need the id, so we use the
+    # lazy mode and skip the full image undistortion. The image is decoded
+    # at a reduced size when the squares are big enough.
     cb = _ilac.IlacCB( from_file_name, size1, size2, camMat, disMat,
-        sqrSize, sphSize )
+        sqrSize, sphSize, lazy = True, pyramid = True, idonly = True )
 
     # Create id string that will be the dir name.
     image_id_dir = ""
@@ -58,7 +60,8 @@ def ilac_classify_file( from_file_name, size1, size2, to_dir, camMat, disMat,
     ilaclog.debug( "Moved %s to %s" % (from_file_name, to_file_name) )
 
 
-def ilac_classify_dir( from_dir, to_dir, size1, size2, camMat, distMat ):
+def ilac_classify_dir( from_dir, to_dir, size1, size2, camMat, distMat,
+    sqrSize = 10, sphSize = 40 ):
     """  Sorts all files contained an a directory without processing them.
     from_dir = Full path of the source dir.
     to_dir = Full path of the destination dir.
@@ -72,14 +75,33 @@ def ilac_classify_dir( from_dir, to_dir, size1, size2, camMat, distMat ):
         if not os.path.isdir(dir):
             raise ILACDirException(dir)
 
-    # classify file for all the /root/files
+    # The ids of all the files are calculated in parallel, without the GIL.
+    file_names = []
     for root, dirs, files in os.walk(from_dir):
         for file in files:
-            try:
-                ilac_classify_file( os.path.join(root,file), \
-                                    size1, size2, to_dir, camMat, disMat )
-            except Exception, err:
-                ilaclog.error( err )
+            file_names.append( os.path.join(root, file) )
+
+    results = _ilac.process_batch( file_names, size1, size2, camMat, distMat,
+        sqrSize, sphSize, lazy = True, pyramid = True )
+
+    for from_file_name, (image_id, err) in zip(file_names, results):
+        if err is not None:
+            ilaclog.error( "File(%s): %s"%(from_file_name, err) )
+            continue
+
+        # Create id string that will be the dir name.
+        image_id_dir = ""
+        for dirpart in image_id:
+            image_id_dir = image_id_dir + str(dirpart)
+
+        to_file_dir = os.path.join(to_dir, image_id_dir)
+        if ( not os.path.isdir( to_file_dir ) ):
+            os.mkdir( to_file_dir )
+
+        to_file_name = os.path.join(to_file_dir,
+                                    os.path.basename(from_file_name))
+        shutil.move( from_file_name, to_file_name )
+        ilaclog.debug( "Moved %s to %s" % (from_file_name, to_file_name) )
 
 def ilac_process_classify_dir ( from_dir, to_dir, \
                                 size1, size2, camMat, disMat, \
@@ -97,33 +119,25 @@ def ilac_process_classify_dir ( from_dir, to_dir, \
         if not os.path.isdir(dir):
             raise ILACDirException(dir)
 
+    file_names = []
     for root, dirs, files in os.walk(from_dir):
         for f in files:
-            try:
-                from_file_name = os.path.join(root, f)
-                cb = _ilac.IlacCB( from_file_name, size1, size2,
-                    camMat, disMat, sqrSize, sphSize )
-            except Exception, err:
-                ilaclog.error( "File(%s): %s"%(from_file_name, err) )
-                continue
-
-            # Create id string that will be the dir name.
-            id_dir = ""
-            for dirpart in cb.img_id():
-                id_dir = id_dir + str(dirpart)
-
-            # Make sure the "new" to_file_dir exists.
-            to_file_dir = os.path.join(to_dir, id_dir)
-            if ( not os.path.isdir( to_file_dir ) ):
-                os.mkdir( to_file_dir )
-
-            # We need the full to_file_name path
-            to_file_name = os.path.join(to_file_dir, f)
-            cb.process_image(to_file_name)
-
-            # tell the user about the move
+            file_names.append( os.path.join(root, f) )
+
+    # Decode, detection, normalization and encoding of different files
+    # overlap in a native pipeline.
+    results, images_per_sec = _ilac.process_pipeline( file_names, to_dir,
+        size1, size2, camMat, disMat, sqrSize, sphSize )
+
+    for from_file_name, (image_id, to_file_name, err) \
+            in zip(file_names, results):
+        if err is not None:
+            ilaclog.error( "File(%s): %s"%(from_file_name, err) )
+        else:
             ilaclog.debug("Moved %s to %s"%(from_file_name, to_file_name))
 
+    ilaclog.debug( "Processed %f images per second" % images_per_sec )
+
 def ilac_calc_intrinsics ( img_dir, size1, size2 ):
     filenames = [];
     for img_file in os.listdir(img_dir):
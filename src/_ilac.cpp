@@ -22,6 +22,11 @@
 #include <opencv2/opencv.hpp>
 #include "ilacConfig.h"
 #include "ilacImage.h"
+#include "ilacUndistort.h"
+#include "ilacThread.h"
+#include "ilacPipeline.h"
+#include "ilacCache.h"
+#include "ilacArena.h"
 
 #define ILAC_RETERR( message ) \
   { \
@@ -29,19 +34,292 @@
     return NULL; \
   }
 
+/* Item i of a sequence (list, tuple, array...) as a double. Needs the GIL. */
+static bool
+ilac_seq_double ( PyObject *seq, const Py_ssize_t i, double &value )
+{
+  PyObject *item = PySequence_GetItem ( seq, i );
+  if ( item == NULL )
+    return false;
+  value = PyFloat_AsDouble ( item );
+  Py_DECREF ( item );
+  return !PyErr_Occurred();
+}
+
+/* Appends value to list as a float. False with a Python error set. */
+static bool
+ilac_list_append_double ( PyObject *list, const double value )
+{
+  PyObject *item = PyFloat_FromDouble ( value );
+  bool appended = item != NULL && PyList_Append ( list, item ) != -1;
+  Py_XDECREF ( item );
+  return appended;
+}
+
+/*
+ * camMat (3x3) and disMat (up to 8) -> CV_64F Mats. Both can be nested lists,
+ * tuples or NumPy arrays. False with a Python error set if they are not.
+ * Needs the GIL.
+ */
+static bool
+ilac_parse_intrinsics ( PyObject *camMat_pylist, PyObject *disMat_pylist,
+                        Mat &camMat_cvmat, Mat &disMat_cvmat )
+{
+  Py_ssize_t disSize = PySequence_Size ( disMat_pylist );
+  if ( disSize < 0 || disSize > 8 || PySequence_Size ( camMat_pylist ) != 3 )
+  {
+    PyErr_SetString ( PyExc_StandardError, "Invalid camMat or disMat." );
+    return false;
+  }
+
+  disMat_cvmat = Mat::zeros( 1, 8, CV_64F );
+  for ( Py_ssize_t i = 0 ; i < disSize ; i++ )
+    if ( !ilac_seq_double ( disMat_pylist, i, disMat_cvmat.at<double>(0,i) ) )
+      return false;
+
+  camMat_cvmat = Mat::zeros( 3, 3, CV_64F );
+  for ( int row = 0 ; row < 3 ; row++ )
+  {
+    PyObject *camRow = PySequence_GetItem ( camMat_pylist, row );
+    bool parsed = camRow != NULL && PySequence_Size ( camRow ) == 3;
+    for ( int col = 0 ; parsed && col < 3 ; col++ )
+      parsed = ilac_seq_double ( camRow, col,
+                                 camMat_cvmat.at<double>(row,col) );
+    Py_XDECREF ( camRow );
+    if ( !parsed )
+    {
+      if ( !PyErr_Occurred() )
+        PyErr_SetString ( PyExc_StandardError, "Invalid camMat." );
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Preset ("default", "fast" or "archive") and format ("jpeg", "png", "tiff",
+ * "raw" or NULL for the file extension) -> encoder. False if unknown.
+ */
+static bool
+ilac_parse_encoder ( const char *preset, const char *format,
+                     ILAC_Encoder &encoder )
+{
+  try {
+    encoder = ILAC_Encoder::getPreset ( preset );
+    if ( format != NULL )
+      encoder.setFormat ( ILAC_Encoder::getFormat ( format ) );
+  }catch(std::exception){
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Used by all the IlacCB objects. See set_encode_threads. Whoever uses the
+ * pool holds a reference from ilac_encode_pool_get to ilac_encode_pool_put,
+ * the global one included, and the last one to let go deletes it. The pool
+ * is not deleted under the feet of a saveNormalized in another thread.
+ */
+struct IlacEncodePoolRef{
+  ILAC_EncodePool *pool;
+  size_t refs;
+};
+static IlacEncodePoolRef *ilac_encode_pool = NULL;
+static Mutex ilac_encode_pool_lock;
+
+/* NULL if there is no pool */
+static IlacEncodePoolRef*
+ilac_encode_pool_get ()
+{
+  AutoLock lock ( ilac_encode_pool_lock );
+  if ( ilac_encode_pool != NULL )
+    ilac_encode_pool->refs++;
+  return ilac_encode_pool;
+}
+
+/* Waits for the jobs of the pool if it is the last reference. No GIL. */
+static void
+ilac_encode_pool_put ( IlacEncodePoolRef *ref )
+{
+  if ( ref == NULL )
+    return;
+  {
+    AutoLock lock ( ilac_encode_pool_lock );
+    if ( --ref->refs > 0 )
+      return;
+  }
+  delete ref->pool;
+  delete ref;
+}
+
+/*{{{ MatView Object*/
+/*
+ * Exports a cv::Mat with the buffer protocol: numpy.asarray(view) is a
+ * HxWxC uint8 array on the Mat memory, without a copy. The view holds a
+ * reference to the Mat data, so the array stays valid after the IlacCB is
+ * gone or has normalized again.
+ */
+typedef struct{
+  PyObject_HEAD
+  Mat *mat;
+  Py_ssize_t shape[3];
+  Py_ssize_t strides[3];
+} MatView;
+
+static void
+MatView_dealloc ( MatView *self )
+{
+  delete self->mat;
+  self->ob_type->tp_free((PyObject*)self);
+}
+
+static int
+MatView_getbuffer ( MatView *self, Py_buffer *view, int flags )
+{
+  Mat &mat = *self->mat;
+  if ( (flags & PyBUF_STRIDES) != PyBUF_STRIDES && !mat.isContinuous() )
+  {
+    PyErr_SetString ( PyExc_BufferError, "The image has row padding." );
+    return -1;
+  }
+
+  view->obj = (PyObject*)self;
+  Py_INCREF ( self );
+  view->buf = mat.data;
+  view->len = mat.rows * mat.cols * mat.elemSize();
+  view->readonly = 0;
+  view->itemsize = 1;
+  view->format = (flags & PyBUF_FORMAT) ? (char*)"B" : NULL;
+  view->ndim = 3;
+  view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+  view->strides = (flags & PyBUF_STRIDES) ? self->strides : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+  return 0;
+}
+
+static PyBufferProcs MatView_as_buffer = {
+  0, 0, 0, 0,                          /* old buffer protocol */
+  (getbufferproc)MatView_getbuffer,    /* bf_getbuffer */
+  0,                                   /* bf_releasebuffer */
+};
+
+static PyTypeObject MatViewType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                         /*ob_size*/
+  "_ilac.MatView",           /*tp_name*/
+  sizeof(MatView),           /*tp_basicsize*/
+  0,                         /*tp_itemsize*/
+  (destructor)MatView_dealloc,/*tp_dealloc*/
+  0,                         /*tp_print*/
+  0,                         /*tp_getattr*/
+  0,                         /*tp_setattr*/
+  0,                         /*tp_compare*/
+  0,                         /*tp_repr*/
+  0,                         /*tp_as_number*/
+  0,                         /*tp_as_sequence*/
+  0,                         /*tp_as_mapping*/
+  0,                         /*tp_hash */
+  0,                         /*tp_call*/
+  0,                         /*tp_str*/
+  0,                         /*tp_getattro*/
+  0,                         /*tp_setattro*/
+  &MatView_as_buffer,        /*tp_as_buffer*/
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+  "Image memory of an IlacCB. Use numpy.asarray on it.", /* tp_doc */
+};
+
+/* New reference to a MatView of mat (8 bit). Needs the GIL. */
+static PyObject*
+MatView_from_mat ( const Mat &mat )
+{
+  MatView *self = PyObject_New ( MatView, &MatViewType );
+  if ( self == NULL )
+    return NULL;
+  self->mat = new Mat ( mat ); /* Shares the data */
+  self->shape[0] = mat.rows;
+  self->shape[1] = mat.cols;
+  self->shape[2] = mat.channels();
+  self->strides[0] = mat.step;
+  self->strides[1] = mat.elemSize();
+  self->strides[2] = 1;
+  return (PyObject*)self;
+}
+/*}}} MatView Object*/
+
 /*{{{ IlacCB Object*/
 typedef struct{
   PyObject_HEAD /* ";" provided by macro*/
   ILAC_Image *ii;
+  Py_buffer image; /* Of the image the object was made from, if any */
+  bool hasImage;
+
+  /*
+   * ILAC_Image is not thread safe and the methods let go of the GIL while
+   * they work on it. Every use of ii holds this, see IlacCBLock.
+   */
+  Mutex *lock;
 } IlacCB;
 
+/*
+ * Holds the lock of an IlacCB while it lives. It is taken without the GIL:
+ * the thread that has it may need the GIL back before it lets go.
+ */
+class IlacCBLock{
+  public:
+    IlacCBLock ( IlacCB *self ):mutex(self->lock)
+    {
+      Py_BEGIN_ALLOW_THREADS
+      this->mutex->lock();
+      Py_END_ALLOW_THREADS
+    }
+    ~IlacCBLock () { this->mutex->unlock(); }
+
+  private:
+    Mutex *mutex;
+};
+
 static void
 IlacCB_dealloc ( IlacCB *self )
 {
-  delete self->ii;
+  delete self->ii; /* Before the buffer it uses */
+  if ( self->hasImage )
+    PyBuffer_Release ( &self->image );
+  delete self->lock;
   self->ob_type->tp_free((PyObject*)self);
 }
 
+/*
+ * A HxWx3 uint8 (BGR) buffer -> Mat on the same memory. Rows may have
+ * padding, pixels may not. The buffer stays in self until dealloc. Needs the
+ * GIL.
+ */
+static bool
+IlacCB_image_from_buffer ( IlacCB *self, PyObject *obj, Mat &image )
+{
+  if ( self->hasImage ) /* From an __init__ that failed */
+    PyBuffer_Release ( &self->image );
+  self->hasImage = false;
+  if ( PyObject_GetBuffer ( obj, &self->image, PyBUF_RECORDS_RO ) != 0 )
+    return false;
+  self->hasImage = true;
+
+  Py_buffer &view = self->image;
+  if ( view.ndim != 3 || view.shape[2] != 3 || view.itemsize != 1
+       || ( view.format != NULL && string(view.format) != "B" )
+       || view.strides[2] != 1 || view.strides[1] != 3
+       || view.strides[0] < 3 * view.shape[1] )
+  {
+    PyErr_SetString ( PyExc_StandardError,
+                      "The image must be a HxWx3 uint8 array." );
+    return false;
+  }
+
+  image = Mat ( view.shape[0], view.shape[1], CV_8UC3, view.buf,
+                view.strides[0] );
+  return true;
+}
+
 /* Creats (not instantiates) new object */
 static PyObject*
 IlacCB_new ( PyTypeObject *type, PyObject *args, PyObject *kwds )
@@ -49,7 +327,11 @@ IlacCB_new ( PyTypeObject *type, PyObject *args, PyObject *kwds )
   IlacCB *self;
   self = (IlacCB *)type->tp_alloc(type, 0);
   if ( self != NULL )
+  {
     self->ii = NULL;
+    self->hasImage = false;
+    self->lock = new Mutex();
+  }
   return (PyObject *)self;
 }
 
@@ -57,41 +339,99 @@ IlacCB_new ( PyTypeObject *type, PyObject *args, PyObject *kwds )
 static int
 IlacCB_init(IlacCB *self, PyObject *args, PyObject *kwds)
 {
-  char *image_file;
+  PyObject *image;
+  Mat image_cvmat;
   int sideCorners1, sideCorners2;
   int sqrSize, sphSize;
+  int lazy = 0, pyramid = 0, idonly = 0;
+  char *spheres = NULL;
   PyObject *camMat_pylist, *disMat_pylist;
   Mat camMat_cvmat, disMat_cvmat;
 
+  IlacCBLock lock ( self );
+
   /* We do nothing if ii has already been created */
   if ( self->ii != NULL )
     return 0;
 
   /* parse incoming arguments. */
-  if ( !PyArg_ParseTuple ( args, "sIIOOII",
-        &image_file, &sideCorners1, &sideCorners2,
-        &camMat_pylist, &disMat_pylist, &sqrSize, &sphSize ) )
+  static char *kwlist[] = { (char*)"image", (char*)"size1", (char*)"size2",
+    (char*)"camMat", (char*)"disMat", (char*)"sqrSize", (char*)"sphSize",
+    (char*)"lazy", (char*)"pyramid", (char*)"spheres", (char*)"idonly",
+    NULL };
+  if ( !PyArg_ParseTupleAndKeywords ( args, kwds, "OIIOOII|iisi", kwlist,
+        &image, &sideCorners1, &sideCorners2,
+        &camMat_pylist, &disMat_pylist, &sqrSize, &sphSize,
+        &lazy, &pyramid, &spheres, &idonly ) )
   {
     PyErr_SetString ( PyExc_StandardError,
         "Invalid parameters for IlacCB_init.");
     return -1;
   }
 
-  /* Lets create the disMat_cvmat var from the disMat_pylist */
-  disMat_cvmat = Mat::zeros( 1, 8, CV_64F );
-  for ( int i = 0 ; i < (int)PyList_Size(disMat_pylist) ; i++ )
-    disMat_cvmat.at<double>(0,i) = PyFloat_AsDouble (
-      PyList_GetItem (disMat_pylist, i) );
+  if ( !ilac_parse_intrinsics ( camMat_pylist, disMat_pylist,
+                                camMat_cvmat, disMat_cvmat ) )
+    return -1;
 
-  camMat_cvmat = Mat::zeros( 3, 3, CV_64F );
-  for ( int i = 0 ; i < 9 ; i++ )
-    camMat_cvmat.at<double>(floor(i/3), i%3) = PyFloat_AsDouble (
-        PyList_GetItem ( PyList_GetItem ( camMat_pylist, floor(i/3) ), i%3 ) );
-
-  /* Instantiate ILAC_Chessboard into an object */
-  self->ii = new ILAC_Image ( image_file, Size(sideCorners1,sideCorners2),
-                              camMat_cvmat, disMat_cvmat,
-                              sqrSize, sphSize, false );
+  /* The image is a file name or a BGR array that we use without a copy */
+  string image_file;
+  if ( PyString_Check ( image ) )
+    image_file = PyString_AsString ( image );
+  else if ( PyUnicode_Check ( image ) )
+  {
+    /* Named the way open() names it */
+    PyObject *encoded =
+      PyUnicode_AsEncodedString ( image, Py_FileSystemDefaultEncoding, NULL );
+    if ( encoded == NULL )
+      return -1;
+    image_file = PyString_AsString ( encoded );
+    Py_DECREF ( encoded );
+  }
+  else if ( !PyObject_CheckBuffer ( image )
+            || !IlacCB_image_from_buffer ( self, image, image_cvmat ) )
+  {
+    if ( !PyErr_Occurred() )
+      PyErr_SetString ( PyExc_StandardError,
+                        "The image must be a file name or an array." );
+    return -1;
+  }
+
+  /* Instantiate ILAC_Chessboard into an object. Reading the image is slow. */
+  const char *error = NULL;
+  ILAC_Image *ii = NULL;
+  Size boardSize ( sideCorners1, sideCorners2 );
+  int detect = pyramid ? ILAC_Chessboard::DETECT_PYRAMID
+                       : ILAC_Chessboard::DETECT_FULL;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    if ( image_cvmat.empty() )
+      ii = new ILAC_Image ( image_file, boardSize, camMat_cvmat, disMat_cvmat,
+                            sqrSize, sphSize, false, lazy, detect );
+    else
+      ii = new ILAC_Image ( image_cvmat, "", boardSize, camMat_cvmat,
+                            disMat_cvmat, sqrSize, sphSize, false, lazy,
+                            detect );
+  }catch(ILACExFileError){
+    error = "Unable to read image file.";
+  }catch(std::exception){
+    error = "Unknown error when reading image.";
+  }
+  Py_END_ALLOW_THREADS
+  if ( error != NULL )
+  {
+    PyErr_SetString ( PyExc_StandardError, error );
+    return -1;
+  }
+  self->ii = ii;
+
+  /* Reduced size decode when we only want the id. Needs lazy. */
+  self->ii->setIdOnly ( idonly );
+
+  /* How the spheres are searched: "roi" (default), "pyramid" or "full" */
+  if ( spheres != NULL && string(spheres) == "pyramid" )
+    self->ii->setSphereMethod ( ILAC_SphereFinder::SF_PYRAMID );
+  else if ( spheres != NULL && string(spheres) == "full" )
+    self->ii->setSphereMethod ( ILAC_SphereFinder::SF_FULL );
   return 0;
 }
 
@@ -102,8 +442,25 @@ IlacCB_process_image ( IlacCB *self, PyObject *args )
   if ( !PyArg_ParseTuple ( args, "s", &outfile ) )
     ILAC_RETERR("Invalid parameters for ilac_calc_process_image.");
 
-  self->ii->normalize ();
-  self->ii->saveNormalized ( outfile );
+  IlacCBLock lock ( self );
+  const char *error = NULL;
+  IlacEncodePoolRef *pool = ilac_encode_pool_get ();
+  self->ii->setEncodePool ( pool != NULL ? pool->pool : NULL );
+  Py_BEGIN_ALLOW_THREADS
+  try { self->ii->normalize ();
+        self->ii->saveNormalized ( outfile );
+  }catch(ILACExLessThanThreeSpheres){
+    error = "Not enough spheres in image";
+  }catch(ILACExFileError){
+    error = "The file already exists";
+  }catch(std::exception){
+    error = "Unknown error when processing image";
+  }
+  self->ii->setEncodePool ( NULL );
+  ilac_encode_pool_put ( pool );
+  Py_END_ALLOW_THREADS
+  if ( error != NULL )
+    ILAC_RETERR ( error );
 
   Py_RETURN_TRUE;
 }
@@ -114,14 +471,22 @@ IlacCB_getID ( IlacCB *self )
   PyObject *list_image_id;
   vector<unsigned short> image_id;
 
+  IlacCBLock lock ( self );
+  const char *error = NULL;
+  Py_BEGIN_ALLOW_THREADS
   try { image_id = self->ii->getID();
   }catch(ILACExNoChessboardFound){
-    ILAC_RETERR ( "Chessboard not found." );
+    error = "Chessboard not found.";
   }catch(ILACExNoneRedSquare){
-    ILAC_RETERR ( "None red square found." );
+    error = "None red square found.";
   }catch(ILACExFileError){
-    ILAC_RETERR ( "Unable to read image file." );
+    error = "Unable to read image file.";
+  }catch(std::exception){
+    error = "Unknown error when calculating the id";
   }
+  Py_END_ALLOW_THREADS
+  if ( error != NULL )
+    ILAC_RETERR ( error );
 
   /*Construct python list that will hold the image id*/
   list_image_id = PyList_New ( image_id.size() );
@@ -138,14 +503,20 @@ IlacCB_getID ( IlacCB *self )
 static PyObject*
 IlacCB_normalize ( IlacCB *self )
 {
+  IlacCBLock lock ( self );
+  const char *error = NULL;
+  Py_BEGIN_ALLOW_THREADS
   try { self->ii->normalize();
   }catch(ILACExLessThanThreeSpheres){
-    ILAC_RETERR ( "Not enough spheres in image" );
+    error = "Not enough spheres in image";
   }catch(ILACExUnknownError){
-    ILAC_RETERR ( "Unknown error when normalizing" );
+    error = "Unknown error when normalizing";
   }catch(std::exception){
-    ILAC_RETERR ( "Unknown error when normalizing" );
+    error = "Unknown error when normalizing";
   }
+  Py_END_ALLOW_THREADS
+  if ( error != NULL )
+    ILAC_RETERR ( error );
   Py_RETURN_TRUE;
 }
 
@@ -156,15 +527,185 @@ IlacCB_save_normalized ( IlacCB *self, PyObject *args )
   if ( !PyArg_ParseTuple ( args, "s", &outfile ) )
     ILAC_RETERR("Invalid parameters for IlacCB_save_normalized.");
 
+  IlacCBLock lock ( self );
+  const char *error = NULL;
+  IlacEncodePoolRef *pool = ilac_encode_pool_get ();
+  self->ii->setEncodePool ( pool != NULL ? pool->pool : NULL );
+  Py_BEGIN_ALLOW_THREADS
   try { self->ii->saveNormalized ( outfile );
   }catch(ILACExFileError){
-    ILAC_RETERR ( "The file already exists" );
+    error = "The file already exists";
   }catch(std::exception){
-    ILAC_RETERR ( "Unknown error when saving normalized" );
+    error = "Unknown error when saving normalized";
   }
+  self->ii->setEncodePool ( NULL );
+  ilac_encode_pool_put ( pool );
+  Py_END_ALLOW_THREADS
+  if ( error != NULL )
+    ILAC_RETERR ( error );
   Py_RETURN_TRUE;
 }
 
+/* MatView of the normalized image. Normalizes first if needed. */
+static PyObject*
+IlacCB_get_normalized ( IlacCB *self )
+{
+  Mat normImg;
+  IlacCBLock lock ( self );
+  const char *error = NULL;
+  Py_BEGIN_ALLOW_THREADS
+  try { normImg = self->ii->getNormalized();
+  }catch(ILACExLessThanThreeSpheres){
+    error = "Not enough spheres in image";
+  }catch(std::exception){
+    error = "Unknown error when normalizing";
+  }
+  Py_END_ALLOW_THREADS
+  if ( error != NULL )
+    ILAC_RETERR ( error );
+  return MatView_from_mat ( normImg );
+}
+
+static PyObject*
+IlacCB_timings ( IlacCB *self )
+{
+  PyObject *timings_dict = PyDict_New ();
+  if ( timings_dict == NULL ){ILAC_RETERR("Error creating a new dict.");}
+
+  IlacCBLock lock ( self );
+  map<string, double> timings = self->ii->getTimings();
+  for ( map<string, double>::iterator timing = timings.begin() ;
+        timing != timings.end() ; ++timing )
+  {
+    PyObject *value = PyFloat_FromDouble ( (*timing).second );
+    if ( value == NULL
+         || PyDict_SetItemString ( timings_dict, (*timing).first.data(),
+                                   value ) == -1 )
+    {
+      Py_XDECREF ( value );
+      Py_DECREF ( timings_dict );
+      ILAC_RETERR("Error creating timings dict elem.");
+    }
+    Py_DECREF ( value );
+  }
+
+  return timings_dict;
+}
+
+/* Times (NAME_ms) and counters in one dict */
+static PyObject*
+IlacCB_stats ( IlacCB *self )
+{
+  PyObject *stats_dict = PyDict_New ();
+  if ( stats_dict == NULL ){ILAC_RETERR("Error creating a new dict.");}
+
+  IlacCBLock lock ( self );
+  map<string, double> stats = self->ii->getStats().getAll();
+  for ( map<string, double>::iterator stat = stats.begin() ;
+        stat != stats.end() ; ++stat )
+  {
+    PyObject *value = PyFloat_FromDouble ( (*stat).second );
+    if ( value == NULL
+         || PyDict_SetItemString ( stats_dict, (*stat).first.data(),
+                                   value ) == -1 )
+    {
+      Py_XDECREF ( value );
+      Py_DECREF ( stats_dict );
+      ILAC_RETERR("Error creating stats dict elem.");
+    }
+    Py_DECREF ( value );
+  }
+
+  return stats_dict;
+}
+
+static PyObject*
+IlacCB_set_chess_hint ( IlacCB *self, PyObject *args )
+{
+  int x, y, width, height;
+  if ( !PyArg_ParseTuple ( args, "(iiii)", &x, &y, &width, &height ) )
+    ILAC_RETERR("Invalid parameters for IlacCB_set_chess_hint.");
+
+  IlacCBLock lock ( self );
+  self->ii->setChessHint ( Rect(x, y, width, height) );
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+IlacCB_set_norm_size ( IlacCB *self, PyObject *args, PyObject *kwds )
+{
+  int width;
+  double ratio = 1.5, pixPerUU = 0;
+  static char *kwlist[] = { (char*)"width", (char*)"ratio",
+    (char*)"pixPerUU", NULL };
+  if ( !PyArg_ParseTupleAndKeywords ( args, kwds, "i|dd", kwlist,
+                                      &width, &ratio, &pixPerUU ) )
+    ILAC_RETERR("Invalid parameters for IlacCB_set_norm_size.");
+
+  IlacCBLock lock ( self );
+  self->ii->setNormSize ( width, ratio, pixPerUU );
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+IlacCB_set_streaming ( IlacCB *self, PyObject *args )
+{
+  PyObject *streaming;
+  if ( !PyArg_ParseTuple ( args, "O", &streaming ) )
+    ILAC_RETERR("Invalid parameters for IlacCB_set_streaming.");
+
+  IlacCBLock lock ( self );
+  self->ii->setStreaming ( PyObject_IsTrue(streaming) );
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+IlacCB_set_memory_bounded ( IlacCB *self, PyObject *args )
+{
+  PyObject *bounded;
+  if ( !PyArg_ParseTuple ( args, "O", &bounded ) )
+    ILAC_RETERR("Invalid parameters for IlacCB_set_memory_bounded.");
+
+  IlacCBLock lock ( self );
+  self->ii->setMemoryBounded ( PyObject_IsTrue(bounded) );
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+IlacCB_set_interpolation ( IlacCB *self, PyObject *args )
+{
+  char *name;
+  if ( !PyArg_ParseTuple ( args, "s", &name ) )
+    ILAC_RETERR("Invalid parameters for IlacCB_set_interpolation.");
+
+  IlacCBLock lock ( self );
+  if ( string(name) == "nearest" )
+    self->ii->setInterpolation ( INTER_NEAREST );
+  else if ( string(name) == "linear" )
+    self->ii->setInterpolation ( INTER_LINEAR );
+  else if ( string(name) == "cubic" )
+    self->ii->setInterpolation ( INTER_CUBIC );
+  else
+    ILAC_RETERR("Interpolation must be nearest, linear or cubic.");
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+IlacCB_set_encoder ( IlacCB *self, PyObject *args, PyObject *kwds )
+{
+  char *preset = (char*)"default", *format = NULL;
+  ILAC_Encoder encoder;
+  static char *kwlist[] = { (char*)"preset", (char*)"format", NULL };
+  if ( !PyArg_ParseTupleAndKeywords ( args, kwds, "|sz", kwlist,
+                                      &preset, &format )
+       || !ilac_parse_encoder ( preset, format, encoder ) )
+    ILAC_RETERR("Invalid parameters for IlacCB_set_encoder.");
+
+  IlacCBLock lock ( self );
+  self->ii->setEncoder ( encoder );
+  Py_RETURN_NONE;
+}
+
 static PyMemberDef IlacCB_members[] = { {NULL} };
 
 static PyMethodDef IlacCB_methods[] = {
@@ -178,6 +719,35 @@ static PyMethodDef IlacCB_methods[] = {
     "Normalizes the image in the object. You can saveNormalized after this"},
   {"saveNormalized", (PyCFunction)IlacCB_save_normalized, METH_VARARGS,
     "Saves normalized image to a FILENAME"},
+  {"setChessHint", (PyCFunction)IlacCB_set_chess_hint, METH_VARARGS,
+    "Search the chessboard around (X, Y, WIDTH, HEIGHT) first"},
+  {"setNormSize", (PyCFunction)IlacCB_set_norm_size,
+    METH_VARARGS | METH_KEYWORDS,
+    "Normalized image of WIDTH x WIDTH/RATIO. WIDTH 0 measures the plot in"
+    " the image and gives it PIXPERUU pixels per unit (default: the image"
+    " resolution)"},
+  {"setStreaming", (PyCFunction)IlacCB_set_streaming, METH_VARARGS,
+    "Warp and encode JPEG files in strips when saving, without keeping the"
+    " normalized image in memory"},
+  {"setMemoryBounded", (PyCFunction)IlacCB_set_memory_bounded, METH_VARARGS,
+    "Let go of every image buffer as soon as it is not needed. Image"
+    " buffers come from the arena, see set_arena_capacity"},
+  {"setInterpolation", (PyCFunction)IlacCB_set_interpolation, METH_VARARGS,
+    "Interpolation of the normalized image: \"nearest\" (previews),"
+    " \"linear\" (default) or \"cubic\""},
+  {"setEncoder", (PyCFunction)IlacCB_set_encoder,
+    METH_VARARGS | METH_KEYWORDS,
+    "How saveNormalized writes: PRESET \"default\" (like imwrite), \"fast\""
+    " or \"archive\", and FORMAT \"jpeg\", \"png\", \"tiff\", \"raw\""
+    " (PPM) or None for the file extension"},
+  {"getNormalized", (PyCFunction)IlacCB_get_normalized, METH_NOARGS,
+    "The normalized image, without writing it. numpy.asarray of the result"
+    " is a HxWx3 BGR uint8 array on the image memory (no copy)"},
+  {"timings", (PyCFunction)IlacCB_timings, METH_NOARGS,
+    "Return a dict with the milliseconds spent in each stage so far"},
+  {"stats", (PyCFunction)IlacCB_stats, METH_NOARGS,
+    "Return a dict with the stage times (NAME_ms) and the counters (bytes,"
+    " pixels, frame_allocs) of the image so far"},
   {NULL}
 };
 
@@ -203,7 +773,11 @@ static PyTypeObject IlacCBType = {
   0,                         /*tp_setattro*/
   0,                         /*tp_as_buffer*/
   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
-  "IlacCB objects",          /* tp_doc */
+  "IlacCB objects. The image is a file name or a HxWx3 uint8 BGR array,"
+  " which is used without a copy: do not change it while the object lives."
+  " camMat and disMat can be lists or arrays. The slow methods release the"
+  " GIL, so different objects can be used from different threads. Do not"
+  " share one object between threads.", /* tp_doc */
   0,                         /* tp_traverse */
   0,                         /* tp_clear */
   0,                         /* tp_richcompare */
@@ -241,15 +815,21 @@ ilac_get_version ( PyObject *self, PyObject *args )
  * 3. CREATE RETURN LIST
  */
 static PyObject*
-ilac_calc_intrinsics ( PyObject *self, PyObject *args )
+ilac_calc_intrinsics ( PyObject *self, PyObject *args, PyObject *kwds )
 {
   PyObject *py_file_list, *ret_list, *tmp_list, *camMat_list, *disMat_list;
   vector<string> images;
+  vector<double> errors;
   int size1, size2;
+  int pyramid = 0, with_errors = 0, threads = 0;
   Mat camMat, disMat;
 
   /* 1. PARSE ARGS */
-  if ( !PyArg_ParseTuple ( args, "Oii", &py_file_list, &size1, &size2 ) )
+  static char *kwlist[] = { (char*)"files", (char*)"size1", (char*)"size2",
+    (char*)"pyramid", (char*)"errors", (char*)"threads", NULL };
+  if ( !PyArg_ParseTupleAndKeywords ( args, kwds, "Oii|iii", kwlist,
+        &py_file_list, &size1, &size2, &pyramid, &with_errors, &threads )
+       || threads < 0 )
     ILAC_RETERR("Invalid parameters for ilac_calc_intrinsics.");
 
   for ( int i = 0 ; i < PyList_Size( py_file_list ) ; i++ )
@@ -257,45 +837,572 @@ ilac_calc_intrinsics ( PyObject *self, PyObject *args )
         (string)PyString_AsString ( PyList_GetItem(py_file_list, i) ) );
 
   /* 2. CALL CALC_IMG_INTRINSICS */
-  ILAC_Image::calcIntr ( images, size1, size2, camMat, disMat );
+  const char *error = NULL;
+  Py_BEGIN_ALLOW_THREADS
+  try { ILAC_Image::calcIntr ( images, size1, size2, camMat, disMat,
+                               pyramid ? ILAC_Chessboard::DETECT_PYRAMID
+                                       : ILAC_Chessboard::DETECT_FULL,
+                               with_errors ? &errors : NULL, threads );
+  }catch(ILACExNoChessboardFound){
+    error = "Chessboard not found.";
+  }catch(std::exception){
+    error = "Unknown error when calculating intrinsics";
+  }
+  Py_END_ALLOW_THREADS
+  if ( error != NULL )
+    ILAC_RETERR ( error );
 
   /*
    * 3. CREATE RETURN LIST
    * ret_list[camMat[[x,x,x],[x,x,x],[x,x,x]], disMat[x,x ... x,x]]
+   * and errors[x, ... x] at the end if they were asked for.
    */
   ret_list = PyList_New(0);
   camMat_list = PyList_New (0);
   disMat_list = PyList_New(0);
-  if ( ret_list == NULL || camMat_list == NULL || disMat_list == NULL )
-    ILAC_RETERR("Error initializing python objects in ilac_calc_intrinsics.");
+  bool ok = ret_list != NULL && camMat_list != NULL && disMat_list != NULL
+            && PyList_Append ( ret_list, camMat_list ) != -1
+            && PyList_Append ( ret_list, disMat_list ) != -1;
+
+  for ( int row = 0 ; ok && row < 3 ; row++ )/* create the camMat rows */
+  {
+    tmp_list = PyList_New (0);
+    ok = tmp_list != NULL && PyList_Append ( camMat_list, tmp_list ) != -1;
+    for ( int col = 0 ; ok && col < 3 ; col++ )
+      ok = ilac_list_append_double ( tmp_list, camMat.at<double>(row,col) );
+    Py_XDECREF ( tmp_list );
+  }
+
+  for ( int col = 0 ; ok && col < disMat.size().width ; col++ )
+    ok = ilac_list_append_double ( disMat_list, disMat.at<double>(0,col) );
+
+  if ( ok && with_errors )
+  {
+    PyObject *errors_list = PyList_New ( 0 );
+    ok = errors_list != NULL && PyList_Append ( ret_list, errors_list ) != -1;
+    for ( size_t i = 0 ; ok && i < errors.size() ; i++ )
+      ok = ilac_list_append_double ( errors_list, errors[i] );
+    Py_XDECREF ( errors_list );
+  }
 
-  if ( PyList_Append ( ret_list, camMat_list ) == -1
-       || PyList_Append ( ret_list, disMat_list ) == -1 )
+  /* ret_list has its own references to the lists in it */
+  Py_XDECREF ( camMat_list );
+  Py_XDECREF ( disMat_list );
+  if ( !ok )
+  {
+    Py_XDECREF ( ret_list );
     ILAC_RETERR("Error initializing python objects in ilac_calc_intrinsics.");
+  }
+  return ret_list;
+}
+
+/*
+ * Calculates the id of every file. One ILAC_Image per file and thread. Lazy
+ * images are decoded at a reduced size when possible.
+ */
+class ILAC_BatchTask : public ILAC_Task{
+  public:
+    ILAC_BatchTask ( const vector<string> &files, const Size &boardSize,
+                     const Mat &camMat, const Mat &disMat,
+                     const int sqrSize, const int sphSize,
+                     const bool lazy, const int chessDetect )
+      :files(files), boardSize(boardSize), camMat(camMat), disMat(disMat),
+       sqrSize(sqrSize), sphSize(sphSize), lazy(lazy),
+       chessDetect(chessDetect), ids(files.size()), errors(files.size()){}
+
+    virtual void run ( const size_t i )
+    {
+      try {
+        ILAC_Image ii ( this->files[i], this->boardSize,
+                        this->camMat, this->disMat,
+                        this->sqrSize, this->sphSize,
+                        false, this->lazy, this->chessDetect );
+        ii.setIdOnly ( true );
+        this->ids[i] = ii.getID();
+      }catch(std::exception &e){
+        this->errors[i] = e.what();
+      }catch(...){
+        this->errors[i] = "Unknown error";
+      }
+    }
+
+    const vector<string> &files;
+    Size boardSize;
+    Mat camMat, disMat;
+    int sqrSize, sphSize;
+    bool lazy;
+    int chessDetect;
+
+    /* One entry per file. The error is empty when the id is valid */
+    vector< vector<unsigned short> > ids;
+    vector<string> errors;
+};
+
+/*
+ * 1. PARSE ARGS
+ * 2. RUN THE POOL WITHOUT THE GIL
+ * 3. CREATE RETURN LIST
+ */
+static PyObject*
+ilac_process_batch ( PyObject *self, PyObject *args, PyObject *kwds )
+{
+  PyObject *py_file_list, *camMat_pylist, *disMat_pylist, *ret_list;
+  int size1, size2, sqrSize, sphSize;
+  int threads = 0, lazy = 1, pyramid = 0;
+  vector<string> files;
+  Mat camMat, disMat;
 
-  //FIXME: add error detection
-  for ( int row = 0 ; row < 3 ; row++ )/* create the camMat rows */
+  /* 1. PARSE ARGS */
+  static char *kwlist[] = { (char*)"files", (char*)"size1", (char*)"size2",
+    (char*)"camMat", (char*)"disMat", (char*)"sqrSize", (char*)"sphSize",
+    (char*)"threads", (char*)"lazy", (char*)"pyramid", NULL };
+  if ( !PyArg_ParseTupleAndKeywords ( args, kwds, "OiiOOii|iii", kwlist,
+        &py_file_list, &size1, &size2, &camMat_pylist, &disMat_pylist,
+        &sqrSize, &sphSize, &threads, &lazy, &pyramid )
+       || !PyList_Check ( py_file_list ) || threads < 0 )
+    ILAC_RETERR("Invalid parameters for ilac_process_batch.");
+
+  for ( int i = 0 ; i < PyList_Size( py_file_list ) ; i++ )
   {
-    tmp_list = PyList_New (0);
-    for ( int col = 0 ; col < 3 ; col++ )
-      PyList_Append ( tmp_list, Py_BuildValue ( "d", camMat.at<double>(row,col) ) );
-    PyList_Append ( camMat_list, tmp_list );
+    char *file = PyString_AsString ( PyList_GetItem(py_file_list, i) );
+    if ( file == NULL )
+      return NULL;
+    files.push_back ( (string)file );
   }
+  if ( !ilac_parse_intrinsics ( camMat_pylist, disMat_pylist,
+                                camMat, disMat ) )
+    return NULL;
 
-  for ( int col = 0 ; col < disMat.size().width ; col++ )/* create disMat */
-    PyList_Append ( disMat_list,
-        Py_BuildValue ( "d", disMat.at<double>(0,col) ) );
+  /* 2. RUN THE POOL WITHOUT THE GIL */
+  ILAC_BatchTask task ( files, Size(size1, size2), camMat, disMat,
+                        sqrSize, sphSize, lazy,
+                        pyramid ? ILAC_Chessboard::DETECT_PYRAMID
+                                : ILAC_Chessboard::DETECT_FULL );
+  Py_BEGIN_ALLOW_THREADS
+  ILAC_ThreadPool pool ( min((size_t)threads, files.size()) );
+  pool.run ( task, files.size() );
+  Py_END_ALLOW_THREADS
+
+  /*
+   * 3. CREATE RETURN LIST
+   * ret_list[(id, None) or (None, error) for every file]
+   */
+  ret_list = PyList_New ( files.size() );
+  if ( ret_list == NULL ){ILAC_RETERR("Error creating a new list.");}
+
+  for ( size_t i = 0 ; i < files.size() ; i++ )
+  {
+    PyObject *result;
+    if ( task.errors[i].empty() )
+    {
+      PyObject *id_list = PyList_New ( task.ids[i].size() );
+      for ( size_t j = 0 ; id_list != NULL && j < task.ids[i].size() ; j++ )
+        PyList_SET_ITEM ( id_list, j, Py_BuildValue("H", task.ids[i][j]) );
+      result = id_list == NULL ? NULL : Py_BuildValue ( "(NO)", id_list, Py_None );
+    }else
+      result = Py_BuildValue ( "(Os)", Py_None, task.errors[i].data() );
+
+    if ( result == NULL )
+    {
+      Py_DECREF ( ret_list );
+      ILAC_RETERR("Error creating batch list elem.");
+    }
+    PyList_SET_ITEM ( ret_list, i, result );
+  }
 
   return ret_list;
 }
 
+/*
+ * 1. PARSE ARGS
+ * 2. RUN THE PIPELINE WITHOUT THE GIL
+ * 3. CREATE RETURN TUPLE
+ */
+static PyObject*
+ilac_process_pipeline ( PyObject *self, PyObject *args, PyObject *kwds )
+{
+  PyObject *py_file_list, *camMat_pylist, *disMat_pylist, *ret_list;
+  char *outDir;
+  int size1, size2, sqrSize, sphSize;
+  int decode = 2, detect = 0, warp = 2, encode = 2, queue = 4;
+  int lazy = 1, pyramid = 0, width = 5000, streaming = 0, lowmem = 0;
+  double ratio = 1.5, pixPerUU = 0;
+  char *preset = (char*)"default", *format = NULL;
+  vector<string> files;
+  vector<ILAC_PipelineResult> results;
+  Mat camMat, disMat;
+  ILAC_Encoder encoder;
+
+  /* 1. PARSE ARGS */
+  static char *kwlist[] = { (char*)"files", (char*)"outDir", (char*)"size1",
+    (char*)"size2", (char*)"camMat", (char*)"disMat", (char*)"sqrSize",
+    (char*)"sphSize", (char*)"decode", (char*)"detect", (char*)"warp",
+    (char*)"encode", (char*)"queue", (char*)"lazy", (char*)"pyramid",
+    (char*)"width", (char*)"ratio", (char*)"pixPerUU", (char*)"streaming",
+    (char*)"preset", (char*)"format", (char*)"lowmem", NULL };
+  if ( !PyArg_ParseTupleAndKeywords ( args, kwds, "OsiiOOii|iiiiiiiiddiszi",
+        kwlist, &py_file_list, &outDir, &size1, &size2, &camMat_pylist,
+        &disMat_pylist, &sqrSize, &sphSize, &decode, &detect, &warp,
+        &encode, &queue, &lazy, &pyramid, &width, &ratio, &pixPerUU,
+        &streaming, &preset, &format, &lowmem )
+       || !PyList_Check ( py_file_list ) || decode < 0 || detect < 0
+       || warp < 0 || encode < 0 || queue < 1
+       || !ilac_parse_encoder ( preset, format, encoder ) )
+    ILAC_RETERR("Invalid parameters for ilac_process_pipeline.");
+
+  for ( int i = 0 ; i < PyList_Size( py_file_list ) ; i++ )
+  {
+    char *file = PyString_AsString ( PyList_GetItem(py_file_list, i) );
+    if ( file == NULL )
+      return NULL;
+    files.push_back ( (string)file );
+  }
+  if ( !ilac_parse_intrinsics ( camMat_pylist, disMat_pylist,
+                                camMat, disMat ) )
+    return NULL;
+
+  /* 2. RUN THE PIPELINE WITHOUT THE GIL */
+  ILAC_Pipeline pipeline ( Size(size1, size2), camMat, disMat,
+                           sqrSize, sphSize );
+  pipeline.setThreads ( ILAC_Pipeline::STAGE_DECODE, decode );
+  pipeline.setThreads ( ILAC_Pipeline::STAGE_DETECT, detect );
+  pipeline.setThreads ( ILAC_Pipeline::STAGE_WARP, warp );
+  pipeline.setThreads ( ILAC_Pipeline::STAGE_ENCODE, encode );
+  pipeline.setQueueSize ( queue );
+  pipeline.setLazy ( lazy );
+  pipeline.setChessDetect ( pyramid ? ILAC_Chessboard::DETECT_PYRAMID
+                                    : ILAC_Chessboard::DETECT_FULL );
+  pipeline.setNormSize ( width, ratio, pixPerUU );
+  pipeline.setStreaming ( streaming );
+  pipeline.setEncoder ( encoder );
+  pipeline.setMemoryBounded ( lowmem );
+
+  const char *error = NULL;
+  Py_BEGIN_ALLOW_THREADS
+  try { results = pipeline.run ( files, outDir );
+  }catch(std::exception){
+    error = "Unable to start the pipeline threads";
+  }
+  Py_END_ALLOW_THREADS
+  if ( error != NULL )
+    ILAC_RETERR ( error );
+
+  /*
+   * 3. CREATE RETURN TUPLE
+   * ([(id, outfile, None) or (None, None, error) per file], images per sec)
+   */
+  ret_list = PyList_New ( results.size() );
+  if ( ret_list == NULL ){ILAC_RETERR("Error creating a new list.");}
+
+  for ( size_t i = 0 ; i < results.size() ; i++ )
+  {
+    PyObject *result;
+    if ( results[i].error.empty() )
+    {
+      PyObject *id_list = PyList_New ( results[i].id.size() );
+      for ( size_t j = 0 ; id_list != NULL && j < results[i].id.size() ; j++ )
+        PyList_SET_ITEM ( id_list, j, Py_BuildValue("H", results[i].id[j]) );
+      result = id_list == NULL ? NULL
+        : Py_BuildValue ( "(NsO)", id_list, results[i].outFile.data(),
+                          Py_None );
+    }else
+      result = Py_BuildValue ( "(OOs)", Py_None, Py_None,
+                               results[i].error.data() );
+
+    if ( result == NULL )
+    {
+      Py_DECREF ( ret_list );
+      ILAC_RETERR("Error creating pipeline list elem.");
+    }
+    PyList_SET_ITEM ( ret_list, i, result );
+  }
+
+  return Py_BuildValue ( "(Nd)", ret_list, pipeline.getImagesPerSec() );
+}
+
+static PyObject*
+ilac_set_undistort_fixed_point ( PyObject *self, PyObject *args )
+{
+  PyObject *fixedPoint;
+  if ( !PyArg_ParseTuple ( args, "O", &fixedPoint ) )
+    ILAC_RETERR("Invalid parameters for ilac_set_undistort_fixed_point.");
+
+  ILAC_UndistortCache::setFixedPoint ( PyObject_IsTrue(fixedPoint) );
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+ilac_set_cache ( PyObject *self, PyObject *args )
+{
+  char *path = NULL;
+  if ( !PyArg_ParseTuple ( args, "z", &path ) )
+    ILAC_RETERR("Invalid parameters for ilac_set_cache.");
+
+  try { ILAC_DetectCache::open ( path == NULL ? "" : path );
+  }catch(std::exception){
+    ILAC_RETERR ( "Unable to open the cache file" );
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+ilac_set_min_square_pix ( PyObject *self, PyObject *args )
+{
+  int minSquarePix;
+  if ( !PyArg_ParseTuple ( args, "i", &minSquarePix ) || minSquarePix < 1 )
+    ILAC_RETERR("Invalid parameters for ilac_set_min_square_pix.");
+
+  ILAC_Image::setMinSquarePix ( minSquarePix );
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+ilac_set_auto_hint ( PyObject *self, PyObject *args )
+{
+  PyObject *autoHint;
+  if ( !PyArg_ParseTuple ( args, "O", &autoHint ) )
+    ILAC_RETERR("Invalid parameters for ilac_set_auto_hint.");
+
+  ILAC_Image::setAutoHint ( PyObject_IsTrue(autoHint) );
+  Py_RETURN_NONE;
+}
+
+/*
+ * Waits for what the old pool has, unless a save in another thread still
+ * uses it. 0 threads goes back to no pool.
+ */
+static PyObject*
+ilac_set_encode_threads ( PyObject *self, PyObject *args )
+{
+  int threads;
+  if ( !PyArg_ParseTuple ( args, "i", &threads ) || threads < 0 )
+    ILAC_RETERR("Invalid parameters for ilac_set_encode_threads.");
+
+  Py_BEGIN_ALLOW_THREADS
+  IlacEncodePoolRef *ref = NULL;
+  if ( threads > 0 )
+  {
+    ref = new IlacEncodePoolRef();
+    ref->pool = new ILAC_EncodePool ( threads );
+    ref->refs = 1;
+  }
+
+  IlacEncodePoolRef *old;
+  {
+    AutoLock lock ( ilac_encode_pool_lock );
+    old = ilac_encode_pool;
+    ilac_encode_pool = ref;
+  }
+  ilac_encode_pool_put ( old );
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+ilac_flush_encodes ( PyObject *self )
+{
+  vector<string> failed;
+  IlacEncodePoolRef *pool = ilac_encode_pool_get ();
+  Py_BEGIN_ALLOW_THREADS
+  if ( pool != NULL )
+    failed = pool->pool->finish ();
+  ilac_encode_pool_put ( pool );
+  Py_END_ALLOW_THREADS
+
+  PyObject *failed_list = PyList_New ( failed.size() );
+  if ( failed_list == NULL ){ILAC_RETERR("Error creating a new list.");}
+  for ( size_t i = 0 ; i < failed.size() ; i++ )
+    PyList_SET_ITEM ( failed_list, i,
+                      PyString_FromString ( failed[i].data() ) );
+  return failed_list;
+}
+
+static PyObject*
+ilac_collect_stats ( PyObject *self, PyObject *args )
+{
+  PyObject *collect;
+  if ( !PyArg_ParseTuple ( args, "O", &collect ) )
+    ILAC_RETERR("Invalid parameters for ilac_collect_stats.");
+
+  ILAC_StatsLog::setSummary ( PyObject_IsTrue(collect) );
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+ilac_stats_summary ( PyObject *self )
+{
+  static const double percentiles[] = { 50, 90, 99, 100 };
+  static const char *keys[] = { "p50", "p90", "p99", "max" };
+
+  ILAC_StatsSummary summary = ILAC_StatsLog::getSummary();
+  vector<string> names = summary.getNames();
+
+  PyObject *summary_dict = PyDict_New ();
+  if ( summary_dict == NULL ){ILAC_RETERR("Error creating a new dict.");}
+  for ( size_t i = 0 ; i < names.size() ; i++ )
+  {
+    PyObject *name_dict =
+      Py_BuildValue ( "{s:k,s:d}",
+                      "n", (unsigned long)summary.getCount(names[i]),
+                      "mean", summary.getMean(names[i]) );
+    bool ok = name_dict != NULL;
+    for ( size_t j = 0 ; ok && j < 4 ; j++ )
+    {
+      PyObject *value =
+        PyFloat_FromDouble ( summary.getPercentile(names[i],
+                                                   percentiles[j]) );
+      ok = value != NULL
+           && PyDict_SetItemString ( name_dict, keys[j], value ) != -1;
+      Py_XDECREF ( value );
+    }
+    ok = ok && PyDict_SetItemString ( summary_dict, names[i].data(),
+                                      name_dict ) != -1;
+    Py_XDECREF ( name_dict );
+    if ( !ok )
+    {
+      Py_DECREF ( summary_dict );
+      ILAC_RETERR("Error creating summary dict elem.");
+    }
+  }
+  return summary_dict;
+}
+
+static PyObject*
+ilac_set_stats_sink ( PyObject *self, PyObject *args )
+{
+  PyObject *path;
+  if ( !PyArg_ParseTuple ( args, "O", &path )
+       || ( path != Py_None && !PyString_Check(path) ) )
+    ILAC_RETERR("Invalid parameters for ilac_set_stats_sink.");
+
+  try{
+    ILAC_StatsLog::openSink ( path == Py_None ? ""
+                                              : PyString_AsString(path) );
+  }catch(ILACExFileError){
+    ILAC_RETERR("Unable to open the stats file.");
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+ilac_peak_rss ( PyObject *self )
+{
+  return PyLong_FromSize_t ( ILAC_Arena::getPeakRSS() );
+}
+
+static PyObject*
+ilac_arena_bytes ( PyObject *self )
+{
+  return PyLong_FromSize_t ( ILAC_Arena::getBytes() );
+}
+
+static PyObject*
+ilac_set_arena_capacity ( PyObject *self, PyObject *args )
+{
+  unsigned long capacity;
+  if ( !PyArg_ParseTuple ( args, "k", &capacity ) )
+    ILAC_RETERR("Invalid parameters for ilac_set_arena_capacity.");
+
+  ILAC_Arena::setCapacity ( capacity );
+  Py_RETURN_NONE;
+}
+
 static struct PyMethodDef ilac_methods [] =
 {
   { "calc_intrinsics",
     (PyCFunction)ilac_calc_intrinsics,
-    METH_VARARGS, "Returns the camera matrix and distortion vector."
-    " [[x,x,x],[x,x,x],[x,x,x]],[x,x,...x] <- (list filenames, int "
-    " sizeofchessboard1, int sizeofchessboard2)"},
+    METH_VARARGS | METH_KEYWORDS, "Returns the camera matrix and distortion"
+    " vector. [[x,x,x],[x,x,x],[x,x,x]],[x,x,...x] <- (list filenames, int "
+    " sizeofchessboard1, int sizeofchessboard2). With errors=1 a third list"
+    " has the reprojection error of every file (-1 if it was not used)."
+    " pyramid=1 searches the corners in downscaled images and threads=N"
+    " limits the threads (default one per cpu)."},
+
+  { "process_batch",
+    (PyCFunction)ilac_process_batch,
+    METH_VARARGS | METH_KEYWORDS, "Calculates the id of every file with a"
+    " pool of THREADS (default one per cpu). One (id, None) or (None, error)"
+    " tuple per file. <- (list filenames, int size1, int size2, camMat,"
+    " disMat, int sqrSize, int sphSize, threads=0, lazy=1, pyramid=0)"},
+
+  { "process_pipeline",
+    (PyCFunction)ilac_process_pipeline,
+    METH_VARARGS | METH_KEYWORDS, "Normalizes every file into"
+    " OUTDIR/<id>/<file name>. Decode, detect, warp and encode run in"
+    " parallel with DECODE, DETECT (default one per cpu), WARP and ENCODE"
+    " threads and QUEUE images between them. Returns a list with one"
+    " (id, outfile, None) or (None, None, error) tuple per file and the"
+    " images per second. <- (list filenames, outDir, int size1, int size2,"
+    " camMat, disMat, int sqrSize, int sphSize, decode=2, detect=0, warp=2,"
+    " encode=2, queue=4, lazy=1, pyramid=0, width=5000, ratio=1.5,"
+    " pixPerUU=0, streaming=0, preset=\"default\", format=None,"
+    " lowmem=0). See IlacCB.setNormSize, setStreaming, setEncoder and"
+    " setMemoryBounded."},
+
+  { "set_undistort_fixed_point",
+    (PyCFunction)ilac_set_undistort_fixed_point,
+    METH_VARARGS, "Use fixed point (CV_16SC2) undistortion maps. Faster but"
+    " slightly less accurate than the default float maps. <- (bool)"},
+
+  { "set_cache",
+    (PyCFunction)ilac_set_cache,
+    METH_VARARGS, "Keep the chessboard corners, sphere centers and ids of"
+    " the images in FILE. Images that are in it are not decoded or"
+    " searched again. None disables the cache. <- (FILE)"},
+
+  { "set_min_square_pix",
+    (PyCFunction)ilac_set_min_square_pix,
+    METH_VARARGS, "Smallest chessboard square side, in pixels, that the"
+    " reduced size decode of idonly images may give. Default 24. <- (int)"},
+
+  { "set_auto_hint",
+    (PyCFunction)ilac_set_auto_hint,
+    METH_VARARGS, "Search the chessboard where it was in the last image of"
+    " the same camera first. On by default. <- (bool)"},
+
+  { "set_encode_threads",
+    (PyCFunction)ilac_set_encode_threads,
+    METH_VARARGS, "Write the normalized images of IlacCB.saveNormalized and"
+    " process_image in N background threads. flush_encodes waits for them."
+    " 0 (default) writes in the calling thread. <- (N)"},
+
+  { "flush_encodes",
+    (PyCFunction)ilac_flush_encodes,
+    METH_NOARGS, "Wait for the background writes. Returns the files that"
+    " could not be written. [file, ...] <- ()"},
+
+  { "collect_stats",
+    (PyCFunction)ilac_collect_stats,
+    METH_VARARGS, "Add the stats of every finished image to a summary."
+    " True starts a new summary, False stops adding. <- (bool)"},
+
+  { "stats_summary",
+    (PyCFunction)ilac_stats_summary,
+    METH_NOARGS, "The summary of collect_stats. {name: {\"n\", \"mean\","
+    " \"p50\", \"p90\", \"p99\", \"max\"}} with IlacCB.stats names"
+    " <- ()"},
+
+  { "set_stats_sink",
+    (PyCFunction)ilac_set_stats_sink,
+    METH_VARARGS, "Append a line with the stats of every finished image to"
+    " FILE, JSON lines if it ends in .json, tab separated otherwise. None"
+    " closes it. <- (FILE)"},
+
+  { "peak_rss",
+    (PyCFunction)ilac_peak_rss,
+    METH_NOARGS, "Largest resident set size of the process so far, in"
+    " bytes. <- ()"},
+
+  { "set_arena_capacity",
+    (PyCFunction)ilac_set_arena_capacity,
+    METH_VARARGS, "Bytes of image buffers all the threads together keep,"
+    " in use or free, for the images of IlacCB.setMemoryBounded. Only the"
+    " buffers in use can go over it. Default 256MB. <- (BYTES)"},
+
+  { "arena_bytes",
+    (PyCFunction)ilac_arena_bytes,
+    METH_NOARGS, "Bytes the arenas of all threads hold now, in use or free."
+    " <- ()"},
 
   { "version",
     (PyCFunction)ilac_get_version,
@@ -309,7 +1416,10 @@ init_ilac (void)
   //(void) Py_InitModule ( "_ilac", ilac_methods );
   PyObject *m;
 
-  if ( PyType_Ready(&IlacCBType) < 0 )
+  /* We release the GIL in the slow parts */
+  PyEval_InitThreads ();
+
+  if ( PyType_Ready(&IlacCBType) < 0 || PyType_Ready(&MatViewType) < 0 )
     return;
 
   m = Py_InitModule3 ( "_ilac", ilac_methods,
@@ -320,5 +1430,7 @@ init_ilac (void)
 
   Py_INCREF ( &IlacCBType );
   PyModule_AddObject ( m, "IlacCB", (PyObject *)&IlacCBType );
+  Py_INCREF ( &MatViewType );
+  PyModule_AddObject ( m, "MatView", (PyObject *)&MatViewType );
 }
 /*}}} ilac Module Methods*/
@@ -0,0 +1,219 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacArena.h"
+#include "ilacStats.h"
+#include <sys/resource.h>
+#include <algorithm>
+
+/*{{{ ILAC_Arena*/
+pthread_key_t ILAC_Arena::key;
+pthread_once_t ILAC_Arena::keyOnce = PTHREAD_ONCE_INIT;
+size_t ILAC_Arena::capacity = 256 << 20; /* A 50MP image and its plot */
+size_t ILAC_Arena::bytes = 0;
+vector<ILAC_Arena*> ILAC_Arena::arenas;
+Mutex ILAC_Arena::lock;
+
+/*
+ * 1. REUSE A FREE BUFFER OF THE SAME SIZE
+ * 2. MAKE ROOM FOR A NEW ONE
+ * 3. ALLOCATE
+ */
+Mat //static method
+ILAC_Arena::get ( const Size &size, const int type )
+{
+  ILAC_Arena *arena = ILAC_Arena::current();
+  vector<Mat> &buffers = arena->buffers;
+  AutoLock lock ( ILAC_Arena::lock );
+
+  /* 1. REUSE A FREE BUFFER OF THE SAME SIZE */
+  for ( size_t i = 0 ; i < buffers.size() ; i++ )
+    if ( ILAC_Arena::isFree ( buffers[i] ) && buffers[i].size() == size
+         && buffers[i].type() == type )
+    {
+      /* Most recently used last, so the oldest are dropped first */
+      Mat buffer = buffers[i];
+      buffers.erase ( buffers.begin() + i );
+      buffers.push_back ( buffer );
+      ILAC_Stats::count ( "arena_reuse" );
+      return buffer;
+    }
+
+  /*
+   * 2. MAKE ROOM FOR A NEW ONE
+   * Our own free buffers go first, then the ones of the other threads.
+   */
+  size_t need = (size_t)size.area() * CV_ELEM_SIZE(type);
+  arena->dropFree ( need );
+  for ( size_t i = 0 ; i < ILAC_Arena::arenas.size() ; i++ )
+    ILAC_Arena::arenas[i]->dropFree ( need );
+
+  /* 3. ALLOCATE */
+  Mat buffer ( size, type );
+  buffers.push_back ( buffer );
+  ILAC_Stats::countAlloc ( buffer );
+  ILAC_Arena::bytes += need;
+  return buffer;
+}
+
+void //static method
+ILAC_Arena::setCapacity ( const size_t capacity )
+{
+  AutoLock lock ( ILAC_Arena::lock );
+  ILAC_Arena::capacity = capacity;
+}
+
+size_t //static method
+ILAC_Arena::getCapacity ()
+{
+  AutoLock lock ( ILAC_Arena::lock );
+  return ILAC_Arena::capacity;
+}
+
+size_t //static method
+ILAC_Arena::getBytes ()
+{
+  AutoLock lock ( ILAC_Arena::lock );
+  return ILAC_Arena::bytes;
+}
+
+void //static method
+ILAC_Arena::trim ()
+{
+  ILAC_Arena *arena = ILAC_Arena::current();
+  AutoLock lock ( ILAC_Arena::lock );
+  for ( size_t i = 0 ; i < arena->buffers.size() ; )
+    if ( ILAC_Arena::isFree ( arena->buffers[i] ) )
+      arena->drop ( i );
+    else
+      i++;
+}
+
+Mat //static method
+ILAC_Arena::getScratch ( const int slot, const Size &size, const int type )
+{
+  CV_Assert ( slot >= 0 && slot < SCRATCH_SLOTS );
+  Mat &scratch = ILAC_Arena::current()->scratch[slot];
+  size_t need = (size_t)size.area() * CV_ELEM_SIZE(type);
+  if ( scratch.total() < need )
+  {
+    {
+      AutoLock lock ( ILAC_Arena::lock );
+      ILAC_Arena::bytes += need - scratch.total();
+    }
+    scratch.create ( 1, (int)need, CV_8UC1 );
+    ILAC_Stats::count ( "scratch_allocs" );
+    ILAC_Stats::countAlloc ( scratch );
+  }
+  return Mat ( size, type, scratch.data );
+}
+
+Mat //static method
+ILAC_Arena::getEllipse ( const int side )
+{
+  map<int, Mat> &ellipses = ILAC_Arena::current()->ellipses;
+  map<int, Mat>::iterator ellipse = ellipses.find ( side );
+  if ( ellipse != ellipses.end() )
+    return ellipse->second;
+
+  Mat se = getStructuringElement ( MORPH_ELLIPSE, Size(side, side) );
+  ILAC_Stats::count ( "scratch_allocs" );
+  ILAC_Stats::countAlloc ( se );
+  ellipses[side] = se;
+  return se;
+}
+
+/* ru_maxrss is in kilobytes on Linux */
+size_t //static method
+ILAC_Arena::getPeakRSS ()
+{
+  struct rusage usage;
+  if ( getrusage ( RUSAGE_SELF, &usage ) != 0 )
+    return 0;
+  return (size_t)usage.ru_maxrss * 1024;
+}
+
+ILAC_Arena::~ILAC_Arena ()
+{
+  AutoLock lock ( ILAC_Arena::lock );
+  while ( this->buffers.size() > 0 )
+    this->drop ( this->buffers.size() - 1 );
+  for ( int i = 0 ; i < SCRATCH_SLOTS ; i++ )
+    ILAC_Arena::bytes -= this->scratch[i].total();
+
+  vector<ILAC_Arena*> &arenas = ILAC_Arena::arenas;
+  arenas.erase ( std::find ( arenas.begin(), arenas.end(), this ) );
+}
+
+/* Buffers in use live on with their other references. Must hold lock. */
+void
+ILAC_Arena::drop ( const size_t offset )
+{
+  Mat &buffer = this->buffers[offset];
+  ILAC_Arena::bytes -= buffer.total() * buffer.elemSize();
+  this->buffers.erase ( this->buffers.begin() + offset );
+}
+
+/* Oldest first, until need more bytes fit. Must hold lock. */
+void
+ILAC_Arena::dropFree ( const size_t need )
+{
+  for ( size_t i = 0 ; i < this->buffers.size()
+                       && ILAC_Arena::bytes + need > ILAC_Arena::capacity ; )
+    if ( ILAC_Arena::isFree ( this->buffers[i] ) )
+      this->drop ( i );
+    else
+      i++;
+}
+
+/*
+ * Other threads can only let go of a buffer and only get hands them out,
+ * under the lock, so a count of 1 stays 1 while we hold it. The count is
+ * read atomically.
+ */
+bool //static method
+ILAC_Arena::isFree ( const Mat &buffer )
+{
+  return buffer.refcount != NULL && CV_XADD ( buffer.refcount, 0 ) == 1;
+}
+
+ILAC_Arena* //static method
+ILAC_Arena::current ()
+{
+  pthread_once ( &ILAC_Arena::keyOnce, ILAC_Arena::createKey );
+  ILAC_Arena *arena = (ILAC_Arena*)pthread_getspecific ( ILAC_Arena::key );
+  if ( arena == NULL )
+  {
+    arena = new ILAC_Arena();
+    pthread_setspecific ( ILAC_Arena::key, arena );
+    AutoLock lock ( ILAC_Arena::lock );
+    ILAC_Arena::arenas.push_back ( arena );
+  }
+  return arena;
+}
+
+/* Thread exit */
+void //static method
+ILAC_Arena::destroy ( void *arena ) { delete (ILAC_Arena*)arena; }
+
+void //static method
+ILAC_Arena::createKey ()
+{
+  pthread_key_create ( &ILAC_Arena::key, ILAC_Arena::destroy );
+}
+/*}}} ILAC_Arena*/
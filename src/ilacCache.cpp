@@ -0,0 +1,231 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacCache.h"
+#include "error.h"
+#include <string.h>
+#include <unistd.h>
+
+/* Changes every time the entry layout changes. Older files are truncated. */
+static const char cacheMagic[8] = { 'I','L','A','C','D','C','0','1' };
+
+/*{{{ ILAC_DetectCache*/
+map<uint64, ILAC_CacheEntry> ILAC_DetectCache::entries;
+FILE *ILAC_DetectCache::file = NULL;
+Mutex ILAC_DetectCache::lock;
+
+/*
+ * 1. CLOSE THE CURRENT FILE
+ * 2. READ THE EXISTING ENTRIES
+ * 3. OPEN FOR APPENDING
+ */
+void //static method
+ILAC_DetectCache::open ( const string &path )
+{
+  AutoLock lock ( ILAC_DetectCache::lock );
+
+  /* 1. CLOSE THE CURRENT FILE */
+  if ( ILAC_DetectCache::file != NULL )
+    fclose ( ILAC_DetectCache::file );
+  ILAC_DetectCache::file = NULL;
+  ILAC_DetectCache::entries.clear();
+  if ( path.empty() )
+    return;
+
+  /* 2. READ THE EXISTING ENTRIES */
+  bool valid = false;
+  FILE *in = fopen ( path.data(), "rb" );
+  if ( in != NULL )
+  {
+    char magic[8];
+    valid = fread ( magic, 1, 8, in ) == 8
+            && memcmp ( magic, cacheMagic, 8 ) == 0;
+
+    uint64 key;
+    ILAC_CacheEntry entry;
+    long goodEnd = ftell ( in );
+    while ( valid && ILAC_DetectCache::readEntry ( in, key, entry ) )
+    {
+      ILAC_DetectCache::entries[key] = entry;
+      goodEnd = ftell ( in );
+    }
+    fclose ( in );
+
+    /* A job that died while writing leaves half an entry at the end */
+    if ( valid && truncate ( path.data(), goodEnd ) != 0 )
+      throw ILACExFileError();
+  }
+
+  /* 3. OPEN FOR APPENDING */
+  ILAC_DetectCache::file = fopen ( path.data(), valid ? "ab" : "wb" );
+  if ( ILAC_DetectCache::file == NULL )
+    throw ILACExFileError();
+  if ( !valid )
+    fwrite ( cacheMagic, 1, 8, ILAC_DetectCache::file );
+  fflush ( ILAC_DetectCache::file );
+}
+
+bool //static method
+ILAC_DetectCache::isOpen ()
+{
+  AutoLock lock ( ILAC_DetectCache::lock );
+  return ILAC_DetectCache::file != NULL;
+}
+
+uint64 //static method
+ILAC_DetectCache::hash ( const void *data, const size_t size,
+                         const uint64 start )
+{
+  const uchar *bytes = (const uchar*)data;
+  uint64 h = start;
+  for ( size_t i = 0 ; i < size ; i++ )
+  {
+    h ^= bytes[i];
+    h *= fnvPrime;
+  }
+  return h;
+}
+
+uint64 //static method
+ILAC_DetectCache::hash ( const vector<uchar> &content )
+{
+  if ( content.empty() )
+    return fnvOffset;
+  return ILAC_DetectCache::hash ( &content[0], content.size() );
+}
+
+uint64 //static method
+ILAC_DetectCache::makeKey ( const uint64 contentHash, const Size &boardSize,
+                            const Mat &camMat, const Mat &disMat,
+                            const int mode, const int sqrSide,
+                            const int sphDiam, const int sphMethod )
+{
+  int values[6] = { boardSize.width, boardSize.height, mode,
+                    sqrSide, sphDiam, sphMethod };
+  uint64 key = ILAC_DetectCache::hash ( values, sizeof(values), contentHash );
+
+  Mat intrinsics[2] = { camMat, disMat };
+  for ( int i = 0 ; i < 2 ; i++ )
+  {
+    Mat m;
+    if ( !intrinsics[i].empty() )
+      intrinsics[i].convertTo ( m, CV_64F );
+    m = m.reshape ( 1, 1 ).clone();
+    key = ILAC_DetectCache::hash ( m.data, m.total()*m.elemSize(), key );
+  }
+  return key;
+}
+
+bool //static method
+ILAC_DetectCache::lookup ( const uint64 key, ILAC_CacheEntry &entry )
+{
+  AutoLock lock ( ILAC_DetectCache::lock );
+  map<uint64, ILAC_CacheEntry>::iterator found =
+    ILAC_DetectCache::entries.find ( key );
+  if ( found == ILAC_DetectCache::entries.end() )
+    return false;
+  entry = (*found).second;
+  return true;
+}
+
+void //static method
+ILAC_DetectCache::store ( const uint64 key, const ILAC_CacheEntry &entry )
+{
+  AutoLock lock ( ILAC_DetectCache::lock );
+  if ( ILAC_DetectCache::file == NULL )
+    return;
+  ILAC_DetectCache::entries[key] = entry;
+  ILAC_DetectCache::writeEntry ( ILAC_DetectCache::file, key, entry );
+  fflush ( ILAC_DetectCache::file );
+}
+
+void //static method
+ILAC_DetectCache::readFile ( const string &path, vector<uchar> &content )
+{
+  FILE *in = fopen ( path.data(), "rb" );
+  if ( in == NULL )
+    throw ILACExFileError();
+
+  fseek ( in, 0, SEEK_END );
+  long size = ftell ( in );
+  fseek ( in, 0, SEEK_SET );
+  content.resize ( size > 0 ? size : 0 );
+  size_t read = content.size() > 0 ? fread ( &content[0], 1, content.size(),
+                                             in ) : 0;
+  fclose ( in );
+  if ( size < 0 || read != content.size() )
+    throw ILACExFileError();
+}
+
+/*
+ * Entry layout (native byte order):
+ * key, id count, ids, corner count, corners, center count, centers, size
+ */
+bool //static method
+ILAC_DetectCache::readEntry ( FILE *in, uint64 &key, ILAC_CacheEntry &entry )
+{
+  unsigned int count;
+  if ( fread ( &key, sizeof(key), 1, in ) != 1
+       || fread ( &count, sizeof(count), 1, in ) != 1 || count > 1024 )
+    return false;
+  entry.id.resize ( count );
+  if ( count > 0
+       && fread ( &entry.id[0], sizeof(unsigned short), count, in ) != count )
+    return false;
+
+  vector<Point2f> *points[2] = { &entry.corners, &entry.centers };
+  for ( int i = 0 ; i < 2 ; i++ )
+  {
+    if ( fread ( &count, sizeof(count), 1, in ) != 1 || count > 65536 )
+      return false;
+    points[i]->resize ( count );
+    if ( count > 0
+         && fread ( &(*points[i])[0], sizeof(Point2f), count, in ) != count )
+      return false;
+  }
+
+  int size[2];
+  if ( fread ( size, sizeof(int), 2, in ) != 2 )
+    return false;
+  entry.size = Size ( size[0], size[1] );
+  return true;
+}
+
+void //static method
+ILAC_DetectCache::writeEntry ( FILE *out, const uint64 key,
+                               const ILAC_CacheEntry &entry )
+{
+  unsigned int count = entry.id.size();
+  fwrite ( &key, sizeof(key), 1, out );
+  fwrite ( &count, sizeof(count), 1, out );
+  if ( count > 0 )
+    fwrite ( &entry.id[0], sizeof(unsigned short), count, out );
+
+  const vector<Point2f> *points[2] = { &entry.corners, &entry.centers };
+  for ( int i = 0 ; i < 2 ; i++ )
+  {
+    count = points[i]->size();
+    fwrite ( &count, sizeof(count), 1, out );
+    if ( count > 0 )
+      fwrite ( &(*points[i])[0], sizeof(Point2f), count, out );
+  }
+
+  int size[2] = { entry.size.width, entry.size.height };
+  fwrite ( size, sizeof(int), 2, out );
+}
+/*}}} ILAC_DetectCache*/
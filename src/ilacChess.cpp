@@ -27,31 +27,50 @@ ILAC_Chessboard::ILAC_Chessboard (){}/*Used to initialize.*/
  * 1. GET CHESSBOARD POINTS IN IMAGE
  * 2. INITIALIZE THE SQUARES VECTOR BASED ON POINTS
  */
-ILAC_Chessboard::ILAC_Chessboard ( const Mat &image, const Size &dimension )
+ILAC_Chessboard::ILAC_Chessboard ( const Mat &image, const Size &dimension,
+                                   const int detect, const Rect &hint )
   :dimension(dimension), association()
 {
   /* 1. GET CHESSBOARD POINTS IN IMAGE */
   try
   {
     Mat g_img; //temp gray image
+    {
+      ILAC_Timer timer ( "chess_gray" );
+      cvtColor ( image, g_img, CV_BGR2GRAY );/* transform to grayscale */
+    }
 
-    cvtColor ( image, g_img, CV_BGR2GRAY );/* transform to grayscale */
+    /*
+     * Search around the hint first. The hint is padded with half its size on
+     * every side so small camera movements are still inside the crop.
+     */
+    bool found = false;
+    if ( hint.area() > 0 )
+    {
+      int pad = max ( hint.width, hint.height ) / 2;
+      Rect roi = Rect ( hint.x - pad, hint.y - pad,
+                        hint.width + 2*pad, hint.height + 2*pad )
+                 & Rect ( 0, 0, g_img.cols, g_img.rows );
 
-    /* find the chessboard points in the image and put them in points.*/
-    if ( !findChessboardCorners(g_img, dimension, (cbPoints),
-                                CV_CALIB_CB_ADAPTIVE_THRESH) )
-      throw ILACExNoChessboardFound();
+      if ( roi.area() > 0
+           && ILAC_Chessboard::findCorners ( g_img(roi), this->dimension,
+                                             this->cbPoints, detect ) )
+      {
+        for ( vector<Point2f>::iterator point = cbPoints.begin() ;
+              point != cbPoints.end() ; ++point )
+          (*point) += Point2f ( roi.x, roi.y );
+        ILAC_Stats::count ( "chess_hint" );
+        found = true;
+      }
+    }
 
-    else
-      /* The 3rd argument is of interest.  It defines the size of the subpix
-       * window.  window_size = NUM*2+1.  This means that with 5,5 we have a
-       * window of 11x11 pixels.  If the window is too big it will mess up the
-       * original corner calculations for small chessboards. */
-      cornerSubPix ( g_img, (cbPoints), Size(5,5), Size(-1,-1),
-                     TermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 30, 0.1) );
+    if ( !found && !ILAC_Chessboard::findCorners ( g_img, this->dimension,
+                                                   this->cbPoints, detect ) )
+      throw ILACExNoChessboardFound();
   }catch (cv::Exception){throw ILACExNoChessboardFound();}
 
   /* 2. INITIALIZE THE SQUARES VECTOR BASED ON POINTS. */
+  ILAC_Timer timer ( "chess_squares" );
   bool isBlack = true;
   for ( int r = 0 ; r < dimension.height-1 ; r++ )
     for ( int c = 0 ; c < dimension.width-1 ; c++ )
@@ -73,6 +92,102 @@ ILAC_Chessboard::ILAC_Chessboard ( const Mat &image, const Size &dimension )
     throw ILACExChessboardTooSmall ();
 }
 
+/* Puts the corners of g_img in points. False if there is no chessboard. */
+bool //static method
+ILAC_Chessboard::findCorners ( const Mat &g_img, const Size &dimension,
+                               vector<Point2f> &points, const int detect )
+{
+  if ( detect == DETECT_PYRAMID
+       && ILAC_Chessboard::findPyramidCorners ( g_img, dimension, points ) )
+    return true;
+
+  /* find the chessboard points in the image and put them in points.*/
+  bool found;
+  {
+    ILAC_Timer timer ( "chess_detect" );
+    found = findChessboardCorners ( g_img, dimension, points,
+                                    CV_CALIB_CB_ADAPTIVE_THRESH );
+  }
+  if ( !found )
+    return false;
+
+  /* The 3rd argument is of interest.  It defines the size of the subpix
+   * window.  window_size = NUM*2+1.  This means that with 5,5 we have a
+   * window of 11x11 pixels.  If the window is too big it will mess up the
+   * original corner calculations for small chessboards. */
+  ILAC_Timer timer ( "chess_refine" );
+  cornerSubPix ( g_img, points, Size(5,5), Size(-1,-1),
+                 TermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 30, 0.1) );
+  return true;
+}
+
+/*
+ * 1. SEARCH THE CORNERS IN A DOWNSCALED IMAGE
+ * 2. TAKE THE CORNERS TO FULL RESOLUTION
+ * 3. REFINE THE CORNERS AT FULL RESOLUTION
+ */
+bool //static method
+ILAC_Chessboard::findPyramidCorners ( const Mat &g_img, const Size &dimension,
+                                      vector<Point2f> &points )
+{
+  for ( int level = maxPyrLevel ; level >= minPyrLevel ; level-- )
+  {
+    /* 1. SEARCH THE CORNERS IN A DOWNSCALED IMAGE */
+    int scale = 1 << level;
+    if ( min ( g_img.cols, g_img.rows ) / scale < minPyrSide )
+      continue;
+
+    Mat s_img;
+    bool found;
+    {
+      ILAC_Timer timer ( "chess_detect" );
+      resize ( g_img, s_img, Size(g_img.cols/scale, g_img.rows/scale),
+               0, 0, INTER_AREA );
+      found = findChessboardCorners ( s_img, dimension, points,
+                                      CV_CALIB_CB_ADAPTIVE_THRESH );
+    }
+    if ( !found )
+      continue;
+
+    /* 2. TAKE THE CORNERS TO FULL RESOLUTION */
+    ILAC_Timer timer ( "chess_refine" );
+    double fx = (double)g_img.cols / s_img.cols;
+    double fy = (double)g_img.rows / s_img.rows;
+    for ( vector<Point2f>::iterator point = points.begin() ;
+          point != points.end() ; ++point )
+    {
+      /* INTER_AREA pixel centers: full = (small + 0.5) * scale - 0.5 */
+      (*point).x = ((*point).x + 0.5) * fx - 0.5;
+      (*point).y = ((*point).y + 0.5) * fy - 0.5;
+    }
+
+    /*
+     * 3. REFINE THE CORNERS AT FULL RESOLUTION
+     * The upscaled corners can be off by about one downscaled pixel. A first
+     * pass with a window that covers that error and stays within a quarter of
+     * the smallest square side, then the usual 5,5 pass.
+     */
+    double minSide = g_img.cols;
+    for ( int r = 0 ; r < dimension.height ; r++ )
+      for ( int c = 0 ; c < dimension.width-1 ; c++ )
+      {
+        Point2f d = points[(r*dimension.width)+c+1]
+                    - points[(r*dimension.width)+c];
+        minSide = min ( minSide, sqrt ( (double)(d.x*d.x + d.y*d.y) ) );
+      }
+    int win = max ( 5, min ( scale + 1, (int)(minSide/4) ) );
+
+    cornerSubPix ( g_img, points, Size(win,win), Size(-1,-1),
+                   TermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 30, 0.1) );
+    cornerSubPix ( g_img, points, Size(5,5), Size(-1,-1),
+                   TermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 30, 0.1) );
+    ILAC_Stats::count ( "chess_level", level );
+    return true;
+  }
+
+  return false;
+}
+
 size_t
 ILAC_Chessboard::getSquaresSize () { return this->squares.size(); }
 
@@ -83,7 +198,7 @@ size_t
 ILAC_Chessboard::getDatasSize ()
 { return this->squares.size() - ILAC_Chessboard::numSamples; }
 
-ILAC_Square
+ILAC_Square&
 ILAC_Chessboard::getSquare ( const size_t offset )
 {
   if ( offset < this->squares.size() )
@@ -92,7 +207,7 @@ ILAC_Chessboard::getSquare ( const size_t offset )
     throw ILACExOutOfBounds();
 }
 
-ILAC_Square
+ILAC_Square&
 ILAC_Chessboard::getSampleSquare ( const size_t offset )
 {
   if ( offset < ILAC_Chessboard::numSamples )
@@ -101,7 +216,7 @@ ILAC_Chessboard::getSampleSquare ( const size_t offset )
     throw ILACExOutOfBounds();
 }
 
-ILAC_Square
+ILAC_Square&
 ILAC_Chessboard::getDataSquare ( const size_t offset )
 {
   if ( offset < ( this->squares.size() - ILAC_Chessboard::numSamples ) )
@@ -113,6 +228,10 @@ ILAC_Chessboard::getDataSquare ( const size_t offset )
 vector<Point2f>
 ILAC_Chessboard::getPoints () { return this->cbPoints; }
 
+/* Bounding rectangle of the chessboard corners. Used as a detection hint. */
+Rect
+ILAC_Chessboard::getBoundingRect () { return boundingRect ( this->cbPoints ); }
+
 vector<int>
 ILAC_Chessboard::getAssociation () { return this->association; }
 
@@ -124,8 +243,10 @@ ILAC_Chess_SD::ILAC_Chess_SD():ILAC_Chessboard(){}
  */
 ILAC_Chess_SD::ILAC_Chess_SD ( const Mat &image,
                                const Size &dimension,
-                               const int methodology )
-  :ILAC_Chessboard ( image, dimension )
+                               const int methodology,
+                               const int detect,
+                               const Rect &hint )
+  :ILAC_Chessboard ( image, dimension, detect, hint )
 {
   ILAC_ColorClassifier *cc;
   vector<ILAC_Square> samples ( this->squares.begin(),
@@ -156,8 +277,10 @@ ILAC_Chess_SSD::ILAC_Chess_SSD():ILAC_Chessboard(){}
  */
 ILAC_Chess_SSD::ILAC_Chess_SSD ( const Mat &image,
                                  const Size &dimension,
-                                 const int methodology )
-  :ILAC_Chessboard ( image, dimension )
+                                 const int methodology,
+                                 const int detect,
+                                 const Rect &hint )
+  :ILAC_Chessboard ( image, dimension, detect, hint )
 {
   ILAC_ColorClassifier *cc;
   vector<ILAC_Square> samples ( this->squares.begin(),
@@ -188,7 +311,7 @@ ILAC_Chess_SSD::getDatasSize ()
   return this->squares.size() - ILAC_Chess_SSD::numSamples - 1;
 }
 
-ILAC_Square
+ILAC_Square&
 ILAC_Chess_SSD::getDataSquare ( const size_t offset )
 {
   if ( offset < ( this->squares.size() - ILAC_Chess_SSD::numSamples ) )
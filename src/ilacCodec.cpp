@@ -0,0 +1,423 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacCodec.h"
+#include "ilacStats.h"
+#include "error.h"
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <exiv2/exiv2.hpp>
+
+/* libjpeg calls exit on errors unless we jump out of it. */
+struct ILAC_JpegError{
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+static void
+ilac_jpeg_error_exit ( j_common_ptr cinfo )
+{
+  longjmp ( ((ILAC_JpegError*)cinfo->err)->jump, 1 );
+}
+
+static void
+ilac_jpeg_output_message ( j_common_ptr cinfo ) {} /* Corrupt data warnings */
+
+static bool
+ilac_is_jpeg ( const vector<uchar> &buf )
+{
+  return buf.size() > 3 && buf[0] == 0xFF && buf[1] == 0xD8 && buf[2] == 0xFF;
+}
+
+/*
+ * Decodes a JPEG at 1/scale into an RGB img. 1 on success, 0 if libjpeg can
+ * not give us RGB, -1 on error. img lives in the caller: nothing with a
+ * destructor may live in the frame that longjmp leaves.
+ */
+static int
+ilac_jpeg_decode ( const vector<uchar> &buf, const int scale, Mat *img )
+{
+  struct jpeg_decompress_struct cinfo;
+  ILAC_JpegError jerr;
+  cinfo.err = jpeg_std_error ( &jerr.mgr );
+  jerr.mgr.error_exit = ilac_jpeg_error_exit;
+  jerr.mgr.output_message = ilac_jpeg_output_message;
+  if ( setjmp ( jerr.jump ) )
+  {
+    jpeg_destroy_decompress ( &cinfo );
+    return -1;
+  }
+
+  jpeg_create_decompress ( &cinfo );
+  jpeg_mem_src ( &cinfo, (unsigned char*)&buf[0], buf.size() );
+  jpeg_read_header ( &cinfo, TRUE );
+  if ( cinfo.jpeg_color_space == JCS_CMYK
+       || cinfo.jpeg_color_space == JCS_YCCK )
+  {
+    jpeg_destroy_decompress ( &cinfo );
+    return 0;
+  }
+  cinfo.out_color_space = JCS_RGB;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale;
+  cinfo.dct_method = JDCT_ISLOW;
+  jpeg_start_decompress ( &cinfo );
+
+  img->create ( cinfo.output_height, cinfo.output_width, CV_8UC3 );
+  while ( cinfo.output_scanline < cinfo.output_height )
+  {
+    JSAMPROW row = img->ptr<uchar>(cinfo.output_scanline);
+    jpeg_read_scanlines ( &cinfo, &row, 1 );
+  }
+  jpeg_finish_decompress ( &cinfo );
+  jpeg_destroy_decompress ( &cinfo );
+  return 1;
+}
+
+struct ILAC_JpegState{
+  struct jpeg_compress_struct cinfo;
+  ILAC_JpegError jerr;
+  FILE *file;
+  vector<uchar> row; /* RGB version of the row being written */
+  vector<uchar> app1; /* Exif APP1 segment content, can be empty */
+  bool progressive;
+  bool optimize;
+  bool fastDct;
+  bool created;
+};
+
+/* Identifies the EXIF APP1 segment. Part of its content. */
+static const uchar ilac_exif_id[] = { 'E', 'x', 'i', 'f', 0, 0 };
+
+/* Content of a JPEG segment: 65535 minus the two bytes of the length */
+static const size_t ilac_max_segment = 65533;
+
+/* Same rules as ilac_jpeg_decode: no destructors in these frames. */
+static bool
+ilac_jpeg_start ( ILAC_JpegState *st, const int width, const int height,
+                  const int quality )
+{
+  st->cinfo.err = jpeg_std_error ( &st->jerr.mgr );
+  st->jerr.mgr.error_exit = ilac_jpeg_error_exit;
+  st->jerr.mgr.output_message = ilac_jpeg_output_message;
+  if ( setjmp ( st->jerr.jump ) )
+    return false;
+
+  jpeg_create_compress ( &st->cinfo );
+  st->created = true;
+  jpeg_stdio_dest ( &st->cinfo, st->file );
+  st->cinfo.image_width = width;
+  st->cinfo.image_height = height;
+  st->cinfo.input_components = 3;
+  st->cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults ( &st->cinfo );
+  jpeg_set_quality ( &st->cinfo, quality, TRUE );
+  if ( st->progressive )
+    jpeg_simple_progression ( &st->cinfo );
+  st->cinfo.optimize_coding = st->optimize ? TRUE : FALSE;
+  if ( st->fastDct )
+    st->cinfo.dct_method = JDCT_IFAST;
+
+  /* Exif wants its APP1 right after SOI, where JFIF would put its APP0 */
+  if ( !st->app1.empty() )
+    st->cinfo.write_JFIF_header = FALSE;
+  jpeg_start_compress ( &st->cinfo, TRUE );
+  if ( !st->app1.empty() )
+    jpeg_write_marker ( &st->cinfo, JPEG_APP0 + 1, &st->app1[0],
+                        st->app1.size() );
+  return true;
+}
+
+static bool
+ilac_jpeg_rows ( ILAC_JpegState *st, const Mat *rows )
+{
+  if ( setjmp ( st->jerr.jump ) )
+    return false;
+
+  for ( int r = 0 ; r < rows->rows ; r++ )
+  {
+    const uchar *bgr = rows->ptr<uchar>(r);
+    uchar *rgb = &st->row[0];
+    for ( int x = 0 ; x < rows->cols ; x++ )
+    {
+      rgb[3*x] = bgr[3*x+2];
+      rgb[3*x+1] = bgr[3*x+1];
+      rgb[3*x+2] = bgr[3*x];
+    }
+    JSAMPROW row = rgb;
+    jpeg_write_scanlines ( &st->cinfo, &row, 1 );
+  }
+  return true;
+}
+
+static bool
+ilac_jpeg_finish ( ILAC_JpegState *st )
+{
+  if ( setjmp ( st->jerr.jump ) )
+    return false;
+  jpeg_finish_compress ( &st->cinfo );
+  return true;
+}
+
+/*{{{ ILAC_JpegWriter*/
+ILAC_JpegWriter::ILAC_JpegWriter ()
+  :state(NULL), progressive(false), optimize(false), fastDct(false){}
+
+ILAC_JpegWriter::~ILAC_JpegWriter ()
+{
+  if ( this->state == NULL )
+    return;
+  if ( this->state->created )
+    jpeg_destroy_compress ( &this->state->cinfo );
+  if ( this->state->file != NULL )
+    fclose ( this->state->file );
+  delete this->state;
+}
+
+void
+ILAC_JpegWriter::setProgressive ( const bool progressive )
+{
+  this->progressive = progressive;
+}
+
+void
+ILAC_JpegWriter::setOptimize ( const bool optimize )
+{
+  this->optimize = optimize;
+}
+
+void
+ILAC_JpegWriter::setFastDct ( const bool fastDct )
+{
+  this->fastDct = fastDct;
+}
+
+void
+ILAC_JpegWriter::open ( const string &fileName, const Size &size,
+                        const int quality, const vector<uchar> &exif )
+{
+  if ( this->state != NULL )
+    throw ILACExFileError();
+
+  this->state = new ILAC_JpegState;
+  this->state->created = false;
+  this->state->progressive = this->progressive;
+  this->state->optimize = this->optimize;
+  this->state->fastDct = this->fastDct;
+  this->state->row.resize ( 3 * max ( size.width, 1 ) );
+
+  /* An EXIF that does not fit in one segment is left out */
+  if ( !exif.empty() && sizeof(ilac_exif_id) + exif.size() <= ilac_max_segment )
+  {
+    this->state->app1.assign ( ilac_exif_id,
+                               ilac_exif_id + sizeof(ilac_exif_id) );
+    this->state->app1.insert ( this->state->app1.end(),
+                               exif.begin(), exif.end() );
+  }
+  this->state->file = fopen ( fileName.data(), "wb" );
+  if ( this->state->file == NULL
+       || !ilac_jpeg_start ( this->state, size.width, size.height, quality ) )
+    throw ILACExFileError();
+}
+
+void
+ILAC_JpegWriter::write ( const Mat &rows )
+{
+  if ( this->state == NULL || rows.type() != CV_8UC3
+       || rows.cols != (int)this->state->cinfo.image_width
+       || this->state->cinfo.next_scanline + rows.rows
+          > this->state->cinfo.image_height
+       || !ilac_jpeg_rows ( this->state, &rows ) )
+    throw ILACExFileError();
+}
+
+void
+ILAC_JpegWriter::close ()
+{
+  if ( this->state == NULL
+       || this->state->cinfo.next_scanline < this->state->cinfo.image_height
+       || !ilac_jpeg_finish ( this->state ) )
+    throw ILACExFileError();
+
+  jpeg_destroy_compress ( &this->state->cinfo );
+  this->state->created = false;
+  int closed = fclose ( this->state->file );
+  this->state->file = NULL;
+  if ( closed != 0 )
+    throw ILACExFileError();
+}
+/*}}} ILAC_JpegWriter*/
+
+/*{{{ ILAC_Codec*/
+bool //static method
+ILAC_Codec::jpegSize ( const vector<uchar> &buf, Size &size )
+{
+  if ( !ilac_is_jpeg ( buf ) )
+    return false;
+
+  struct jpeg_decompress_struct cinfo;
+  ILAC_JpegError jerr;
+  cinfo.err = jpeg_std_error ( &jerr.mgr );
+  jerr.mgr.error_exit = ilac_jpeg_error_exit;
+  jerr.mgr.output_message = ilac_jpeg_output_message;
+  if ( setjmp ( jerr.jump ) )
+  {
+    jpeg_destroy_decompress ( &cinfo );
+    return false;
+  }
+
+  jpeg_create_decompress ( &cinfo );
+  jpeg_mem_src ( &cinfo, (unsigned char*)&buf[0], buf.size() );
+  jpeg_read_header ( &cinfo, TRUE );
+  size = Size ( cinfo.image_width, cinfo.image_height );
+  jpeg_destroy_decompress ( &cinfo );
+  return true;
+}
+
+/*
+ * 1. FULL SIZE AND NON JPEG IMAGES GO TO IMDECODE
+ * 2. SCALED DECODE
+ * 3. SWAP TO BGR
+ */
+Mat //static method
+ILAC_Codec::decode ( const vector<uchar> &buf, const int scale )
+{
+  /* 1. FULL SIZE AND NON JPEG IMAGES GO TO IMDECODE */
+  if ( scale <= 1 || !ilac_is_jpeg ( buf ) )
+    return buf.empty() ? Mat() : imdecode ( Mat(buf), CV_LOAD_IMAGE_COLOR );
+
+  /* 2. SCALED DECODE */
+  Mat img;
+  int ret = ilac_jpeg_decode ( buf, scale, &img );
+  if ( ret < 0 )
+    return Mat();
+  if ( ret == 0 ) /* libjpeg does not convert CMYK to RGB */
+    return imdecode ( Mat(buf), CV_LOAD_IMAGE_COLOR );
+
+  /* 3. SWAP TO BGR */
+  cvtColor ( img, img, CV_RGB2BGR );
+  return img;
+}
+
+bool //static method
+ILAC_Codec::decode ( const vector<uchar> &buf, Mat &img )
+{
+  int ret = ilac_is_jpeg ( buf ) ? ilac_jpeg_decode ( buf, 1, &img ) : 0;
+  if ( ret < 0 )
+    return false;
+  if ( ret == 0 ) /* Not a JPEG, or CMYK */
+  {
+    img = ILAC_Codec::decode ( buf );
+    return !img.empty();
+  }
+
+  cvtColor ( img, img, CV_RGB2BGR );
+  return true;
+}
+
+vector<uchar> //static method
+ILAC_Codec::readExif ( const vector<uchar> &buf )
+{
+  vector<uchar> exif;
+  if ( buf.empty() )
+    return exif;
+
+  try
+  {
+    Exiv2::Image::AutoPtr img = Exiv2::ImageFactory::open ( &buf[0],
+                                                            buf.size() );
+    img->readMetadata ();
+    if ( !img->exifData().empty() )
+    {
+      Exiv2::Blob blob;
+      Exiv2::ExifParser::encode ( blob, Exiv2::littleEndian,
+                                  img->exifData() );
+      exif.assign ( blob.begin(), blob.end() );
+    }
+  }catch(Exiv2::AnyError&){
+    exif.clear ();
+  }
+  return exif;
+}
+
+/*
+ * 1. OPEN THE ENCODED IMAGE FROM MEMORY
+ * 2. WRITE THE METADATA. EXIV2 REWRITES ITS COPY OF THE BUFFER
+ * 3. REPLACE THE BUFFER WITH THE COPY
+ */
+void //static method
+ILAC_Codec::addExif ( vector<uchar> &buf, const vector<uchar> &exif )
+{
+  if ( buf.empty() || exif.empty() )
+    return;
+
+  ILAC_Timer timer ( "exif_write" );
+  try
+  {
+    /* 1. OPEN THE ENCODED IMAGE FROM MEMORY */
+    Exiv2::Image::AutoPtr img = Exiv2::ImageFactory::open ( &buf[0],
+                                                            buf.size() );
+    Exiv2::ExifData exifData;
+    Exiv2::ExifParser::decode ( exifData, &exif[0], exif.size() );
+
+    /* 2. WRITE THE METADATA. EXIV2 REWRITES ITS COPY OF THE BUFFER */
+    img->setExifData ( exifData );
+    img->writeMetadata ();
+
+    /* 3. REPLACE THE BUFFER WITH THE COPY */
+    Exiv2::BasicIo &io = img->io();
+    if ( io.open() != 0 )
+      return;
+    vector<uchar> tagged ( io.size() );
+    long read = tagged.empty() ? 0 : io.read ( &tagged[0], tagged.size() );
+    io.close ();
+    if ( read == (long)tagged.size() && read > 0 )
+      buf.swap ( tagged );
+  }catch(Exiv2::AnyError&){} /* Keep the image without EXIF */
+}
+
+void //static method
+ILAC_Codec::addExif ( const string &fileName, const vector<uchar> &exif )
+{
+  if ( exif.empty() )
+    return;
+
+  try
+  {
+    Exiv2::Image::AutoPtr img = Exiv2::ImageFactory::open ( fileName );
+    Exiv2::ExifData exifData;
+    Exiv2::ExifParser::decode ( exifData, &exif[0], exif.size() );
+    img->setExifData ( exifData );
+    img->writeMetadata ();
+  }catch(Exiv2::AnyError&){} /* Keep the image without EXIF */
+}
+
+void //static method
+ILAC_Codec::writeFile ( const string &fileName, const vector<uchar> &buf )
+{
+  FILE *file = fopen ( fileName.data(), "wb" );
+  if ( file == NULL )
+    throw ILACExFileError();
+
+  size_t written = buf.empty() ? 0 : fwrite ( &buf[0], 1, buf.size(), file );
+  ILAC_Stats::count ( "bytes_written", written );
+  if ( fclose ( file ) != 0 || written != buf.size() )
+    throw ILACExFileError();
+}
+/*}}} ILAC_Codec*/
@@ -0,0 +1,310 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacEncoder.h"
+#include "error.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+
+/* Lower case extension of a file name, without the dot */
+static string
+ilac_extension ( const string &fileName )
+{
+  size_t dot = fileName.find_last_of ( '.' );
+  if ( dot == string::npos )
+    return "";
+  string ext = fileName.substr ( dot + 1 );
+  transform ( ext.begin(), ext.end(), ext.begin(), ::tolower );
+  return ext;
+}
+
+/*{{{ ILAC_Encoder*/
+ILAC_Encoder::ILAC_Encoder ()
+  :format(FMT_AUTO), jpegQuality(95), jpegProgressive(false),
+   jpegOptimize(false), jpegFastDct(false), pngLevel(3){}
+
+ILAC_Encoder //static method
+ILAC_Encoder::getPreset ( const string &name )
+{
+  ILAC_Encoder encoder;
+  if ( name == "fast" )
+  {
+    encoder.jpegQuality = 85;
+    encoder.jpegFastDct = true;
+    encoder.pngLevel = 1;
+  }
+  else if ( name == "archive" )
+  {
+    encoder.jpegQuality = 98;
+    encoder.jpegProgressive = true;
+    encoder.jpegOptimize = true;
+    encoder.pngLevel = 9;
+  }
+  else if ( name != "default" )
+    throw ILACExUnknownError();
+  return encoder;
+}
+
+int //static method
+ILAC_Encoder::getFormat ( const string &name )
+{
+  if ( name == "jpeg" || name == "jpg" )
+    return FMT_JPEG;
+  if ( name == "png" )
+    return FMT_PNG;
+  if ( name == "tiff" || name == "tif" )
+    return FMT_TIFF;
+  if ( name == "raw" || name == "ppm" )
+    return FMT_RAW;
+  throw ILACExUnknownError();
+}
+
+void
+ILAC_Encoder::setFormat ( const int format )
+{
+  if ( format < FMT_AUTO || format > FMT_RAW )
+    throw ILACExOutOfBounds();
+  this->format = format;
+}
+
+void
+ILAC_Encoder::setJpegQuality ( const int quality )
+{
+  this->jpegQuality = max ( 0, min ( 100, quality ) );
+}
+
+void
+ILAC_Encoder::setJpegProgressive ( const bool progressive )
+{
+  this->jpegProgressive = progressive;
+}
+
+void
+ILAC_Encoder::setJpegOptimize ( const bool optimize )
+{
+  this->jpegOptimize = optimize;
+}
+
+void
+ILAC_Encoder::setJpegFastDct ( const bool fastDct )
+{
+  this->jpegFastDct = fastDct;
+}
+
+void
+ILAC_Encoder::setPngLevel ( const int level )
+{
+  this->pngLevel = max ( 0, min ( 9, level ) );
+}
+
+int
+ILAC_Encoder::resolveFormat ( const string &fileName ) const
+{
+  if ( this->format != FMT_AUTO )
+    return this->format;
+  try { return ILAC_Encoder::getFormat ( ilac_extension ( fileName ) ); }
+  catch(ILACExUnknownError){ return FMT_AUTO; }
+}
+
+string
+ILAC_Encoder::getExtension () const
+{
+  switch ( this->format )
+  {
+    case FMT_JPEG: return ".jpg";
+    case FMT_PNG: return ".png";
+    case FMT_TIFF: return ".tif";
+    case FMT_RAW: return ".ppm";
+  }
+  return "";
+}
+
+bool
+ILAC_Encoder::canStream ( const string &fileName ) const
+{
+  return this->resolveFormat ( fileName ) == FMT_JPEG;
+}
+
+void
+ILAC_Encoder::openJpeg ( ILAC_JpegWriter &writer, const string &fileName,
+                         const Size &size, const vector<uchar> &exif ) const
+{
+  writer.setProgressive ( this->jpegProgressive );
+  writer.setOptimize ( this->jpegOptimize );
+  writer.setFastDct ( this->jpegFastDct );
+  writer.open ( fileName, size, this->jpegQuality, exif );
+}
+
+/*
+ * 1. JPEG GOES THROUGH OUR WRITER, EXIF INCLUDED
+ * 2. TIFF IS WRITTEN BY LIBTIFF AND GETS ITS EXIF IN THE FILE
+ * 3. THE REST IS ENCODED IN MEMORY, GETS ITS EXIF AND IS WRITTEN ONCE
+ */
+void
+ILAC_Encoder::save ( const Mat &img, const string &fileName,
+                     const vector<uchar> &exif ) const
+{
+  int format = this->resolveFormat ( fileName );
+
+  /* 1. JPEG GOES THROUGH OUR WRITER, EXIF INCLUDED */
+  if ( format == FMT_JPEG && img.type() == CV_8UC3 )
+  {
+    ILAC_JpegWriter writer;
+    this->openJpeg ( writer, fileName, img.size(), exif );
+    writer.write ( img );
+    writer.close ();
+    return;
+  }
+
+  /*
+   * 2. TIFF IS WRITTEN BY LIBTIFF AND GETS ITS EXIF IN THE FILE
+   * imencode only has the uncompressed TIFF writer. imwrite uses libtiff,
+   * with LZW, but only to files.
+   */
+  if ( format == FMT_TIFF )
+  {
+    if ( !imwrite ( fileName, img ) )
+      throw ILACExFileError();
+    ILAC_Codec::addExif ( fileName, exif );
+    return;
+  }
+
+  /* 3. THE REST IS ENCODED IN MEMORY, GETS ITS EXIF AND IS WRITTEN ONCE */
+  vector<int> params;
+  string ext = "." + ilac_extension ( fileName );
+  switch ( format )
+  {
+    case FMT_JPEG:
+      ext = ".jpg";
+      params.push_back ( CV_IMWRITE_JPEG_QUALITY );
+      params.push_back ( this->jpegQuality );
+      break;
+    case FMT_PNG:
+      ext = ".png";
+      params.push_back ( CV_IMWRITE_PNG_COMPRESSION );
+      params.push_back ( this->pngLevel );
+      break;
+    case FMT_RAW:
+      ext = ".ppm";
+      params.push_back ( CV_IMWRITE_PXM_BINARY );
+      params.push_back ( 1 );
+      break;
+  }
+
+  vector<uchar> buf;
+  if ( !imencode ( ext, img, buf, params ) )
+    throw ILACExFileError();
+  if ( format != FMT_RAW )
+    ILAC_Codec::addExif ( buf, exif );
+  ILAC_Codec::writeFile ( fileName, buf );
+}
+/*}}} ILAC_Encoder*/
+
+/*{{{ ILAC_EncodePool*/
+ILAC_EncodePool::ILAC_EncodePool ( const size_t numThreads )
+  :jobs(2 * (numThreads > 0 ? numThreads : ILAC_ThreadPool::getNumCpus())),
+   pending(0)
+{
+  pthread_mutex_init ( &this->lock, NULL );
+  pthread_cond_init ( &this->idleCond, NULL );
+
+  size_t n = numThreads > 0 ? numThreads : ILAC_ThreadPool::getNumCpus();
+  for ( size_t i = 0 ; i < n ; i++ )
+  {
+    pthread_t thread;
+    if ( pthread_create ( &thread, NULL, ILAC_EncodePool::worker, this )
+         == 0 )
+      this->threads.push_back ( thread );
+  }
+}
+
+/* Everything submitted is written before we go. */
+ILAC_EncodePool::~ILAC_EncodePool ()
+{
+  this->jobs.close ();
+  for ( vector<pthread_t>::iterator thread = this->threads.begin() ;
+        thread != this->threads.end() ; ++thread )
+    pthread_join ( *thread, NULL );
+
+  pthread_cond_destroy ( &this->idleCond );
+  pthread_mutex_destroy ( &this->lock );
+}
+
+void
+ILAC_EncodePool::submit ( const Mat &img, const string &fileName,
+                          const vector<uchar> &exif,
+                          const ILAC_Encoder &encoder )
+{
+  /* No threads could be created. Do the work here. */
+  if ( this->threads.size() == 0 )
+  {
+    encoder.save ( img, fileName, exif );
+    return;
+  }
+
+  Job *job = new Job;
+  job->img = img;
+  job->fileName = fileName;
+  job->exif = exif;
+  job->encoder = encoder;
+
+  pthread_mutex_lock ( &this->lock );
+  this->pending++;
+  pthread_mutex_unlock ( &this->lock );
+  this->jobs.push ( job );
+}
+
+vector<string>
+ILAC_EncodePool::finish ()
+{
+  pthread_mutex_lock ( &this->lock );
+  while ( this->pending > 0 )
+    pthread_cond_wait ( &this->idleCond, &this->lock );
+  vector<string> failed;
+  failed.swap ( this->failed );
+  pthread_mutex_unlock ( &this->lock );
+  return failed;
+}
+
+void* //static method
+ILAC_EncodePool::worker ( void *pool )
+{
+  ((ILAC_EncodePool*)pool)->work();
+  return NULL;
+}
+
+void
+ILAC_EncodePool::work ()
+{
+  Job *job;
+  while ( this->jobs.pop ( job ) )
+  {
+    bool saved = true;
+    try { job->encoder.save ( job->img, job->fileName, job->exif ); }
+    catch(...){ saved = false; }
+
+    pthread_mutex_lock ( &this->lock );
+    if ( !saved )
+      this->failed.push_back ( job->fileName );
+    if ( --this->pending == 0 )
+      pthread_cond_broadcast ( &this->idleCond );
+    pthread_mutex_unlock ( &this->lock );
+    delete job;
+  }
+}
+/*}}} ILAC_EncodePool*/
@@ -0,0 +1,269 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacHue.h"
+#include <string.h>
+#include <opencv2/opencv.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ILAC_HUE_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Same fixed point arithmetic as the 8 bit CV_BGR2HSV_FULL in cvtColor:
+ * hdiv_table[diff] = (256 << hsv_shift) / (6*diff), rounded.
+ */
+static const int hsv_shift = 12;
+
+class ILAC_HueTable{
+  public:
+    ILAC_HueTable ()
+    {
+      hdiv[0] = 0;
+      for ( int i = 1 ; i < 256 ; i++ )
+        hdiv[i] = saturate_cast<int>( (256 << hsv_shift)/(6.*i) );
+    }
+    int hdiv[256];
+};
+static const ILAC_HueTable hueTable; /* Built when the library loads */
+
+typedef void (*ILAC_HueRowFunc) ( const uchar*, uchar*, const int );
+
+/*{{{ Scalar path*/
+static inline uchar
+hueScalar ( const int b, const int g, const int r )
+{
+  int v = max ( b, max ( g, r ) );
+  int diff = v - min ( b, min ( g, r ) );
+  int vr = v == r ? -1 : 0;
+  int vg = v == g ? -1 : 0;
+
+  int h = (vr & (g - b))
+          + (~vr & ((vg & (b - r + 2*diff)) + ((~vg) & (r - g + 4*diff))));
+  h = (h*hueTable.hdiv[diff] + (1 << (hsv_shift-1))) >> hsv_shift;
+  h += h < 0 ? 256 : 0;
+  return saturate_cast<uchar>(h);
+}
+
+static void
+hueRowScalar ( const uchar *bgr, uchar *hue, const int n )
+{
+  for ( int i = 0 ; i < n ; i++, bgr += 3 )
+    hue[i] = hueScalar ( bgr[0], bgr[1], bgr[2] );
+}
+/*}}} Scalar path*/
+
+#ifdef ILAC_HUE_X86
+/*{{{ SSE4.1 path*/
+/*
+ * Four pixels at a time. pshufb puts b, g and r of each pixel in their own
+ * 32 bit lane and the arithmetic is the scalar one, lane by lane.
+ */
+__attribute__((target("sse4.1"))) static void
+hueRowSSE41 ( const uchar *bgr, uchar *hue, const int n )
+{
+  const __m128i shufB = _mm_setr_epi8 ( 0,-1,-1,-1, 3,-1,-1,-1,
+                                        6,-1,-1,-1, 9,-1,-1,-1 );
+  const __m128i shufG = _mm_setr_epi8 ( 1,-1,-1,-1, 4,-1,-1,-1,
+                                        7,-1,-1,-1, 10,-1,-1,-1 );
+  const __m128i shufR = _mm_setr_epi8 ( 2,-1,-1,-1, 5,-1,-1,-1,
+                                        8,-1,-1,-1, 11,-1,-1,-1 );
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i round = _mm_set1_epi32 ( 1 << (hsv_shift-1) );
+  const __m128i hr = _mm_set1_epi32 ( 256 );
+
+  int i = 0;
+  /* A 16 byte load reads 12 bytes of pixels. Stay away from the end. */
+  for ( ; i + 6 <= n ; i += 4 )
+  {
+    __m128i px = _mm_loadu_si128 ( (const __m128i*)(bgr + 3*i) );
+    __m128i b = _mm_shuffle_epi8 ( px, shufB );
+    __m128i g = _mm_shuffle_epi8 ( px, shufG );
+    __m128i r = _mm_shuffle_epi8 ( px, shufR );
+
+    __m128i v = _mm_max_epi32 ( b, _mm_max_epi32 ( g, r ) );
+    __m128i diff = _mm_sub_epi32 ( v, _mm_min_epi32 ( b,
+                                                      _mm_min_epi32 ( g, r ) ) );
+    __m128i vr = _mm_cmpeq_epi32 ( v, r );
+    __m128i vg = _mm_cmpeq_epi32 ( v, g );
+
+    __m128i diff2 = _mm_add_epi32 ( diff, diff );
+    __m128i hg = _mm_add_epi32 ( _mm_sub_epi32 ( b, r ), diff2 );
+    __m128i hb = _mm_add_epi32 ( _mm_sub_epi32 ( r, g ),
+                                 _mm_add_epi32 ( diff2, diff2 ) );
+    __m128i h = _mm_add_epi32 (
+        _mm_and_si128 ( vr, _mm_sub_epi32 ( g, b ) ),
+        _mm_andnot_si128 ( vr, _mm_add_epi32 ( _mm_and_si128 ( vg, hg ),
+                                               _mm_andnot_si128 ( vg, hb ) ) ) );
+
+    __m128i div = _mm_setr_epi32 ( hueTable.hdiv[_mm_extract_epi32(diff, 0)],
+                                   hueTable.hdiv[_mm_extract_epi32(diff, 1)],
+                                   hueTable.hdiv[_mm_extract_epi32(diff, 2)],
+                                   hueTable.hdiv[_mm_extract_epi32(diff, 3)] );
+    h = _mm_srai_epi32 ( _mm_add_epi32 ( _mm_mullo_epi32 ( h, div ), round ),
+                         hsv_shift );
+    h = _mm_add_epi32 ( h, _mm_and_si128 ( _mm_cmplt_epi32 ( h, zero ), hr ) );
+
+    /* Saturate to 8 bits and store the 4 hues */
+    h = _mm_packus_epi16 ( _mm_packs_epi32 ( h, zero ), zero );
+    int packed = _mm_cvtsi128_si32 ( h );
+    memcpy ( hue + i, &packed, 4 );
+  }
+
+  hueRowScalar ( bgr + 3*i, hue + i, n - i );
+}
+/*}}} SSE4.1 path*/
+
+/*{{{ AVX2 path*/
+/* Eight pixels at a time. Same as SSE4.1 with a gather for the table. */
+__attribute__((target("avx2"))) static void
+hueRowAVX2 ( const uchar *bgr, uchar *hue, const int n )
+{
+  const __m256i shufB = _mm256_setr_epi8 ( 0,-1,-1,-1, 3,-1,-1,-1,
+                                           6,-1,-1,-1, 9,-1,-1,-1,
+                                           0,-1,-1,-1, 3,-1,-1,-1,
+                                           6,-1,-1,-1, 9,-1,-1,-1 );
+  const __m256i shufG = _mm256_setr_epi8 ( 1,-1,-1,-1, 4,-1,-1,-1,
+                                           7,-1,-1,-1, 10,-1,-1,-1,
+                                           1,-1,-1,-1, 4,-1,-1,-1,
+                                           7,-1,-1,-1, 10,-1,-1,-1 );
+  const __m256i shufR = _mm256_setr_epi8 ( 2,-1,-1,-1, 5,-1,-1,-1,
+                                           8,-1,-1,-1, 11,-1,-1,-1,
+                                           2,-1,-1,-1, 5,-1,-1,-1,
+                                           8,-1,-1,-1, 11,-1,-1,-1 );
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i round = _mm256_set1_epi32 ( 1 << (hsv_shift-1) );
+  const __m256i hr = _mm256_set1_epi32 ( 256 );
+
+  int i = 0;
+  /* The second 16 byte load starts 12 bytes in. Stay away from the end. */
+  for ( ; i + 10 <= n ; i += 8 )
+  {
+    /* Pixels 0-3 in the low lane and 4-7 in the high lane */
+    __m256i px = _mm256_inserti128_si256 ( _mm256_castsi128_si256 (
+          _mm_loadu_si128 ( (const __m128i*)(bgr + 3*i) ) ),
+        _mm_loadu_si128 ( (const __m128i*)(bgr + 3*i + 12) ), 1 );
+    __m256i b = _mm256_shuffle_epi8 ( px, shufB );
+    __m256i g = _mm256_shuffle_epi8 ( px, shufG );
+    __m256i r = _mm256_shuffle_epi8 ( px, shufR );
+
+    __m256i v = _mm256_max_epi32 ( b, _mm256_max_epi32 ( g, r ) );
+    __m256i diff = _mm256_sub_epi32 ( v,
+        _mm256_min_epi32 ( b, _mm256_min_epi32 ( g, r ) ) );
+    __m256i vr = _mm256_cmpeq_epi32 ( v, r );
+    __m256i vg = _mm256_cmpeq_epi32 ( v, g );
+
+    __m256i diff2 = _mm256_add_epi32 ( diff, diff );
+    __m256i hg = _mm256_add_epi32 ( _mm256_sub_epi32 ( b, r ), diff2 );
+    __m256i hb = _mm256_add_epi32 ( _mm256_sub_epi32 ( r, g ),
+                                    _mm256_add_epi32 ( diff2, diff2 ) );
+    __m256i h = _mm256_add_epi32 (
+        _mm256_and_si256 ( vr, _mm256_sub_epi32 ( g, b ) ),
+        _mm256_andnot_si256 ( vr,
+          _mm256_add_epi32 ( _mm256_and_si256 ( vg, hg ),
+                             _mm256_andnot_si256 ( vg, hb ) ) ) );
+
+    __m256i div = _mm256_i32gather_epi32 ( hueTable.hdiv, diff, 4 );
+    h = _mm256_srai_epi32 (
+        _mm256_add_epi32 ( _mm256_mullo_epi32 ( h, div ), round ),
+        hsv_shift );
+    h = _mm256_add_epi32 ( h,
+        _mm256_and_si256 ( _mm256_cmpgt_epi32 ( zero, h ), hr ) );
+
+    /* Saturate to 8 bits. Each lane has its 4 hues in its first 4 bytes */
+    h = _mm256_packus_epi16 ( _mm256_packs_epi32 ( h, zero ), zero );
+    int packed[2] = { _mm_cvtsi128_si32 ( _mm256_castsi256_si128 ( h ) ),
+                      _mm_cvtsi128_si32 ( _mm256_extracti128_si256 ( h, 1 ) ) };
+    memcpy ( hue + i, packed, 8 );
+  }
+
+  hueRowScalar ( bgr + 3*i, hue + i, n - i );
+}
+/*}}} AVX2 path*/
+#endif /* ILAC_HUE_X86 */
+
+/*{{{ ILAC_Hue*/
+static bool
+pathSupported ( const int path )
+{
+#ifdef ILAC_HUE_X86
+  __builtin_cpu_init ();
+  if ( path == ILAC_Hue::PATH_AVX2 )
+    return __builtin_cpu_supports ( "avx2" );
+  if ( path == ILAC_Hue::PATH_SSE41 )
+    return __builtin_cpu_supports ( "sse4.1" );
+#endif
+  return path == ILAC_Hue::PATH_SCALAR;
+}
+
+static int
+bestPath ()
+{
+  if ( pathSupported ( ILAC_Hue::PATH_AVX2 ) )
+    return ILAC_Hue::PATH_AVX2;
+  if ( pathSupported ( ILAC_Hue::PATH_SSE41 ) )
+    return ILAC_Hue::PATH_SSE41;
+  return ILAC_Hue::PATH_SCALAR;
+}
+
+static ILAC_HueRowFunc
+pathFunc ( const int path )
+{
+#ifdef ILAC_HUE_X86
+  if ( path == ILAC_Hue::PATH_AVX2 )
+    return hueRowAVX2;
+  if ( path == ILAC_Hue::PATH_SSE41 )
+    return hueRowSSE41;
+#endif
+  return hueRowScalar;
+}
+
+static int huePath = bestPath ();
+static ILAC_HueRowFunc hueRow = pathFunc ( huePath );
+
+void //static method
+ILAC_Hue::convertRow ( const uchar *bgr, uchar *hue, const int n )
+{
+  hueRow ( bgr, hue, n );
+}
+
+void //static method
+ILAC_Hue::convert ( const Mat &bgr, Mat &hue )
+{
+  CV_Assert ( bgr.type() == CV_8UC3 );
+  hue.create ( bgr.size(), CV_8UC1 );
+
+  for ( int row = 0 ; row < bgr.rows ; row++ )
+    hueRow ( bgr.ptr(row), hue.ptr(row), bgr.cols );
+}
+
+int //static method
+ILAC_Hue::getPath () { return huePath; }
+
+bool //static method
+ILAC_Hue::setPath ( const int path )
+{
+  if ( !pathSupported ( path ) )
+    return false;
+
+  huePath = path;
+  hueRow = pathFunc ( path );
+  return true;
+}
+/*}}} ILAC_Hue*/
@@ -17,51 +17,123 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 #include "ilacImage.h"
+#include "ilacUndistort.h"
+#include "ilacNormalize.h"
+#include "ilacThread.h"
+#include "ilacCache.h"
+#include "ilacCodec.h"
+#include "ilacStats.h"
+#include "ilacArena.h"
 #include <opencv2/opencv.hpp>
 #include <sys/stat.h>
-#include <exiv2/exiv2.hpp>
 
 /*{{{ ILAC_Image*/
-ILAC_Image::ILAC_Image (){}
+vector<ILAC_Image::HintEntry> ILAC_Image::hints;
+Mutex ILAC_Image::hintsLock;
+bool ILAC_Image::autoHint = true;
+int ILAC_Image::minSquarePix = 24;
+
+ILAC_Image::ILAC_Image ():encodePool(NULL){}
 
-/*
- * 1. INITIALIZE VARIABLES
- * 2. INITIALIZE CHESSBOARD
- * 3. CALCULATE PIXELS PER MILIMITER
- * 4. CALCULATE IMAGE ID
- * 5. CALCULATE PLOT CORNERS
- */
 ILAC_Image::ILAC_Image ( const string &image, const Size &boardSize,
                          const Mat &camMat, const Mat &disMat,
                          const int sqrSideUU, const int sphDiamUU,
-                         const bool full )
+                         const bool full, const bool lazy,
+                         const int chessDetect )
   :camMat(camMat), disMat(disMat), image_file(image),
-   sphDiamUU(sphDiamUU), sqrSideUU(sqrSideUU),
-   cb(NULL), pixPerUU(-1), id(), plotCorners(), normImg()
+   sphDiamUU(sphDiamUU), sqrSideUU(sqrSideUU), lazy(lazy),
+   chessDetect(chessDetect), chessHint(),
+   sphereMethod(ILAC_SphereFinder::SF_ROI),
+   cb(NULL), pixPerUU(-1), id(), plotCorners(), normImg(),
+   useCache(false), fileHash(0), cacheKey(0), fileRead(false),
+   idOnly(false), idScale(1),
+   normWidth(5000), normRatio(1.5), normPixPerUU(0), streaming(false),
+   bounded(false), normInter(INTER_LINEAR), warpThreads(0),
+   encodePool(NULL)
 {
-  /* 1. INITIALIZE VARIABLES*/
+  ILAC_StatsScope scope ( &this->stats );
   this->dimension.width = max ( boardSize.width, boardSize.height );
   this->dimension.height = min ( boardSize.width, boardSize.height );
   check_input ( image, this->dimension );
-  undistort ( imread(this->image_file), this->img, camMat, disMat );
 
-  if ( full )
+  /*
+   * Decoded when the pixels are needed. With the cache we might not need to
+   * decode at all, and in id only mode we decode at a reduced size. Without
+   * it the file is not even read until then.
+   */
+  if ( ILAC_DetectCache::isOpen() )
   {
-    /* 2. INITIALIZE CHESSBOARD*/
-    this->initChess ();
+    this->loadFile ();
+    this->useCache = true;
+    this->fileHash = ILAC_DetectCache::hash ( this->fileData );
+    this->makeCacheKey ();
+  }
+  this->init ( full );
+}
 
-    /* 3. CALCULATE PIXELS PER MILIMITER */
-    this->calcPixPerUU ();
+/* The image was decoded by the caller. It can give us the EXIF too. */
+ILAC_Image::ILAC_Image ( const Mat &rawImg, const string &image,
+                         const Size &boardSize,
+                         const Mat &camMat, const Mat &disMat,
+                         const int sqrSideUU, const int sphDiamUU,
+                         const bool full, const bool lazy,
+                         const int chessDetect )
+  :camMat(camMat), disMat(disMat), image_file(image), rawImg(rawImg),
+   sphDiamUU(sphDiamUU), sqrSideUU(sqrSideUU), lazy(lazy),
+   chessDetect(chessDetect), chessHint(),
+   sphereMethod(ILAC_SphereFinder::SF_ROI),
+   cb(NULL), pixPerUU(-1), id(), plotCorners(), normImg(),
+   useCache(false), fileHash(0), cacheKey(0), fileRead(true),
+   idOnly(false), idScale(1),
+   fullSize(rawImg.size()),
+   normWidth(5000), normRatio(1.5), normPixPerUU(0), streaming(false),
+   bounded(false), normInter(INTER_LINEAR), warpThreads(0),
+   encodePool(NULL)
+{
+  ILAC_StatsScope scope ( &this->stats );
+  this->dimension.width = max ( boardSize.width, boardSize.height );
+  this->dimension.height = min ( boardSize.width, boardSize.height );
+  if ( this->dimension.height % 2 == this->dimension.width % 2 )
+    throw ILACExSymmetricalChessboard();
+  if ( this->rawImg.empty() )
+    throw ILACExFileError();
+  this->init ( full );
+}
 
-    /* 4. CALCULATE IMAGE ID */
-    this->calcID();
+/*
+ * 1. USE WHAT THE CACHE KNOWS
+ * 2. CALCULATE IMAGE ID
+ * 3. CALCULATE PLOT CORNERS
+ * The image is decoded and undistorted when the detection needs it.
+ */
+void
+ILAC_Image::init ( const bool full )
+{
+  /* 1. USE WHAT THE CACHE KNOWS */
+  this->lookupCached ();
 
-    /* 5. CALCULATE PLOT CORNERS */
-    this->calcRefPoints();
+  if ( full )
+  {
+    /* 2. CALCULATE IMAGE ID */
+    this->getID ();
+
+    /* 3. CALCULATE PLOT CORNERS */
+    if ( this->plotCorners.size() == 0 )
+    {
+      if ( this->cb == NULL )
+        this->initChess ();
+      if ( this->pixPerUU == -1 )
+        this->calcPixPerUU ();
+      this->calcRefPoints();
+    }
   }
 }
 
-ILAC_Image::~ILAC_Image () { delete this->cb; }
+ILAC_Image::~ILAC_Image ()
+{
+  delete this->cb;
+  ILAC_StatsLog::publish ( this->image_file, this->stats );
+}
 
 void
 ILAC_Image::calcPixPerUU ()
@@ -72,8 +144,8 @@ ILAC_Image::calcPixPerUU ()
   double wAccum = 0, hAccum = 0;
   for ( int i = 0 ; i < this->cb->getSquaresSize() ; i++ )
   {
-    wAccum += this->cb->getSquare(i).getImg().size().width;
-    hAccum += this->cb->getSquare(i).getImg().size().height;
+    wAccum += this->cb->getSquare(i).getSize().width;
+    hAccum += this->cb->getSquare(i).getSize().height;
   }
 
   /* Averate square side size in pixels:
@@ -90,24 +162,44 @@ ILAC_Image::calcPixPerUU ()
 void
 ILAC_Image::calcRefPoints ()
 {
+  ILAC_StatsScope scope ( &this->stats );
+
   /* 1. EXTRACT THE FOUR MARKED POINTS: SPHERES AND CHESSBOARD. */
-  ILAC_SphereFinder sf;
-  vector<Point2f> tmpCor; /* Temp Corners */
+  ILAC_SphereFinder sf ( this->sphereMethod );
 
   vector<ILAC_Sphere> spheres =
-    sf.findSpheres ( this->cb->getSphereSquare(), this->img,
+    sf.findSpheres ( this->cb->getSphereSquare(), this->getDetectImg(),
                      this->sphDiamUU*this->pixPerUU );
   if ( spheres.size() < 3 )
     throw ILACExLessThanThreeSpheres();
   else if ( spheres.size() > 3 )
     spheres.erase ( spheres.begin()+3, spheres.end() );
 
-  tmpCor.push_back ( this->calcChessCenter(this->cb->getPoints()) );
+  /* Sphere centers and chessboard points must be in undistorted space */
+  vector<Point2f> centers;
   for ( vector<ILAC_Sphere>::iterator sphere = spheres.begin() ;
       sphere != spheres.end() ; ++sphere )
-    tmpCor.push_back ( (*sphere).getCenter() );
+    centers.push_back ( (*sphere).getCenter() );
+  centers = this->toUndistorted ( centers );
 
   /* 2. ORDER THE POINTS ACCORDINGLY */
+  this->setRefPoints ( this->toUndistorted(this->cb->getPoints()), centers );
+  this->storeCached ( centers );
+
+  /* Detection is done. normalize samples the raw image, not this one */
+  if ( !this->rawImg.empty() )
+    this->img.release();
+}
+
+/* Chessboard points and sphere centers are in the undistorted space */
+void
+ILAC_Image::setRefPoints ( const vector<Point2f> &chessPoints,
+                           const vector<Point2f> &centers )
+{
+  vector<Point2f> tmpCor; /* Temp Corners */
+  tmpCor.push_back ( this->calcChessCenter ( chessPoints ) );
+  tmpCor.insert ( tmpCor.end(), centers.begin(), centers.end() );
+
   convexHull ( tmpCor, this->plotCorners ); /*counter clockwise by default*/
   while ( this->plotCorners[0] == tmpCor[0] ) /* put chessboard at [0]*/
     rotate(this->plotCorners.begin(),
@@ -166,110 +258,562 @@ ILAC_Image::calcID ()
 void
 ILAC_Image::initChess ()
 {
-  this->cb = new ILAC_Chess_SSD( this->img,
+  ILAC_StatsScope scope ( &this->stats );
+
+  /* Hints are in full size coordinates */
+  Mat &detectImg = this->getDetectImg();
+  Rect hint = this->chessHint;
+  if ( hint.area() == 0 )
+    hint = this->lookupHint ();
+  if ( this->idScale > 1 )
+    hint = Rect ( hint.x / this->idScale, hint.y / this->idScale,
+                  hint.width / this->idScale, hint.height / this->idScale );
+
+  this->cb = new ILAC_Chess_SSD( detectImg,
                                  this->dimension,
-                                 ILAC_Chessboard::CB_MEDIAN );
+                                 ILAC_Chessboard::CB_MEDIAN,
+                                 this->chessDetect,
+                                 hint );
+
+  this->calcPixPerUU ();
+  Rect found = this->cb->getBoundingRect();
+  this->storeHint ( Rect ( found.x * this->idScale, found.y * this->idScale,
+                           found.width * this->idScale,
+                           found.height * this->idScale ),
+                    this->pixPerUU * this->sqrSideUU * this->idScale );
+}
+
+void
+ILAC_Image::setChessHint ( const Rect &hint ) { this->chessHint = hint; }
+
+void
+ILAC_Image::setSphereMethod ( const int method )
+{
+  if ( method == this->sphereMethod )
+    return;
+
+  this->sphereMethod = method;
+  this->plotCorners.clear();
+  if ( this->useCache )
+  {
+    this->makeCacheKey ();
+    this->lookupCached ();
+  }
+}
+
+void
+ILAC_Image::loadFile ()
+{
+  if ( this->fileRead )
+    return;
+
+  ILAC_StatsScope scope ( &this->stats );
+  ILAC_Timer timer ( "read" );
+  ILAC_DetectCache::readFile ( this->image_file, this->fileData );
+  ILAC_Stats::count ( "bytes_read", this->fileData.size() );
+  this->fileRead = true;
+}
+
+void //static method
+ILAC_Image::setAutoHint ( const bool autoHint )
+{
+  AutoLock lock ( ILAC_Image::hintsLock );
+  ILAC_Image::autoHint = autoHint;
+  if ( !autoHint ) /* The square sizes are still good */
+    for ( vector<HintEntry>::iterator entry = hints.begin() ;
+          entry != hints.end() ; ++entry )
+      (*entry).rect = Rect();
+}
+
+void
+ILAC_Image::setIdOnly ( const bool idOnly ) { this->idOnly = idOnly; }
+
+void //static method
+ILAC_Image::setMinSquarePix ( const int minSquarePix )
+{
+  AutoLock lock ( ILAC_Image::hintsLock );
+  ILAC_Image::minSquarePix = minSquarePix;
+}
+
+/* Last chessboard position for this camera. Empty Rect if there is none. */
+/* Must hold hintsLock. NULL if we have not seen this camera and size. */
+ILAC_Image::HintEntry*
+ILAC_Image::findHint ()
+{
+  for ( vector<HintEntry>::iterator entry = hints.begin() ;
+        entry != hints.end() ; ++entry )
+    if ( (*entry).size == this->fullSize
+         && ILAC_UndistortCache::sameMat ( (*entry).camMat, this->camMat )
+         && ILAC_UndistortCache::sameMat ( (*entry).disMat, this->disMat ) )
+      return &(*entry);
+  return NULL;
+}
+
+Rect
+ILAC_Image::lookupHint ()
+{
+  AutoLock lock ( ILAC_Image::hintsLock );
+  HintEntry *entry = this->findHint();
+  if ( entry == NULL || !ILAC_Image::autoHint )
+    return Rect();
+  return entry->rect;
+}
+
+/* rect only counts with autoHint. squarePix is ignored if not positive. */
+void
+ILAC_Image::storeHint ( const Rect &rect, const double squarePix )
+{
+  AutoLock lock ( ILAC_Image::hintsLock );
+  HintEntry *entry = this->findHint();
+  if ( entry == NULL )
+  {
+    HintEntry newEntry;
+    newEntry.camMat = this->camMat.clone();
+    newEntry.disMat = this->disMat.clone();
+    newEntry.size = this->fullSize;
+    newEntry.squarePix = 0;
+    if ( hints.size() >= ILAC_Image::maxHints )
+      hints.erase ( hints.begin() );
+    hints.push_back ( newEntry );
+    entry = &hints.back();
+  }
+
+  if ( ILAC_Image::autoHint )
+    entry->rect = rect;
+  if ( squarePix > 0 )
+    entry->squarePix = squarePix;
+}
+
+/*
+ * Largest reduction at which the squares of the last image of this camera
+ * still have minSquarePix pixels. 1 if we have not seen the camera yet.
+ */
+int
+ILAC_Image::lookupScale ()
+{
+  AutoLock lock ( ILAC_Image::hintsLock );
+  HintEntry *entry = this->findHint();
+  if ( entry == NULL )
+    return 1;
+
+  for ( int scale = 8 ; scale > 1 ; scale /= 2 )
+    if ( entry->squarePix / scale >= ILAC_Image::minSquarePix )
+      return scale;
+  return 1;
 }
 
 vector<unsigned short>
 ILAC_Image::getID () {
-  /* This depends on initChess & calcID */
-  if ( this->cb == NULL )
-    this->initChess ();
+  ILAC_StatsScope scope ( &this->stats );
+  /* This depends on initChess & calcID, unless the cache had the id */
   if ( this->id.size() == 0 )
-    this->calcID ();
+  {
+    try {
+      if ( this->cb == NULL )
+        this->initChess ();
+      this->calcID ();
+    }catch(std::exception&){
+      if ( this->idScale == 1 )
+        throw;
+
+      /* Too few pixels in the reduced image. Try at full size. */
+      this->id.clear();
+      this->toFullScale ();
+      this->initChess ();
+      this->calcID ();
+    }
+    this->storeCached ( vector<Point2f>() );
+  }
 
   return this->id;
 }
 
+/* Everything the detection depends on */
 void
-ILAC_Image::normalize ()
+ILAC_Image::makeCacheKey ()
+{
+  this->cacheKey = ILAC_DetectCache::makeKey (
+      this->fileHash, this->dimension, this->camMat, this->disMat,
+      (this->lazy ? 1 : 0) | (this->chessDetect << 1),
+      this->sqrSideUU, this->sphDiamUU, this->sphereMethod );
+}
+
+/* Id and plot corners of the image, if the cache has them */
+void
+ILAC_Image::lookupCached ()
+{
+  ILAC_CacheEntry entry;
+  if ( !this->useCache || !ILAC_DetectCache::lookup ( this->cacheKey, entry ) )
+    return;
+
+  this->id = entry.id;
+  if ( entry.corners.size() > 0 && entry.centers.size() == 3 )
+    this->setRefPoints ( entry.corners, entry.centers );
+}
+
+/* Adds what we calculated to the cache entry of the image */
+void
+ILAC_Image::storeCached ( const vector<Point2f> &centers )
 {
-  /* This depends on plotPoints, chessboard & pixPerUU */
-  if ( this->cb == NULL )
-    this->initChess ();
-  if ( this->pixPerUU == -1 )
-    this->calcPixPerUU ();
+  if ( !this->useCache )
+    return;
+
+  ILAC_CacheEntry entry;
+  ILAC_DetectCache::lookup ( this->cacheKey, entry );
+  entry.id = this->id;
+  if ( this->cb != NULL && this->idScale == 1 )
+    entry.corners = this->toUndistorted ( this->cb->getPoints() );
+  if ( centers.size() > 0 )
+    entry.centers = centers;
+  entry.size = this->fullSize;
+  ILAC_DetectCache::store ( this->cacheKey, entry );
+}
+
+map<string, double>
+ILAC_Image::getTimings () { return this->stats.getTimes(); }
+
+ILAC_Stats&
+ILAC_Image::getStats () { return this->stats; }
+
+/* Makes sure we have plotCorners from a full size image */
+void
+ILAC_Image::fullScalePlot ()
+{
+  ILAC_StatsScope scope ( &this->stats );
+
+  /*
+   * The reduced id only image is not good enough. Cached plotCorners (no
+   * chessboard) are from a full size image already.
+   */
+  if ( this->idScale > 1 )
+  {
+    if ( this->cb != NULL )
+      this->plotCorners.clear();
+    this->toFullScale ();
+  }
+
+  /* This depends on plotPoints, which depend on chessboard & pixPerUU */
   if ( this->plotCorners.size() == 0 )
+  {
+    if ( this->cb == NULL )
+      this->initChess ();
+    if ( this->pixPerUU == -1 )
+      this->calcPixPerUU ();
     this->calcRefPoints();
+  }
+}
+
+void
+ILAC_Image::normalize ()
+{
+  ILAC_StatsScope scope ( &this->stats );
+  this->fullScalePlot ();
+
+  Size endSize;
+  Mat persTrans = this->calcNormTrans ( endSize );
+
+  /*
+   * Undistortion and perspective are done in one pass over the raw image.
+   * Every output pixel is interpolated once.
+   */
+  Mat disMat;
+  Mat &src = this->getNormSource ( disMat );
+  ILAC_Timer timer ( "normalize" );
+  ILAC_Normalizer normalizer ( persTrans, this->camMat, disMat );
+  normalizer.setInterpolation ( this->normInter );
+  normalizer.setThreads ( this->warpThreads );
+  if ( this->bounded )
+    this->normImg = ILAC_Arena::get ( endSize, src.type() );
+  normalizer.warp ( src, this->normImg, endSize );
+  if ( !this->bounded )
+    ILAC_Stats::countAlloc ( this->normImg );
+  ILAC_Stats::count ( "pixels_normalized", this->normImg.total() );
+
+  if ( this->bounded )
+  {
+    this->img.release();
+    this->rawImg.release();
+  }
+}
+
+/*
+ * The image normalize samples, and the distortion between it and the
+ * undistorted space. The raw image. Except when it was let go and can not be
+ * decoded again: the undistorted image, without distortion. Chessboard,
+ * pixPerUU and plotCorners are calculated, the undistorted image is not
+ * needed for anything else.
+ */
+Mat&
+ILAC_Image::getNormSource ( Mat &disMat )
+{
+  if ( this->rawImg.empty() && this->fileData.empty() && !this->img.empty() )
+  {
+    disMat = Mat::zeros ( 1, 5, CV_64F );
+    return this->img;
+  }
+
+  this->img.release();
+  disMat = this->disMat;
+  if ( this->getRawImg().empty() ) /* Let go after a bounded normalize */
+    throw ILACExFileError();
+  return this->rawImg;
+}
 
-  Mat persTrans;
-  int width = ILAC_Image::normWidth;
-  int height = width/ILAC_Image::normRatio;
+Mat
+ILAC_Image::getNormalized ()
+{
+  if ( this->normImg.empty() )
+    this->normalize();
+  return this->normImg;
+}
+
+/*
+ * Perspective transform from the undistorted image to the normalized image
+ * and the size of the normalized image. Needs the plotCorners.
+ */
+Mat
+ILAC_Image::calcNormTrans ( Size &endSize )
+{
+  int width = this->normWidth;
+  int height = width/this->normRatio;
+
+  if ( width <= 0 )
+  {
+    /* The sides of the plot as we see it. plotCorners[0] -> (height, 0) */
+    double side[4];
+    for ( int i = 0 ; i < 4 ; i++ )
+    {
+      Point2f d = this->plotCorners[(i+1)%4] - this->plotCorners[i];
+      side[i] = sqrt ( (double)(d.x*d.x + d.y*d.y) );
+    }
+
+    double scale = 1;
+    if ( this->normPixPerUU > 0 )
+    {
+      if ( this->pixPerUU == -1 ) /* plotCorners came from the cache */
+      {
+        if ( this->cb == NULL )
+          this->initChess ();
+        this->calcPixPerUU ();
+      }
+      scale = this->normPixPerUU / this->pixPerUU;
+    }
+    width = max ( 1, cvRound ( scale * (side[0] + side[2]) / 2 ) );
+    height = max ( 1, cvRound ( scale * (side[1] + side[3]) / 2 ) );
+  }
 
   Point2f tvsrc[4] = { this->plotCorners[0], this->plotCorners[1],
                        this->plotCorners[2], this->plotCorners[3] };
   Point2f tvdst[4] = { Point2f(height,0), Point2f(height,width),
                        Point2f(0,width), Point2f(0,0) };
 
-  Size endSize(height,width); /* Size(rows,cols)*/
-  persTrans = getPerspectiveTransform ( tvsrc, tvdst );
-  warpPerspective ( this->img, this->normImg, persTrans, endSize );
+  endSize = Size(height,width); /* Size(rows,cols)*/
+  return getPerspectiveTransform ( tvsrc, tvdst );
+}
+
+void
+ILAC_Image::setNormSize ( const int width, const double ratio,
+                          const double pixPerUU )
+{
+  this->normWidth = width;
+  this->normRatio = ratio > 0 ? ratio : 1.5;
+  this->normPixPerUU = pixPerUU;
+  this->normImg.release();
+}
+
+void
+ILAC_Image::setStreaming ( const bool streaming )
+{
+  this->streaming = streaming;
+}
+
+void
+ILAC_Image::setInterpolation ( const int interpolation )
+{
+  if ( interpolation != INTER_NEAREST && interpolation != INTER_LINEAR
+       && interpolation != INTER_CUBIC )
+    throw ILACExUnknownError();
+  this->normInter = interpolation;
+  this->normImg.release();
+}
+
+void
+ILAC_Image::setWarpThreads ( const size_t warpThreads )
+{
+  this->warpThreads = warpThreads;
 }
 
 /*
- * 1. SAVE NORMALIZED IMAGE
- * 2. ADD EXIF DATA TO THE NEWLY CREATED IMAGE
+ * The encoder writes the file once, with the EXIF of the source. Streaming
+ * needs the writing to happen here, so it is not done with an encode pool.
  */
 void
 ILAC_Image::saveNormalized ( const string &fileName, const bool overwrite )
 {
-  /* 1. SAVE NORMALIZED IMAGE */
-  /* Depends on normalize being executed */
-  if ( this->normImg.size() == Size(0,0) )
-    this->normalize();
-
+  ILAC_StatsScope scope ( &this->stats );
   if ( !overwrite )
   {
     struct stat file_stat;
     if ( stat ( fileName.data(), &file_stat ) == 0 )
       throw ILACExFileError(); /* Do not overwrite */
   }
-  imwrite ( fileName, this->normImg );
 
-  /* 2. ADD EXIF DATA TO THE NEWLY CREATED IMAGE */
-  Exiv2::Image::AutoPtr srcImg = Exiv2::ImageFactory::open(this->image_file);
-  Exiv2::Image::AutoPtr dstImg = Exiv2::ImageFactory::open(fileName);
+  if ( this->normImg.empty() && this->streaming && this->encodePool == NULL
+       && this->encoder.canStream ( fileName ) )
+  {
+    this->streamNormalized ( fileName );
+    return;
+  }
+
+  if ( this->normImg.empty() )
+    this->normalize();
+  ILAC_Timer timer ( "encode" ); /* Only the hand over with a pool */
+  if ( this->encodePool != NULL )
+    this->encodePool->submit ( this->normImg, fileName, this->exif,
+                               this->encoder );
+  else
+    this->encoder.save ( this->normImg, fileName, this->exif );
+
+  /* The pool holds its own reference until it is written */
+  if ( this->bounded )
+    this->normImg.release();
+}
+
+void
+ILAC_Image::setMemoryBounded ( const bool bounded )
+{
+  this->bounded = bounded;
+}
+
+void
+ILAC_Image::setExif ( const vector<uchar> &exif )
+{
+  this->exif = exif;
+}
+
+void
+ILAC_Image::setEncoder ( const ILAC_Encoder &encoder )
+{
+  this->encoder = encoder;
+}
+
+void
+ILAC_Image::setEncodePool ( ILAC_EncodePool *encodePool )
+{
+  this->encodePool = encodePool;
+}
+
+/* normalize and imwrite, streamRows rows at a time. */
+void
+ILAC_Image::streamNormalized ( const string &fileName )
+{
+  this->fullScalePlot ();
+
+  Size endSize;
+  Mat persTrans = this->calcNormTrans ( endSize );
+  Mat disMat;
+  Mat &src = this->getNormSource ( disMat );
+  ILAC_Normalizer normalizer ( persTrans, this->camMat, disMat );
+  normalizer.setInterpolation ( this->normInter );
+  normalizer.setThreads ( this->warpThreads );
+
+  /* Warp and encode are interleaved, we can only time them together */
+  ILAC_Timer timer ( "normalize_encode" );
+  ILAC_Stats::count ( "pixels_normalized", endSize.area() );
+  ILAC_JpegWriter writer;
+  this->encoder.openJpeg ( writer, fileName, endSize, this->exif );
+  Mat block ( min ( (int)streamRows, endSize.height ), endSize.width,
+              src.type() );
+  for ( int row = 0 ; row < endSize.height ; row += block.rows )
+  {
+    Mat rows = block.rowRange ( 0, min ( block.rows, endSize.height - row ) );
+    normalizer.warpBlock ( src, rows, row );
+    writer.write ( rows );
+  }
+  writer.close ();
 
-  //FIXME: catch the warnings from the output.
-  srcImg->readMetadata ();
-  dstImg->setExifData ( srcImg->exifData() );
-  dstImg->writeMetadata ();
+  if ( this->bounded )
+  {
+    this->img.release();
+    this->rawImg.release();
+  }
 }
 
+/* Searches the corners of every calibration image. Used with the pool. */
+class ILAC_IntrTask : public ILAC_Task{
+  public:
+    ILAC_IntrTask ( const vector<string> &images, const Size &boardSize,
+                    const int detect )
+      :images(images), boardSize(boardSize), detect(detect),
+       found(images.size(), 0), imagePoints(images.size()),
+       sizes(images.size()){}
+
+    virtual void run ( const size_t i )
+    {
+      this->found[i] =
+        ILAC_Image::findIntrCorners ( this->images[i], this->boardSize,
+                                      this->detect, this->imagePoints[i],
+                                      this->sizes[i] );
+    }
+
+    const vector<string> &images;
+    Size boardSize;
+    int detect;
+
+    /*
+     * One entry per image, so the order does not depend on the threads. Not
+     * vector<bool>: its elements can not be written from different threads.
+     */
+    vector<char> found;
+    vector< vector<Point2f> > imagePoints;
+    vector<Size> sizes; /* Empty if the image could not be read */
+};
+
+/*
+ * 1. CREATE IMAGEPOINTS.
+ * 2. CREATE OBJECTPOINTS.
+ * 3. CALL CALIBRATE CAMERA.
+ * 4. CALCULATE THE REPROJECTION ERRORS.
+ */
 void
 ILAC_Image::calcIntr ( const vector<string> images,
                        const unsigned int size1,
                        const unsigned int size2,
-                       Mat &camMat, Mat &disMat )
+                       Mat &camMat, Mat &disMat,
+                       const int detect, vector<double> *errors,
+                       const size_t threads )
 {
-  Mat tmp_img;
-  vector<Point2f> pointbuf;
   vector<Point3f> corners;
   vector< vector<Point2f> > imagePoints;
   vector< vector<Point3f> > objectPoints;
+  vector<size_t> used; /* images offset of every imagePoints element */
   vector<Mat> rvecs, tvecs;
-  Size boardSize;
+  Size boardSize, imageSize;
   int sqr_size = 1;
 
   /* 1. CREATE IMAGEPOINTS.*/
   boardSize.width = max ( size1, size2 );
   boardSize.height = min ( size1, size2 );
-  for ( vector<string>::const_iterator img = images.begin() ;
-        img != images.end() ; ++img )
-    try {
-      check_input ( (*img), boardSize );/*validate args*/
-      cvtColor ( imread ( (*img) ), tmp_img, CV_BGR2GRAY );/*to grayscale*/
-      if ( !findChessboardCorners ( tmp_img, boardSize, pointbuf,
-                                    CV_CALIB_CB_ADAPTIVE_THRESH ) )
-        continue;
-      else
-        cornerSubPix ( tmp_img, pointbuf, Size(5,5), Size(-1,-1),
-                    TermCriteria( CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 30, 0.1 ) );
+  if ( boardSize.height % 2 == boardSize.width % 2 )
+    throw ILACExSymmetricalChessboard();
 
-      imagePoints.push_back(pointbuf); /*keep image points */
-    }catch(ILACExFileError){continue;}
-     catch(cv::Exception){continue;}
+  ILAC_IntrTask task ( images, boardSize, detect );
+  ILAC_ThreadPool pool ( min ( threads > 0 ? threads
+                                           : ILAC_ThreadPool::getNumCpus(),
+                               max ( images.size(), (size_t)1 ) ) );
+  pool.run ( task, images.size() );
+
+  /* Same order as images. The size is the one of the last readable image */
+  for ( size_t i = 0 ; i < images.size() ; i++ )
+  {
+    if ( task.sizes[i].area() > 0 )
+      imageSize = task.sizes[i];
+    if ( task.found[i] )
+    {
+      imagePoints.push_back ( task.imagePoints[i] ); /*keep image points */
+      used.push_back ( i );
+    }
+  }
 
   if ( imagePoints.size() <= 0 )/* Need at least one element */
     throw ILACExNoChessboardFound();
@@ -286,8 +830,79 @@ ILAC_Image::calcIntr ( const vector<string> images,
     objectPoints.push_back(corners);
 
   /* 3. CALL CALIBRATE CAMERA. find camMat, disMat */
-  calibrateCamera( objectPoints, imagePoints, tmp_img.size(),
+  calibrateCamera( objectPoints, imagePoints, imageSize,
                    camMat, disMat, rvecs, tvecs, 0 );
+
+  /* 4. CALCULATE THE REPROJECTION ERRORS. RMS in pixels, -1 if not used */
+  if ( errors == NULL )
+    return;
+
+  errors->assign ( images.size(), -1 );
+  for ( size_t i = 0 ; i < imagePoints.size() ; i++ )
+  {
+    vector<Point2f> projected;
+    projectPoints ( objectPoints[i], rvecs[i], tvecs[i], camMat, disMat,
+                    projected );
+
+    double accum = 0;
+    for ( size_t j = 0 ; j < projected.size() ; j++ )
+    {
+      Point2f d = projected[j] - imagePoints[i][j];
+      accum += d.x*d.x + d.y*d.y;
+    }
+    (*errors)[used[i]] = sqrt ( accum / projected.size() );
+  }
+}
+
+/* Corners of one calibration image. Runs in the pool threads. */
+bool //static method
+ILAC_Image::findIntrCorners ( const string &image, const Size &boardSize,
+                              const int detect, vector<Point2f> &points,
+                              Size &size )
+{
+  try {
+    Size dimension = boardSize;
+    Mat tmp_img;
+    check_input ( image, dimension );/*validate args*/
+
+    /* The corners do not depend on the intrinsics. Negative modes. */
+    uint64 key = 0;
+    if ( !ILAC_DetectCache::isOpen() )
+      cvtColor ( imread ( image ), tmp_img, CV_BGR2GRAY );/*to grayscale*/
+    else
+    {
+      vector<uchar> content;
+      ILAC_DetectCache::readFile ( image, content );
+      key = ILAC_DetectCache::makeKey (
+          ILAC_DetectCache::hash ( content ), boardSize, Mat(), Mat(),
+          -1 - detect );
+
+      ILAC_CacheEntry entry;
+      if ( ILAC_DetectCache::lookup ( key, entry ) )
+      {
+        points = entry.corners;
+        size = entry.size;
+        return points.size() > 0;
+      }
+
+      cvtColor ( imdecode ( Mat(content), CV_LOAD_IMAGE_COLOR ), tmp_img,
+                 CV_BGR2GRAY );
+    }
+
+    size = tmp_img.size();
+    bool found = ILAC_Chessboard::findCorners ( tmp_img, boardSize, points,
+                                                detect );
+    if ( key != 0 )
+    {
+      ILAC_CacheEntry entry;
+      entry.size = size;
+      if ( found )
+        entry.corners = points;
+      ILAC_DetectCache::store ( key, entry );
+    }
+    return found;
+  }catch(ILACExFileError){return false;}
+   catch(cv::Exception){return false;}
 }
 
 void //static method
@@ -319,6 +934,112 @@ ILAC_Image::calcAngle ( const Point2f &V, const Point2f &A, const Point2f &B )
   return retAng;
 }
 
+/* Image where the chessboard and the spheres are searched for. */
+Mat&
+ILAC_Image::getDetectImg ()
+{
+  if ( this->lazy )
+    return this->getRawImg();
+
+  if ( this->img.empty() )
+  {
+    Mat &src = this->getRawImg();
+    ILAC_Timer timer ( "undistort" );
+    if ( this->bounded )
+      this->img = ILAC_Arena::get ( src.size(), src.type() );
+    else
+      ILAC_Stats::countAlloc ( src ); /* undistort allocates as much */
+    ILAC_UndistortCache::undistort ( src, this->img,
+                                     this->camMat, this->disMat );
+  }
+  return this->img;
+}
+
+/*
+ * Decodes the file content the first time the pixels are needed. In id only
+ * mode JPEGs are decoded at a reduced size and the content is kept in case
+ * we need the full size later.
+ */
+Mat&
+ILAC_Image::getRawImg ()
+{
+  if ( this->rawImg.empty() )
+    this->loadFile ();
+  if ( this->rawImg.empty() && this->fileData.size() > 0 )
+  {
+    this->idScale = 1;
+    if ( this->idOnly && this->lazy
+         && ILAC_Codec::jpegSize ( this->fileData, this->fullSize ) )
+      this->idScale = this->lookupScale ();
+
+    {
+      ILAC_Timer timer ( "decode" );
+      if ( this->bounded && this->idScale == 1
+           && ILAC_Codec::jpegSize ( this->fileData, this->fullSize ) )
+      {
+        /* Kept until normalize, so it comes from the arena */
+        this->rawImg = ILAC_Arena::get ( this->fullSize, CV_8UC3 );
+        if ( !ILAC_Codec::decode ( this->fileData, this->rawImg ) )
+          this->rawImg.release();
+      }
+      else
+      {
+        this->rawImg = ILAC_Codec::decode ( this->fileData, this->idScale );
+        ILAC_Stats::countAlloc ( this->rawImg );
+      }
+    }
+    ILAC_Stats::count ( "pixels_decoded", this->rawImg.total() );
+    if ( this->idScale == 1 )
+      this->fullSize = this->rawImg.size();
+    if ( this->idScale == 1 && this->exif.empty() )
+    {
+      /* saveNormalized needs the EXIF */
+      ILAC_Timer timer ( "exif_read" );
+      this->exif = ILAC_Codec::readExif ( this->fileData );
+    }
+
+    /* Last time we see the file content, unless we decode it again */
+    if ( this->idScale == 1 && !this->bounded )
+      vector<uchar>().swap ( this->fileData );
+  }
+  return this->rawImg;
+}
+
+/* Forget the reduced image and everything detected in it */
+void
+ILAC_Image::toFullScale ()
+{
+  delete this->cb;
+  this->cb = NULL;
+  this->pixPerUU = -1;
+  this->rawImg.release();
+  this->img.release();
+  this->idOnly = false;
+  this->idScale = 1;
+}
+
+/*
+ * Helper function. Takes detected points to the undistorted image space.
+ * plotCorners always live in the undistorted space.
+ */
+vector<Point2f>
+ILAC_Image::toUndistorted ( const vector<Point2f> &points )
+{
+  /* Points of a reduced image. Pixel centers: full = (p + 0.5)*scale - 0.5 */
+  vector<Point2f> fullPoints = points;
+  if ( this->idScale > 1 )
+    for ( vector<Point2f>::iterator point = fullPoints.begin() ;
+          point != fullPoints.end() ; ++point )
+      (*point) = ((*point) + Point2f(0.5, 0.5)) * this->idScale
+                 - Point2f(0.5, 0.5);
+
+  if ( !this->lazy )
+    return fullPoints; /* Detected on the undistorted image already. */
+
+  ILAC_LensModel lens ( this->camMat, this->disMat );
+  return lens.undistort ( fullPoints );
+}
+
 Point2f
 ILAC_Image::calcChessCenter ( vector<Point2f> points )
 {
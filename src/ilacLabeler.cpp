@@ -17,6 +17,9 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 #include "ilacLabeler.h"
+#include "ilacHue.h"
+#include "ilacStats.h"
+#include "ilacArena.h"
 #include "error.h"
 #include <opencv2/opencv.hpp>
 
@@ -25,32 +28,99 @@
 ILAC_Square::ILAC_Square ( const Point2f ul, const Point2f ur,
                        const Point2f lr, const Point2f ll,
                        const Mat& img )
+  :img(&img)
 {
-  /* Calculate the enclosing rectangle. referenced to the original image */
+  this->corners[0] = ul;
+  this->corners[1] = ur;
+  this->corners[2] = lr;
+  this->corners[3] = ll;
+}
+
+Rect
+ILAC_Square::getRect ()
+{
+  Point2f *c = this->corners;
   Rect t_rect = Rect( /* helper rectangle (x, y, width, height) */
-    FLOOR_MIN (ul.x, ur.x, lr.x, ll.x), FLOOR_MIN (ul.y, ur.y, lr.y, ll.y),
-    CEIL_DIST (ul.x, ur.x, lr.x, ll.x), CEIL_DIST (ul.y, ur.y, lr.y, ll.y) );
+    FLOOR_MIN (c[0].x, c[1].x, c[2].x, c[3].x),
+    FLOOR_MIN (c[0].y, c[1].y, c[2].y, c[3].y),
+    CEIL_DIST (c[0].x, c[1].x, c[2].x, c[3].x),
+    CEIL_DIST (c[0].y, c[1].y, c[2].y, c[3].y) );
+  return t_rect & Rect ( 0, 0, this->img->cols, this->img->rows );
+}
+
+Size
+ILAC_Square::getSize () { return this->getRect().size(); }
 
-  /* Calculate source and destination points for the perspective transform.*/
-  Point2f s[4] = {ul, ur, lr, ll};
+/*
+ * Intersect the row with the four sides. The square is convex, so the pixels
+ * between the smallest and largest intersection are inside.
+ */
+bool
+ILAC_Square::getSpan ( const int row, int &first, int &last )
+{
+  double xmin = this->img->cols, xmax = -1;
   for ( int i = 0 ; i < 4 ; i++ )
   {
-    /* Remember that ul and its brothers refer to the position with respect to
-     * the chessboard, not the image. */
-    s[i].x = floor(s[i].x - t_rect.x);
-    s[i].y = floor(s[i].y - t_rect.y);
+    Point2f a = this->corners[i];
+    Point2f b = this->corners[(i+1)%4];
+    if ( (row < a.y && row < b.y) || (row > a.y && row > b.y) )
+      continue; /* This side does not cross the row */
+
+    if ( a.y == b.y )
+    {
+      xmin = min ( xmin, (double)min ( a.x, b.x ) );
+      xmax = max ( xmax, (double)max ( a.x, b.x ) );
+      continue;
+    }
+
+    double x = a.x + (row - a.y) * (b.x - a.x) / (b.y - a.y);
+    xmin = min ( xmin, x );
+    xmax = max ( xmax, x );
   }
-  Point2f d[4]={Point2f(0,0), Point2f(t_rect.width,0),
-                Point2f(t_rect.width, t_rect.height), Point2f(0,t_rect.height)};
 
-  /* Calculate the perspective transform and create a subimage. */
-  Mat t_img = Mat( img, t_rect );
-  warpPerspective( t_img, this->img,
-                   getPerspectiveTransform(s,d), t_img.size() );
+  first = max ( (int)ceil(xmin), 0 );
+  last = min ( (int)floor(xmax), this->img->cols - 1 );
+  return first <= last;
 }
 
-Mat&
-ILAC_Square::getImg () { return this->img; }
+void
+ILAC_Square::calcHueHist ( unsigned long *hist )
+{
+  Rect t_rect = this->getRect();
+
+  /*
+   * Four partial histograms. Consecutive pixels usually have the same hue and
+   * incrementing the same bin back to back stalls on the previous store.
+   */
+  unsigned long part[4][256] = {{0}};
+  uchar hue[256]; /* Hue of up to 256 pixels of the span */
+  int first, last;
+  for ( int row = t_rect.y ; row < t_rect.y + t_rect.height ; row++ )
+  {
+    if ( !this->getSpan ( row, first, last ) )
+      continue;
+
+    for ( int col = first ; col <= last ; col += 256 )
+    {
+      int n = min ( 256, last - col + 1 );
+      ILAC_Hue::convertRow ( this->img->ptr(row) + 3*col, hue, n );
+
+      int i = 0;
+      for ( ; i + 4 <= n ; i += 4 )
+      {
+        part[0][hue[i]]++;
+        part[1][hue[i+1]]++;
+        part[2][hue[i+2]]++;
+        part[3][hue[i+3]]++;
+      }
+      for ( ; i < n ; i++ )
+        part[0][hue[i]]++;
+    }
+  }
+
+  for ( int i = 0 ; i < 256 ; i++ )
+    hist[i] = part[0][i] + part[1][i] + part[2][i] + part[3][i];
+}
 /*}}} ILAC_Square*/
 
 /*{{{ ILAC_ColorClassifiers*/
@@ -75,11 +145,15 @@ ILAC_Median_CC::ILAC_Median_CC
     throw ILACExTooManyColors();
 }
 
+/*
+ * 1. CREATE RANGE ARRAY
+ * 2. CREATE THE HUE -> CLASS LOOKUP TABLE
+ */
 void
-ILAC_Median_CC::classify ()
+ILAC_Median_CC::calcHueLut ()
 {
   /*
-   * 1 CREATE RANGE ARRAY
+   * 1. CREATE RANGE ARRAY
    * Color mapping: hRange[0] < RED < hRange[1] |
    *                hRange[1] < YELLOW < hRange[2] |
    *                ... |
@@ -123,41 +197,42 @@ ILAC_Median_CC::classify ()
   hRange[7] = 256;
 
   /*
-   * 2.CALCULATE CLASS
-   * Each accumulator offset will represent a color.
-   * c_accum[0] -> red,  c_accum[1] -> yellow, c_accum[2] -> green,
-   * c_accum[3] -> cyan, c_accum[4] -> Blue,   c_accum[5] -> magenta
+   * 2. CREATE THE HUE -> CLASS LOOKUP TABLE
+   * Each class offset represents a color.
+   * 0 -> red,  1 -> yellow, 2 -> green, 3 -> cyan, 4 -> Blue, 5 -> magenta
    * These values are related to the range argument.
-   * The color with more hits is the one that is chosen.
    */
-  Mat hImg;
-  uchar *data_ptr;
+  for ( int hue = 0 ; hue < 256 ; hue++ )
+    for ( int j = 1 ; j < 8 ; j++ )
+      if ( hRange[j] > hue )
+      {
+        this->hueLut[hue] = (uchar)((j-1)%6);
+        break;
+      }
+}
 
+void
+ILAC_Median_CC::classify ()
+{
+  ILAC_Timer timer ( "classify" );
+  this->calcHueLut ();
+
+  /*
+   * Each accumulator offset will represent a color (see calcHueLut). The
+   * color with more hits is the one that is chosen. We bin the pixel hues and
+   * fold the histogram through the lookup table.
+   */
   int coffset = 0;
+  unsigned long hist[256];
   for ( vector<ILAC_Square>::iterator _data = data.begin();
         _data != data.end() ; ++_data, coffset++ )
   {
-    /* Transform from BGR to HSV */
-    {
-      Mat hsvImg;
-      cvtColor ( (*_data).getImg(), hsvImg, CV_BGR2HSV_FULL );
-      vector<Mat> tmp_dim;
-      split( hsvImg, tmp_dim );
-      hImg = tmp_dim[0];
-    }
+    /* Hue histogram, straight from the image pixels */
+    (*_data).calcHueHist ( hist );
 
     unsigned long c_accum[6] = {0};
-    for ( unsigned int row = 0 ; row <= hImg.rows ; row++ )
-      for ( unsigned int col = 0 ; col <= hImg.cols ; col++ )
-      {
-        data_ptr = hImg.data + (row*hImg.cols) + col;
-        for ( int j = 0 ; j < 8 ; j++ )
-          if ( hRange[j] > *data_ptr )
-          {
-            c_accum[(j-1)%6]++;
-            break;
-          }
-      }
+    for ( int hue = 0 ; hue < 256 ; hue++ )
+      c_accum[ this->hueLut[hue] ] += hist[hue];
 
     /* find where the maximum offset is*/
     int max_offset = 0;
@@ -172,32 +247,24 @@ ILAC_Median_CC::classify ()
 int
 ILAC_Median_CC::calcHueMedian ( ILAC_Square &square )
 {
-  Mat hImg;
-  /* Transform from BGR to HSV */
-  {
-    Mat hsvImg;
-    cvtColor ( square.getImg(), hsvImg, CV_BGR2HSV_FULL );
-    vector<Mat> tmp_dim;
-    //FIXME: try using mixchannels to avoid s and v
-    split( hsvImg, tmp_dim );
-    hImg = tmp_dim[0];
-  }
-
-  uchar *data_ptr;
-  unsigned long c_accum[256] = {0};
-  for ( unsigned int row = 0 ; row <= hImg.rows ; row++ )
-    for ( unsigned int col = 0 ; col <= hImg.cols ; col++ )
-    {
-      data_ptr = hImg.data + (row*hImg.cols) + col;
-      c_accum[ *data_ptr ]++;
-    }
+  unsigned long c_accum[256];
+  square.calcHueHist ( c_accum );
+  return this->calcHueMedian ( c_accum );
+}
 
+int
+ILAC_Median_CC::calcHueMedian ( const unsigned long *c_accum )
+{
   /* The median is the offset in c_accum where we cross the middle of the data
    * set. */
-  unsigned long hp_size = (hImg.rows * hImg.cols)/2; //half population size
+  unsigned long population = 0;
+  for ( int i = 0 ; i < 256 ; i++ )
+    population += c_accum[i];
+
+  unsigned long hp_size = population/2; //half population size
   unsigned long accum_size = 0;
   int median = 0;
-  for ( ; median <= 256 ; median++ )
+  for ( ; median < 256 ; median++ )
   {
     if ( accum_size > hp_size )
       break;// We have found the median
@@ -210,15 +277,11 @@ ILAC_Median_CC::calcHueMedian ( ILAC_Square &square )
 
 /*{{{ ILAC_Sphere and related*/
 ILAC_Sphere::ILAC_Sphere ()
-  :img(NULL), center(Point(0,0)), radius(0){}
+  :center(Point(0,0)), radius(0){}
 
 
-ILAC_Sphere::ILAC_Sphere
-  ( const Mat *img, const Point center, const int radius)
-  :img((Mat*)img),center(center), radius(radius){}
-
-Mat*
-ILAC_Sphere::getImg() { return this->img; }
+ILAC_Sphere::ILAC_Sphere ( const Point center, const int radius)
+  :center(center), radius(radius){}
 
 Point
 ILAC_Sphere::getCenter() { return this->center; }
@@ -226,50 +289,341 @@ ILAC_Sphere::getCenter() { return this->center; }
 int
 ILAC_Sphere::getRadius() { return this->radius; }
 
-ILAC_SphereFinder::ILAC_SphereFinder () {}
+const double ILAC_SphereFinder::minCircularity = 0.5;
+
+ILAC_SphereFinder::ILAC_SphereFinder ( const int method )
+  :method(method){}
 
 /*
  * 1. CALCULATE RANGE FROM MEAN AND STANDARD DEVIATION
- * 2. CREATE A MASK FROM THE RANGE
- * 3. SMOOTH STUFF USING MORPHOLOGY
- * 4. DETECT THE CIRCLES
+ * 2. LOOK FOR THE SPHERES IN SMALL REGIONS (SF_ROI)
+ * 3. LOOK FOR THE SPHERES IN A DOWNSCALED IMAGE (SF_PYRAMID)
+ * 4. LOOK FOR THE SPHERES IN THE WHOLE IMAGE
  */
 vector<ILAC_Sphere>
 ILAC_SphereFinder::findSpheres ( ILAC_Square &square, Mat &img,
                                  const size_t pixSphDiam )
 {
+  ILAC_Timer timer ( "spheres" );
+
   /* 1. CALCULATE RANGE FROM MEAN AND STANDARD DEVIATION */
-  Mat mean, stddev;
+  double mean = 0, stddev = 0;
   {/* Isolate the Hue */
-    Mat tmpImg;
-    vector<Mat> tmp_dim;
-    cvtColor ( square.getImg(), tmpImg, CV_BGR2HSV_FULL );
-    split( tmpImg, tmp_dim );
-    tmpImg = tmp_dim[0];
-    meanStdDev ( tmpImg, mean, stddev );
+    unsigned long hist[256];
+    unsigned long population = 0;
+    square.calcHueHist ( hist );
+    for ( int hue = 0 ; hue < 256 ; hue++ )
+    {
+      population += hist[hue];
+      mean += (double)hue * hist[hue];
+    }
+    mean = population > 0 ? mean / population : 0;
+    for ( int hue = 0 ; hue < 256 ; hue++ )
+      stddev += (hue - mean) * (hue - mean) * hist[hue];
+    stddev = population > 0 ? sqrt ( stddev / population ) : 0;
   }
 
   /*
    * Range will be -+ 1 standard deviation. This has aprox 68% of the data
    * (http://en.wikipedia.org/wiki/Standard_deviation)
    */
-  Mat lowerb = mean - stddev;
-  Mat upperb = mean + stddev;
+  Scalar lowerb = Scalar ( mean - stddev );
+  Scalar upperb = Scalar ( mean + stddev );
+
+  /* 2. LOOK FOR THE SPHERES IN SMALL REGIONS (SF_ROI) */
+  vector<Vec3f> circles;
+  if ( this->method == SF_ROI )
+  {
+    vector<Rect> rois = this->findCandidates ( img, lowerb, upperb,
+                                               pixSphDiam );
+    for ( vector<Rect>::iterator roi = rois.begin() ;
+          roi != rois.end() ; ++roi )
+      this->findCircles ( img(*roi), lowerb, upperb, pixSphDiam,
+                          (*roi).tl(), circles );
+    if ( !ILAC_SphereFinder::validRoiCircles ( circles, pixSphDiam ) )
+      circles.clear();
+  }
 
-  /* 2. CREATE A MASK FROM THE RANGE */
-  Mat himg;
+  /* 3. LOOK FOR THE SPHERES IN A DOWNSCALED IMAGE (SF_PYRAMID) */
+  if ( this->method == SF_PYRAMID )
+    this->findPyramidCircles ( img, lowerb, upperb, pixSphDiam, circles );
+
+  /* 4. LOOK FOR THE SPHERES IN THE WHOLE IMAGE */
+  if ( circles.size() < 3 )
   {
-    Mat tmpImg;
-    vector<Mat> tmp_dim;
-    cvtColor ( img, tmpImg, CV_BGR2HSV_FULL );
-    split ( tmpImg, tmp_dim );
-    himg = tmp_dim[0];
+    circles.clear();
+    this->findCircles ( img, lowerb, upperb, pixSphDiam, Point(0,0),
+                        circles );
   }
 
-  Mat mask = Mat::ones(img.rows, img.cols, CV_8UC1);
+  vector<ILAC_Sphere> spheres;
+  for( size_t i = 0; i < circles.size(); i++ )
+  {
+    Point center(cvRound(circles[i][0]), cvRound(circles[i][1]));
+    int radius = cvRound(circles[i][2]);
+    ILAC_Sphere temp ( center, radius );
+    spheres.push_back(temp);
+
+    for ( int j = i ;
+         j > 0 && spheres[j].getRadius() < spheres[j-1].getRadius() ; j-- )
+      std::swap( spheres[j], spheres[j-1] );
+  }
+
+  if ( spheres.size() < 3 )
+    throw ILACExLessThanThreeSpheres ();
+
+  return spheres;
+}
+
+/*
+ * 1. DOWNSCALE UNTIL THE SPHERE IS minPyrDiam TO 2*minPyrDiam PIXELS WIDE
+ * 2. FIND THE CIRCLES IN THE DOWNSCALED IMAGE
+ * 3. REFINE THE CENTERS AT FULL RESOLUTION
+ */
+void
+ILAC_SphereFinder::findPyramidCircles ( const Mat &img, const Scalar &lowerb,
+                                        const Scalar &upperb,
+                                        const size_t pixSphDiam,
+                                        vector<Vec3f> &circles )
+{
+  /* 1. DOWNSCALE UNTIL THE SPHERE IS minPyrDiam TO 2*minPyrDiam PIXELS WIDE */
+  int scale = 1;
+  while ( (int)pixSphDiam / (scale*2) >= minPyrDiam )
+    scale = scale * 2;
+
+  Mat smallImg = img;
+  if ( scale > 1 )
+  {
+    Size smallSize ( img.cols/scale, img.rows/scale );
+    smallImg = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_SMALL,
+                                        smallSize, img.type() );
+    resize ( img, smallImg, smallSize, 0, 0, INTER_AREA );
+  }
+
+  /*
+   * 2. FIND THE CIRCLES IN THE DOWNSCALED IMAGE
+   * Same steps as findCircles. The structuring elements are now a few pixels
+   * wide, so the morphology is cheap.
+   */
+  int smallDiam = max ( (int)pixSphDiam / scale, 4 );
+  vector<Vec3f> found;
+  {
+    Mat himg = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_HUE,
+                                        smallImg.size(), CV_8UC1 );
+    Mat mask = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_MASK,
+                                        smallImg.size(), CV_8UC1 );
+    ILAC_Hue::convert ( smallImg, himg );
+    inRange ( himg, lowerb, upperb, mask );
+
+    morphologyEx ( mask, mask, MORPH_OPEN,
+                   ILAC_Arena::getEllipse ( smallDiam/4 ) );
+    dilate ( mask, mask, ILAC_Arena::getEllipse ( smallDiam/2 ) );
+
+    GaussianBlur ( mask, mask, Size(5, 5), 1, 1 );
+    HoughCircles ( mask, found, CV_HOUGH_GRADIENT, 1, 3*smallDiam/2,
+                   100, smallDiam );
+  }
+
+  /*
+   * 3. REFINE THE CENTERS AT FULL RESOLUTION
+   * The noise was opened away at the coarse level. At full resolution a 3x3
+   * open is enough to cut off single pixels. The center is the centroid of
+   * the blob of the circle, the one the coarse center is in or else the
+   * closest, so other same hue pixels in the window do not pull it.
+   */
+  Mat openSE = ILAC_Arena::getEllipse ( 3 );
+  for ( vector<Vec3f>::iterator circle = found.begin() ;
+        circle != found.end() ; ++circle )
+  {
+    Point2f center ( ((*circle)[0] + 0.5) * scale - 0.5,
+                     ((*circle)[1] + 0.5) * scale - 0.5 );
+    float radius = (*circle)[2] * scale;
+
+    int half = cvCeil ( 1.5 * max ( radius, (float)pixSphDiam/2 ) );
+    Rect win = Rect ( cvRound(center.x) - half, cvRound(center.y) - half,
+                      2*half + 1, 2*half + 1 )
+               & Rect ( 0, 0, img.cols, img.rows );
+    if ( win.area() > 0 )
+    {
+      Mat himg = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_HUE,
+                                          win.size(), CV_8UC1 );
+      Mat mask = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_MASK,
+                                          win.size(), CV_8UC1 );
+      ILAC_Hue::convert ( img(win), himg );
+      inRange ( himg, lowerb, upperb, mask );
+      morphologyEx ( mask, mask, MORPH_OPEN, openSE );
+
+      /* Signed distance: positive inside the blob */
+      vector< vector<Point> > blobs;
+      findContours ( mask, blobs, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE );
+      Point2f local ( center.x - win.x, center.y - win.y );
+      int best = -1;
+      double bestDist = 0;
+      for ( size_t j = 0 ; j < blobs.size() ; j++ )
+      {
+        double dist = pointPolygonTest ( blobs[j], local, true );
+        if ( best == -1 || dist > bestDist )
+        {
+          best = j;
+          bestDist = dist;
+        }
+      }
+
+      Moments m;
+      if ( best != -1 )
+        m = moments ( blobs[best] );
+      /*
+       * The radius is the one of a disc with the blob area, grown like the
+       * findCircles dilation with half a diameter does: findSpheres sorts
+       * the circles of all methods by radius.
+       */
+      if ( m.m00 > 0 )
+      {
+        center = Point2f ( win.x + m.m10/m.m00, win.y + m.m01/m.m00 );
+        radius = sqrt ( m.m00 / CV_PI ) + (float)pixSphDiam/4;
+      }
+    }
+
+    circles.push_back ( Vec3f ( center.x, center.y, radius ) );
+  }
+}
+
+/*
+ * 1. CREATE A DOWNSCALED MASK FROM THE RANGE
+ * 2. KEEP THE BLOBS THAT LOOK LIKE A SPHERE
+ * 3. MERGE OVERLAPPING REGIONS
+ */
+vector<Rect>
+ILAC_SphereFinder::findCandidates ( const Mat &img, const Scalar &lowerb,
+                                    const Scalar &upperb,
+                                    const size_t pixSphDiam )
+{
+  /* 1. CREATE A DOWNSCALED MASK FROM THE RANGE */
+  /* The sphere should still be minCandDiam pixels wide in the small mask */
+  int scale = max ( 1, (int)pixSphDiam / minCandDiam );
+  Mat smallImg = img;
+  if ( scale > 1 )
+  {
+    Size smallSize ( img.cols/scale, img.rows/scale );
+    smallImg = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_SMALL,
+                                        smallSize, img.type() );
+    resize ( img, smallImg, smallSize, 0, 0, INTER_AREA );
+  }
+  Mat himg = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_HUE,
+                                      smallImg.size(), CV_8UC1 );
+  Mat mask = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_MASK,
+                                      smallImg.size(), CV_8UC1 );
+  ILAC_Hue::convert ( smallImg, himg );
+  inRange ( himg, lowerb, upperb, mask );
+
+  /* 2. KEEP THE BLOBS THAT LOOK LIKE A SPHERE */
+  vector< vector<Point> > contours;
+  findContours ( mask, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE );
+
+  double radius = (double)pixSphDiam / (2*scale);
+  double expArea = CV_PI * radius * radius; /* In the small mask */
+  vector<Rect> rois;
+  for ( vector< vector<Point> >::iterator contour = contours.begin() ;
+        contour != contours.end() ; ++contour )
+  {
+    double area = contourArea ( *contour );
+    double perimeter = arcLength ( *contour, true );
+    if ( area < expArea/4 || area > expArea*4 || perimeter <= 0 )
+      continue;
+
+    /* 4*pi*area/perimeter^2 is 1 for a circle */
+    if ( 4*CV_PI*area / (perimeter*perimeter) < minCircularity )
+      continue;
+
+    /* Full resolution region, padded with a sphere diameter */
+    Rect br = boundingRect ( *contour );
+    Rect roi = Rect ( br.x*scale - pixSphDiam, br.y*scale - pixSphDiam,
+                      br.width*scale + 2*pixSphDiam,
+                      br.height*scale + 2*pixSphDiam )
+               & Rect ( 0, 0, img.cols, img.rows );
+    if ( roi.area() > 0 )
+      rois.push_back ( roi );
+  }
+
+  /*
+   * 3. MERGE OVERLAPPING REGIONS
+   * Until nothing overlaps: a region that grew can overlap one that was
+   * checked before it.
+   */
+  bool merged = true;
+  while ( merged )
+  {
+    merged = false;
+    for ( size_t i = 0 ; i < rois.size() ; i++ )
+      for ( size_t j = i+1 ; j < rois.size() ; j++ )
+        if ( (rois[i] & rois[j]).area() > 0 )
+        {
+          rois[i] = rois[i] | rois[j];
+          rois.erase ( rois.begin() + j );
+          j--;
+          merged = true;
+        }
+  }
+
+  return rois;
+}
+
+/*
+ * SF_ROI circles are taken only when they look like the three spheres:
+ * exactly three, about the size of a sphere and not on top of each other.
+ */
+bool //static method
+ILAC_SphereFinder::validRoiCircles ( const vector<Vec3f> &circles,
+                                     const size_t pixSphDiam )
+{
+  if ( circles.size() != 3 )
+    return false;
+
+  /*
+   * findCircles dilates the mask with half a diameter: its radii are up to a
+   * quarter of a diameter bigger than the sphere radius.
+   */
+  double radius = (double)pixSphDiam / 2;
+  for ( size_t i = 0 ; i < circles.size() ; i++ )
+    if ( circles[i][2] < radius/2 || circles[i][2] > 2*radius )
+      return false;
+
+  /* HoughCircles keeps them this far apart, but only inside one region */
+  double minDist = 3*(double)pixSphDiam/2;
+  for ( size_t i = 0 ; i < circles.size() ; i++ )
+    for ( size_t j = i+1 ; j < circles.size() ; j++ )
+    {
+      double dx = circles[i][0] - circles[j][0];
+      double dy = circles[i][1] - circles[j][1];
+      if ( dx*dx + dy*dy < minDist*minDist )
+        return false;
+    }
+
+  return true;
+}
+
+/*
+ * 1. CREATE A MASK FROM THE RANGE
+ * 2. SMOOTH STUFF USING MORPHOLOGY
+ * 3. DETECT THE CIRCLES
+ * Circles are returned in the coordinates of the image offset belongs to.
+ */
+void
+ILAC_SphereFinder::findCircles ( const Mat &img, const Scalar &lowerb,
+                                 const Scalar &upperb,
+                                 const size_t pixSphDiam, const Point offset,
+                                 vector<Vec3f> &circles )
+{
+  /* 1. CREATE A MASK FROM THE RANGE */
+  Mat himg = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_HUE,
+                                      img.size(), CV_8UC1 );
+  ILAC_Hue::convert ( img, himg );
+
+  Mat mask = ILAC_Arena::getScratch ( ILAC_Arena::SCRATCH_MASK,
+                                      img.size(), CV_8UC1 );
   inRange(himg, lowerb, upperb, mask);
 
-  /* 3. SMOOTH STUFF USING MORPHOLOGY */
+  /* 2. SMOOTH STUFF USING MORPHOLOGY */
   {
     /*
      * Morphological open is 1.Erode and 2.Dilate. We use 1/4 of the sphere
@@ -277,8 +631,8 @@ ILAC_SphereFinder::findSpheres ( ILAC_Square &square, Mat &img,
      * enough to remove the big sphere blob.
      */
     int openSize = pixSphDiam/4;
-    Mat se = getStructuringElement ( MORPH_ELLIPSE, Size(openSize,openSize) );
-    morphologyEx ( mask, mask, MORPH_OPEN, se );
+    morphologyEx ( mask, mask, MORPH_OPEN,
+                   ILAC_Arena::getEllipse ( openSize ) );
 
 
     /*
@@ -287,36 +641,24 @@ ILAC_SphereFinder::findSpheres ( ILAC_Square &square, Mat &img,
      * roundy this way.
      */
     int dilateSize = pixSphDiam/2;
-    se = getStructuringElement ( MORPH_ELLIPSE,
-                                 Size(dilateSize,dilateSize) );
-    dilate ( mask, mask, se );
+    dilate ( mask, mask, ILAC_Arena::getEllipse ( dilateSize ) );
   }
 
-  /* 4. DETECT THE CIRCLES */
+  /* 3. DETECT THE CIRCLES */
   /* Play with the arguments for HoughCircles. */
-  vector<Vec3f> circles;
-  vector<ILAC_Sphere> spheres;
+  vector<Vec3f> found;
   int minCircDist = 3*pixSphDiam/2;
 
   GaussianBlur ( mask, mask, Size(15, 15), 2, 2 );
-  HoughCircles ( mask, circles, CV_HOUGH_GRADIENT, 2, minCircDist, 100, 40);
+  HoughCircles ( mask, found, CV_HOUGH_GRADIENT, 2, minCircDist, 100, 40);
 
-  for( size_t i = 0; i < circles.size(); i++ )
+  for ( vector<Vec3f>::iterator circle = found.begin() ;
+        circle != found.end() ; ++circle )
   {
-    Point center(cvRound(circles[i][0]), cvRound(circles[i][1]));
-    int radius = cvRound(circles[i][2]);
-    ILAC_Sphere temp ( &img, center, radius );
-    spheres.push_back(temp);
-
-    for ( int j = i ;
-         j > 0 && spheres[j].getRadius() < spheres[j-1].getRadius() ; j-- )
-      std::swap( spheres[j], spheres[j-1] );
+    (*circle)[0] += offset.x;
+    (*circle)[1] += offset.y;
+    circles.push_back ( *circle );
   }
-
-  if ( spheres.size() < 3 )
-    throw ILACExLessThanThreeSpheres ();
-
-  return spheres;
 }
 /*}}} ILAC_Sphere and related*/
 
@@ -0,0 +1,222 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacNormalize.h"
+#include "error.h"
+#include <opencv2/opencv.hpp>
+#include <cfloat>
+
+/* Runs warpTile for every tile of dst. dst starts at firstRow. */
+class ILAC_NormalizeTiles : public ILAC_Task{
+  public:
+    ILAC_NormalizeTiles ( ILAC_Normalizer &norm, const Mat &src, Mat &dst,
+                          const int firstRow, const int tileSide )
+      :norm(norm), src(src), dst(dst), firstRow(firstRow),
+       tileSide(tileSide),
+       tileCols((dst.cols + tileSide - 1) / tileSide),
+       tileRows((dst.rows + tileSide - 1) / tileSide){}
+
+    size_t getNumTiles () { return (size_t)this->tileCols * this->tileRows; }
+
+    /* Row major: the ranges of the pool threads are bands of the image */
+    virtual void run ( const size_t tile )
+    {
+      int x = (tile % this->tileCols) * this->tileSide;
+      int y = (tile / this->tileCols) * this->tileSide;
+      Rect rect ( x, y, min ( this->tileSide, this->dst.cols - x ),
+                  min ( this->tileSide, this->dst.rows - y ) );
+      Mat dstTile = this->dst ( rect );
+      this->norm.warpTile ( this->src, dstTile, x, this->firstRow + y );
+    }
+
+  private:
+    ILAC_Normalizer &norm;
+    const Mat &src;
+    Mat &dst;
+    int firstRow;
+    int tileSide;
+    int tileCols;
+    int tileRows;
+};
+
+/*{{{ ILAC_Normalizer*/
+pthread_key_t ILAC_Normalizer::poolKey;
+pthread_once_t ILAC_Normalizer::poolOnce = PTHREAD_ONCE_INIT;
+
+ILAC_Normalizer::ILAC_Normalizer ( const Mat &persTrans,
+                                   const Mat &camMat, const Mat &disMat )
+  :lens(camMat, disMat), interpolation(INTER_LINEAR), numThreads(0)
+{
+  persTrans.inv().convertTo ( this->invTrans, CV_64F );
+}
+
+void
+ILAC_Normalizer::setInterpolation ( const int interpolation )
+{
+  if ( interpolation != INTER_NEAREST && interpolation != INTER_LINEAR
+       && interpolation != INTER_CUBIC )
+    throw ILACExUnknownError();
+  this->interpolation = interpolation;
+}
+
+void
+ILAC_Normalizer::setThreads ( const size_t numThreads )
+{
+  this->numThreads = numThreads;
+}
+
+void
+ILAC_Normalizer::warp ( const Mat &src, Mat &dst, const Size &dstSize )
+{
+  dst.create ( dstSize, src.type() );
+  this->warpBlock ( src, dst, 0 );
+}
+
+/* The tiles of dstRows are processed in parallel. */
+void
+ILAC_Normalizer::warpBlock ( const Mat &src, Mat &dstRows, const int firstRow )
+{
+  ILAC_NormalizeTiles tiles ( *this, src, dstRows, firstRow, tileSide );
+  if ( tiles.getNumTiles() == 1 || this->numThreads == 1 )
+  {
+    for ( size_t tile = 0 ; tile < tiles.getNumTiles() ; tile++ )
+      tiles.run ( tile );
+    return;
+  }
+
+  ILAC_Normalizer::getPool ( this->numThreads )
+    ->run ( tiles, tiles.getNumTiles(), true );
+}
+
+/* Made again only when the number of threads changes */
+ILAC_ThreadPool* //static method
+ILAC_Normalizer::getPool ( const size_t numThreads )
+{
+  pthread_once ( &ILAC_Normalizer::poolOnce, ILAC_Normalizer::createPoolKey );
+  size_t n = numThreads > 0 ? numThreads : ILAC_ThreadPool::getNumCpus();
+  ILAC_ThreadPool *pool =
+    (ILAC_ThreadPool*)pthread_getspecific ( ILAC_Normalizer::poolKey );
+  if ( pool != NULL && pool->getNumThreads() != n )
+  {
+    delete pool;
+    pool = NULL;
+  }
+  if ( pool == NULL )
+  {
+    pool = new ILAC_ThreadPool ( n );
+    pthread_setspecific ( ILAC_Normalizer::poolKey, pool );
+  }
+  return pool;
+}
+
+/* Thread exit */
+void //static method
+ILAC_Normalizer::destroyPool ( void *pool )
+{
+  delete (ILAC_ThreadPool*)pool;
+}
+
+void //static method
+ILAC_Normalizer::createPoolKey ()
+{
+  pthread_key_create ( &ILAC_Normalizer::poolKey,
+                       ILAC_Normalizer::destroyPool );
+}
+
+/*
+ * 1. BUILD THE MAP OF THE TILE
+ * 2. CALCULATE THE FOOTPRINT OF THE TILE IN THE RAW IMAGE
+ * 3. INTERPOLATE FROM THE FOOTPRINT ONLY
+ *
+ * warpTile only reads the members, so it can run in several threads at the
+ * same time.
+ */
+void
+ILAC_Normalizer::warpTile ( const Mat &src, Mat &dstTile,
+                            const int firstCol, const int firstRow )
+{
+  /* 1. BUILD THE MAP OF THE TILE */
+  Mat compMap ( dstTile.size(), CV_32FC2 );
+  this->buildMap ( compMap, firstCol, firstRow );
+
+  /* 2. CALCULATE THE FOOTPRINT OF THE TILE IN THE RAW IMAGE */
+  float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+  for ( int row = 0 ; row < compMap.rows ; row++ )
+  {
+    const Point2f *map_ptr = compMap.ptr<Point2f>(row);
+    for ( int x = 0 ; x < compMap.cols ; x++ )
+    {
+      minX = min ( minX, map_ptr[x].x );
+      maxX = max ( maxX, map_ptr[x].x );
+      minY = min ( minY, map_ptr[x].y );
+      maxY = max ( maxY, map_ptr[x].y );
+    }
+  }
+
+  /*
+   * Pixels read around a point: nearest rounds up to one pixel to the
+   * right, bilinear reads one to the right and bicubic one to the left and
+   * two to the right.
+   */
+  int margin = this->interpolation == INTER_CUBIC ? 2 : 1;
+  Rect footprint ( 0, 0, src.cols, src.rows );
+  const float limit = 1 << 24; /* Also false for NaN */
+  if ( minX > -limit && maxX < limit && minY > -limit && maxY < limit )
+  {
+    int x0 = max ( 0, cvFloor(minX) - margin );
+    int y0 = max ( 0, cvFloor(minY) - margin );
+    int x1 = min ( src.cols, cvFloor(maxX) + margin + 1 );
+    int y1 = min ( src.rows, cvFloor(maxY) + margin + 1 );
+    if ( x0 >= x1 || y0 >= y1 )
+    {
+      dstTile = Scalar::all(0); /* Outside of the raw image */
+      return;
+    }
+    footprint = Rect ( x0, y0, x1 - x0, y1 - y0 );
+  }
+
+  /*
+   * 3. INTERPOLATE FROM THE FOOTPRINT ONLY
+   * Moving the map by whole pixels does not change the interpolation.
+   */
+  if ( footprint.x != 0 || footprint.y != 0 )
+    compMap -= Scalar ( footprint.x, footprint.y );
+  remap ( src(footprint), dstTile, compMap, Mat(), this->interpolation,
+          BORDER_CONSTANT );
+}
+
+/* Composite map: normalized pixel -> undistorted pixel -> raw pixel */
+void
+ILAC_Normalizer::buildMap ( Mat &compMap, const int firstCol,
+                            const int firstRow )
+{
+  const double *h = this->invTrans.ptr<double>(0);
+  for ( int row = 0 ; row < compMap.rows ; row++ )
+  {
+    Point2f *map_ptr = compMap.ptr<Point2f>(row);
+    double y = firstRow + row;
+    for ( int col = 0 ; col < compMap.cols ; col++ )
+    {
+      double x = firstCol + col;
+      double w = h[6]*x + h[7]*y + h[8];
+      map_ptr[col] = this->lens.distort ( (h[0]*x + h[1]*y + h[2])/w,
+                                          (h[3]*x + h[4]*y + h[5])/w );
+    }
+  }
+}
+/*}}} ILAC_Normalizer*/
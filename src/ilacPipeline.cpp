@@ -0,0 +1,345 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacPipeline.h"
+#include "ilacCache.h"
+#include "ilacCodec.h"
+#include <opencv2/opencv.hpp>
+#include <sys/stat.h>
+#include <errno.h>
+
+/*{{{ ILAC_Pipeline*/
+ILAC_Pipeline::ILAC_Pipeline ( const Size &boardSize,
+                               const Mat &camMat, const Mat &disMat,
+                               const int sqrSize, const int sphSize )
+  :boardSize(boardSize), camMat(camMat), disMat(disMat),
+   sqrSize(sqrSize), sphSize(sphSize), lazy(true),
+   chessDetect(ILAC_Chessboard::DETECT_FULL), normWidth(5000),
+   normRatio(1.5), normPixPerUU(0), streaming(false), bounded(false),
+   queueSize(4),
+   seconds(0), processed(0)
+{
+  /*
+   * Decode and encode mostly wait for the disk. A warp in one thread takes
+   * a fraction of the detection, which gets the cpus.
+   */
+  this->threads[STAGE_DECODE] = 2;
+  this->threads[STAGE_DETECT] = 0;
+  this->threads[STAGE_WARP] = 2;
+  this->threads[STAGE_ENCODE] = 2;
+}
+
+void
+ILAC_Pipeline::setThreads ( const int stage, const size_t threads )
+{
+  if ( stage < 0 || stage >= STAGE_COUNT )
+    throw ILACExOutOfBounds();
+  this->threads[stage] = threads;
+}
+
+void
+ILAC_Pipeline::setQueueSize ( const size_t queueSize )
+{
+  this->queueSize = queueSize;
+}
+
+void
+ILAC_Pipeline::setLazy ( const bool lazy ) { this->lazy = lazy; }
+
+void
+ILAC_Pipeline::setChessDetect ( const int chessDetect )
+{
+  this->chessDetect = chessDetect;
+}
+
+void
+ILAC_Pipeline::setNormSize ( const int width, const double ratio,
+                             const double pixPerUU )
+{
+  this->normWidth = width;
+  this->normRatio = ratio;
+  this->normPixPerUU = pixPerUU;
+}
+
+void
+ILAC_Pipeline::setStreaming ( const bool streaming )
+{
+  this->streaming = streaming;
+}
+
+void
+ILAC_Pipeline::setEncoder ( const ILAC_Encoder &encoder )
+{
+  this->encoder = encoder;
+}
+
+void
+ILAC_Pipeline::setMemoryBounded ( const bool bounded )
+{
+  this->bounded = bounded;
+}
+
+/*
+ * 1. INITIALIZE THE RUN
+ * 2. START THE STAGE THREADS
+ * 3. WAIT FOR ALL OF THEM
+ */
+vector<ILAC_PipelineResult>
+ILAC_Pipeline::run ( const vector<string> &files, const string &outDir )
+{
+  /* 1. INITIALIZE THE RUN */
+  int64 start = getTickCount();
+  this->outDir = outDir;
+  this->files = files;
+  this->images.assign ( files.size(), (ILAC_Image*)NULL );
+  this->results.assign ( files.size(), ILAC_PipelineResult() );
+  for ( size_t i = 0 ; i < files.size() ; i++ )
+    this->results[i].file = files[i];
+
+  this->queues.clear();
+  this->queues.push_back ( new ILAC_Queue<size_t> ( max(files.size(),
+                                                        (size_t)1) ) );
+  for ( int stage = 1 ; stage < STAGE_COUNT ; stage++ )
+    this->queues.push_back ( new ILAC_Queue<size_t> ( this->queueSize ) );
+
+  /* 2. START THE STAGE THREADS */
+  pthread_mutex_init ( &this->runningLock, NULL );
+  vector<Worker> workers;
+  for ( int stage = 0 ; stage < STAGE_COUNT ; stage++ )
+  {
+    size_t n = this->threads[stage] > 0 ? this->threads[stage]
+                                        : ILAC_ThreadPool::getNumCpus();
+    this->running[stage] = 0;
+    for ( size_t i = 0 ; i < n ; i++ )
+    {
+      Worker worker = { this, stage };
+      workers.push_back ( worker );
+    }
+  }
+
+  /*
+   * Nothing flows until the files are in the decode queue, so a stage can
+   * not finish while we are still starting threads.
+   */
+  vector<pthread_t> pthreads;
+  for ( size_t i = 0 ; i < workers.size() ; i++ )
+  {
+    pthread_t thread;
+    pthread_mutex_lock ( &this->runningLock );
+    this->running[workers[i].stage]++;
+    pthread_mutex_unlock ( &this->runningLock );
+    if ( pthread_create ( &thread, NULL, ILAC_Pipeline::work,
+                          &workers[i] ) == 0 )
+      pthreads.push_back ( thread );
+    else
+    {
+      pthread_mutex_lock ( &this->runningLock );
+      this->running[workers[i].stage]--;
+      pthread_mutex_unlock ( &this->runningLock );
+    }
+  }
+
+  bool started = true;
+  for ( int stage = 0 ; stage < STAGE_COUNT ; stage++ )
+    started = started && this->running[stage] > 0;
+
+  if ( started )
+  {
+    for ( size_t i = 0 ; i < files.size() ; i++ )
+      this->queues[0]->push ( i );
+    this->queues[0]->close();
+  }else
+    /* A stage has no threads. Let the others exit. */
+    for ( size_t i = 0 ; i < this->queues.size() ; i++ )
+      this->queues[i]->close();
+
+  /* 3. WAIT FOR ALL OF THEM */
+  for ( size_t i = 0 ; i < pthreads.size() ; i++ )
+    pthread_join ( pthreads[i], NULL );
+
+  pthread_mutex_destroy ( &this->runningLock );
+  for ( size_t i = 0 ; i < this->queues.size() ; i++ )
+    delete this->queues[i];
+  this->queues.clear();
+
+  this->processed = 0;
+  for ( size_t i = 0 ; i < this->results.size() ; i++ )
+    if ( this->results[i].error.empty() )
+      this->processed++;
+  this->seconds = (getTickCount() - start) / getTickFrequency();
+
+  if ( !started )
+    throw ILACExUnknownError();
+  return this->results;
+}
+
+double
+ILAC_Pipeline::getSeconds () { return this->seconds; }
+
+double
+ILAC_Pipeline::getImagesPerSec ()
+{
+  if ( this->seconds <= 0 )
+    return 0;
+  return this->processed / this->seconds;
+}
+
+void* //static method
+ILAC_Pipeline::work ( void *worker )
+{
+  Worker *w = (Worker*)worker;
+  w->pipeline->workStage ( w->stage );
+  return NULL;
+}
+
+/*
+ * Images that fail are not passed on. The last thread of a stage closes the
+ * queue of the next one.
+ */
+void
+ILAC_Pipeline::workStage ( const int stage )
+{
+  size_t i;
+  while ( this->queues[stage]->pop ( i ) )
+  {
+    try {
+      this->process ( stage, i );
+      if ( stage + 1 < STAGE_COUNT )
+        this->queues[stage+1]->push ( i );
+    }catch(std::exception &e){
+      this->results[i].error = e.what();
+    }catch(...){
+      this->results[i].error = "Unknown error";
+    }
+
+    if ( !this->results[i].error.empty() || stage + 1 == STAGE_COUNT )
+    {
+      delete this->images[i];
+      this->images[i] = NULL;
+    }
+  }
+
+  pthread_mutex_lock ( &this->runningLock );
+  bool last = --this->running[stage] == 0;
+  pthread_mutex_unlock ( &this->runningLock );
+  if ( last && stage + 1 < STAGE_COUNT )
+    this->queues[stage+1]->close();
+}
+
+/* Only one thread works on image i at any time. */
+void
+ILAC_Pipeline::process ( const int stage, const size_t i )
+{
+  ILAC_PipelineResult &result = this->results[i];
+  switch ( stage )
+  {
+    case STAGE_DECODE:
+      if ( this->bounded )
+      {
+        /*
+         * Only the file content waits in the queues. The image decodes it
+         * when it is detected and keeps it until it is warped.
+         */
+        this->images[i] = new ILAC_Image ( result.file, this->boardSize,
+                                           this->camMat, this->disMat,
+                                           this->sqrSize, this->sphSize,
+                                           false, this->lazy,
+                                           this->chessDetect );
+        this->images[i]->setMemoryBounded ( true );
+        this->images[i]->loadFile ();
+      }
+      else
+        this->decode ( i );
+      this->images[i]->setNormSize ( this->normWidth, this->normRatio,
+                                     this->normPixPerUU );
+      this->images[i]->setStreaming ( this->streaming );
+      this->images[i]->setWarpThreads ( 1 );
+      this->images[i]->setEncoder ( this->encoder );
+      break;
+
+    case STAGE_DETECT:
+      /* A cached image has an id and plot corners, but no chessboard */
+      result.id = this->images[i]->getID();
+      this->images[i]->fullScalePlot();
+      break;
+
+    case STAGE_WARP:
+      if ( !this->streaming )
+        this->images[i]->normalize();
+      break;
+
+    case STAGE_ENCODE:
+    {
+      /* outDir/<id>/<file name>, like ilac_process_classify_dir */
+      string idDir = this->outDir + "/";
+      for ( size_t j = 0 ; j < result.id.size() ; j++ )
+        idDir += format ( "%d", result.id[j] );
+      if ( mkdir ( idDir.data(), 0755 ) != 0 && errno != EEXIST )
+        throw ILACExFileError();
+
+      size_t slash = result.file.find_last_of ( '/' );
+      string outFile = idDir + "/" + ( slash == string::npos ? result.file
+                                         : result.file.substr(slash+1) );
+      string ext = this->encoder.getExtension();
+      if ( !ext.empty() )
+      {
+        size_t dot = outFile.find_last_of ( '.' );
+        if ( dot != string::npos && dot > idDir.size() )
+          outFile.erase ( dot );
+        outFile += ext;
+      }
+      this->images[i]->saveNormalized ( outFile );
+      result.outFile = outFile;
+      break;
+    }
+  }
+}
+
+/* Reads file i, for the pixels and for the EXIF, into images[i] */
+void
+ILAC_Pipeline::decode ( const size_t i )
+{
+  /* There is no image to record into yet, it gets the stats when it exists */
+  ILAC_Stats stats;
+  ILAC_StatsScope scope ( &stats );
+  vector<uchar> fileData;
+  {
+    ILAC_Timer timer ( "read" );
+    ILAC_DetectCache::readFile ( this->results[i].file, fileData );
+    ILAC_Stats::count ( "bytes_read", fileData.size() );
+  }
+  Mat rawImg;
+  {
+    ILAC_Timer timer ( "decode" );
+    rawImg = ILAC_Codec::decode ( fileData );
+  }
+  ILAC_Stats::countAlloc ( rawImg );
+  ILAC_Stats::count ( "pixels_decoded", rawImg.total() );
+  this->images[i] = new ILAC_Image ( rawImg, this->results[i].file,
+                                     this->boardSize,
+                                     this->camMat, this->disMat,
+                                     this->sqrSize, this->sphSize,
+                                     false, this->lazy,
+                                     this->chessDetect );
+  {
+    ILAC_Timer timer ( "exif_read" );
+    this->images[i]->setExif ( ILAC_Codec::readExif ( fileData ) );
+  }
+  this->images[i]->getStats().merge ( stats );
+}
+/*}}} ILAC_Pipeline*/
@@ -0,0 +1,331 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacStats.h"
+#include "error.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+
+/*{{{ ILAC_Stats*/
+pthread_key_t ILAC_Stats::key;
+pthread_once_t ILAC_Stats::keyOnce = PTHREAD_ONCE_INIT;
+
+void
+ILAC_Stats::addTime ( const string &name, const double ms )
+{
+  this->times[name] += ms;
+}
+
+void
+ILAC_Stats::addCount ( const string &name, const double value )
+{
+  this->counts[name] += value;
+}
+
+void
+ILAC_Stats::merge ( const ILAC_Stats &other )
+{
+  for ( map<string, double>::const_iterator time = other.times.begin() ;
+        time != other.times.end() ; ++time )
+    this->times[(*time).first] += (*time).second;
+  for ( map<string, double>::const_iterator cnt = other.counts.begin() ;
+        cnt != other.counts.end() ; ++cnt )
+    this->counts[(*cnt).first] += (*cnt).second;
+}
+
+bool
+ILAC_Stats::empty () const
+{
+  return this->times.empty() && this->counts.empty();
+}
+
+map<string, double>
+ILAC_Stats::getTimes () const { return this->times; }
+
+map<string, double>
+ILAC_Stats::getCounts () const { return this->counts; }
+
+map<string, double>
+ILAC_Stats::getAll () const
+{
+  map<string, double> all = this->counts;
+  for ( map<string, double>::const_iterator time = this->times.begin() ;
+        time != this->times.end() ; ++time )
+    all[(*time).first + "_ms"] = (*time).second;
+  return all;
+}
+
+ILAC_Stats* //static method
+ILAC_Stats::current ()
+{
+  pthread_once ( &ILAC_Stats::keyOnce, ILAC_Stats::createKey );
+  return (ILAC_Stats*)pthread_getspecific ( ILAC_Stats::key );
+}
+
+void //static method
+ILAC_Stats::count ( const string &name, const double value )
+{
+  ILAC_Stats *stats = ILAC_Stats::current();
+  if ( stats != NULL )
+    stats->addCount ( name, value );
+}
+
+void //static method
+ILAC_Stats::countAlloc ( const Mat &mat )
+{
+  ILAC_Stats *stats = ILAC_Stats::current();
+  if ( stats == NULL || mat.empty() )
+    return;
+  stats->addCount ( "frame_allocs", 1 );
+  stats->addCount ( "frame_alloc_bytes",
+                    (double)mat.total() * mat.elemSize() );
+}
+
+void //static method
+ILAC_Stats::createKey ()
+{
+  pthread_key_create ( &ILAC_Stats::key, NULL );
+}
+
+void //static method
+ILAC_Stats::setCurrent ( ILAC_Stats *stats )
+{
+  pthread_once ( &ILAC_Stats::keyOnce, ILAC_Stats::createKey );
+  pthread_setspecific ( ILAC_Stats::key, stats );
+}
+/*}}} ILAC_Stats*/
+
+/*{{{ ILAC_StatsScope*/
+ILAC_StatsScope::ILAC_StatsScope ( ILAC_Stats *stats )
+  :previous(ILAC_Stats::current())
+{
+  ILAC_Stats::setCurrent ( stats );
+}
+
+ILAC_StatsScope::~ILAC_StatsScope ()
+{
+  ILAC_Stats::setCurrent ( this->previous );
+}
+/*}}} ILAC_StatsScope*/
+
+/*{{{ ILAC_Timer*/
+ILAC_Timer::ILAC_Timer ( const char *name )
+  :stats(ILAC_Stats::current()), name(name), start(0)
+{
+  if ( this->stats != NULL )
+    this->start = getTickCount();
+}
+
+ILAC_Timer::~ILAC_Timer ()
+{
+  if ( this->stats != NULL )
+    this->stats->addTime ( this->name, (getTickCount() - this->start)
+                                       * 1000.0 / getTickFrequency() );
+}
+/*}}} ILAC_Timer*/
+
+/*{{{ ILAC_StatsSummary*/
+void
+ILAC_StatsSummary::add ( const ILAC_Stats &stats )
+{
+  map<string, double> all = stats.getAll();
+  for ( map<string, double>::iterator value = all.begin() ;
+        value != all.end() ; ++value )
+    this->values[(*value).first].push_back ( (*value).second );
+}
+
+void
+ILAC_StatsSummary::clear () { this->values.clear(); }
+
+bool
+ILAC_StatsSummary::empty () const { return this->values.empty(); }
+
+vector<string>
+ILAC_StatsSummary::getNames () const
+{
+  vector<string> names;
+  for ( map<string, vector<double> >::const_iterator value =
+          this->values.begin() ; value != this->values.end() ; ++value )
+    names.push_back ( (*value).first );
+  return names;
+}
+
+size_t
+ILAC_StatsSummary::getCount ( const string &name ) const
+{
+  map<string, vector<double> >::const_iterator value =
+    this->values.find ( name );
+  return value == this->values.end() ? 0 : (*value).second.size();
+}
+
+double
+ILAC_StatsSummary::getMean ( const string &name ) const
+{
+  map<string, vector<double> >::const_iterator value =
+    this->values.find ( name );
+  if ( value == this->values.end() )
+    return 0;
+
+  double sum = 0;
+  for ( size_t i = 0 ; i < (*value).second.size() ; i++ )
+    sum += (*value).second[i];
+  return sum / (*value).second.size();
+}
+
+double
+ILAC_StatsSummary::getPercentile ( const string &name, const double p ) const
+{
+  map<string, vector<double> >::const_iterator value =
+    this->values.find ( name );
+  if ( value == this->values.end() )
+    return 0;
+
+  vector<double> sorted = (*value).second;
+  sort ( sorted.begin(), sorted.end() );
+  size_t rank = (size_t)ceil ( min ( 100.0, max ( 0.0, p ) ) / 100
+                               * sorted.size() );
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+string
+ILAC_StatsSummary::toText () const
+{
+  string text = format ( "%-24s %8s %12s %12s %12s %12s %12s\n", "name", "n",
+                         "mean", "p50", "p90", "p99", "max" );
+  vector<string> names = this->getNames();
+  for ( size_t i = 0 ; i < names.size() ; i++ )
+    text += format ( "%-24s %8lu %12.3f %12.3f %12.3f %12.3f %12.3f\n",
+                     names[i].data(), (unsigned long)this->getCount(names[i]),
+                     this->getMean(names[i]),
+                     this->getPercentile(names[i], 50),
+                     this->getPercentile(names[i], 90),
+                     this->getPercentile(names[i], 99),
+                     this->getPercentile(names[i], 100) );
+  return text;
+}
+
+string
+ILAC_StatsSummary::toJson () const
+{
+  string json = "{";
+  vector<string> names = this->getNames();
+  for ( size_t i = 0 ; i < names.size() ; i++ )
+    json += format ( "%s%s: {\"n\": %lu, \"mean\": %g, \"p50\": %g,"
+                     " \"p90\": %g, \"p99\": %g, \"max\": %g}",
+                     i > 0 ? ", " : "",
+                     ILAC_StatsLog::jsonString(names[i]).data(),
+                     (unsigned long)this->getCount(names[i]),
+                     this->getMean(names[i]),
+                     this->getPercentile(names[i], 50),
+                     this->getPercentile(names[i], 90),
+                     this->getPercentile(names[i], 99),
+                     this->getPercentile(names[i], 100) );
+  return json + "}";
+}
+/*}}} ILAC_StatsSummary*/
+
+/*{{{ ILAC_StatsLog*/
+string //static method
+ILAC_StatsLog::jsonString ( const string &s )
+{
+  string json = "\"";
+  for ( size_t i = 0 ; i < s.size() ; i++ )
+  {
+    if ( s[i] == '"' || s[i] == '\\' )
+      json += '\\';
+    if ( (unsigned char)s[i] < 0x20 )
+      json += format ( "\\u%04x", (unsigned char)s[i] );
+    else
+      json += s[i];
+  }
+  return json + "\"";
+}
+
+Mutex ILAC_StatsLog::lock;
+bool ILAC_StatsLog::collect = false;
+ILAC_StatsSummary ILAC_StatsLog::summary;
+FILE *ILAC_StatsLog::sink = NULL;
+bool ILAC_StatsLog::jsonSink = false;
+
+/*
+ * 1. ADD TO THE SUMMARY
+ * 2. WRITE A LINE TO THE SINK
+ */
+void //static method
+ILAC_StatsLog::publish ( const string &file, const ILAC_Stats &stats )
+{
+  AutoLock lock ( ILAC_StatsLog::lock );
+  if ( stats.empty() || ( !ILAC_StatsLog::collect && !ILAC_StatsLog::sink ) )
+    return;
+
+  /* 1. ADD TO THE SUMMARY */
+  if ( ILAC_StatsLog::collect )
+    ILAC_StatsLog::summary.add ( stats );
+
+  /* 2. WRITE A LINE TO THE SINK */
+  if ( ILAC_StatsLog::sink == NULL )
+    return;
+
+  map<string, double> all = stats.getAll();
+  string line = ILAC_StatsLog::jsonSink
+                ? "{\"file\": " + jsonString ( file ) : file;
+  for ( map<string, double>::iterator value = all.begin() ;
+        value != all.end() ; ++value )
+    line += ILAC_StatsLog::jsonSink
+            ? format ( ", %s: %g", jsonString((*value).first).data(),
+                       (*value).second )
+            : format ( "\t%s=%g", (*value).first.data(), (*value).second );
+  line += ILAC_StatsLog::jsonSink ? "}\n" : "\n";
+  fputs ( line.data(), ILAC_StatsLog::sink );
+  fflush ( ILAC_StatsLog::sink );
+}
+
+void //static method
+ILAC_StatsLog::setSummary ( const bool collect )
+{
+  AutoLock lock ( ILAC_StatsLog::lock );
+  ILAC_StatsLog::collect = collect;
+  if ( collect )
+    ILAC_StatsLog::summary.clear();
+}
+
+ILAC_StatsSummary //static method
+ILAC_StatsLog::getSummary ()
+{
+  AutoLock lock ( ILAC_StatsLog::lock );
+  return ILAC_StatsLog::summary;
+}
+
+/* Lines are appended: several runs can share a sink. */
+void //static method
+ILAC_StatsLog::openSink ( const string &path )
+{
+  AutoLock lock ( ILAC_StatsLog::lock );
+  if ( ILAC_StatsLog::sink != NULL )
+    fclose ( ILAC_StatsLog::sink );
+  ILAC_StatsLog::sink = NULL;
+  if ( path.empty() )
+    return;
+
+  ILAC_StatsLog::sink = fopen ( path.data(), "a" );
+  if ( ILAC_StatsLog::sink == NULL )
+    throw ILACExFileError();
+  ILAC_StatsLog::jsonSink = path.size() > 5
+                            && path.substr ( path.size() - 5 ) == ".json";
+}
+/*}}} ILAC_StatsLog*/
@@ -0,0 +1,314 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacThread.h"
+#include "error.h"
+#include <unistd.h>
+
+ILAC_Task::~ILAC_Task (){}
+
+/*{{{ ILAC_ThreadPool*/
+ILAC_ThreadPool::ILAC_ThreadPool ( const size_t numThreads )
+  :task(NULL), stats(NULL), next(0), size(0), done(0), generation(0), quit(false),
+   failed(false), steal(false), started(0), active(0)
+{
+  pthread_mutex_init ( &this->lock, NULL );
+  pthread_cond_init ( &this->workCond, NULL );
+  pthread_cond_init ( &this->doneCond, NULL );
+
+  size_t n = numThreads > 0 ? numThreads : ILAC_ThreadPool::getNumCpus();
+  for ( size_t i = 0 ; i < n ; i++ )
+  {
+    this->ranges.push_back ( new StealRange() );
+    pthread_mutex_init ( &this->ranges[i]->lock, NULL );
+    this->ranges[i]->begin = this->ranges[i]->end = 0;
+  }
+  for ( size_t i = 0 ; i < n ; i++ )
+  {
+    pthread_t thread;
+    if ( pthread_create ( &thread, NULL, ILAC_ThreadPool::worker, this ) == 0 )
+      this->threads.push_back ( thread );
+  }
+}
+
+ILAC_ThreadPool::~ILAC_ThreadPool ()
+{
+  pthread_mutex_lock ( &this->lock );
+  this->quit = true;
+  pthread_cond_broadcast ( &this->workCond );
+  pthread_mutex_unlock ( &this->lock );
+
+  for ( vector<pthread_t>::iterator thread = this->threads.begin() ;
+        thread != this->threads.end() ; ++thread )
+    pthread_join ( *thread, NULL );
+
+  for ( size_t i = 0 ; i < this->ranges.size() ; i++ )
+  {
+    pthread_mutex_destroy ( &this->ranges[i]->lock );
+    delete this->ranges[i];
+  }
+  pthread_cond_destroy ( &this->doneCond );
+  pthread_cond_destroy ( &this->workCond );
+  pthread_mutex_destroy ( &this->lock );
+}
+
+void
+ILAC_ThreadPool::run ( ILAC_Task &task, const size_t size, const bool steal )
+{
+  if ( size == 0 )
+    return;
+
+  /* No threads could be created. Do the work here. */
+  if ( this->threads.size() == 0 )
+  {
+    for ( size_t i = 0 ; i < size ; i++ )
+    {
+      try { task.run ( i ); }
+      catch ( std::exception &e ) { throw ILACExTaskFailed ( e.what() ); }
+      catch ( ... ) { throw ILACExTaskFailed ( "Unknown error in a task" ); }
+    }
+    return;
+  }
+
+  pthread_mutex_lock ( &this->lock );
+  /* A thread that woke up late for the last run may still be stealing */
+  while ( this->active > 0 )
+    pthread_cond_wait ( &this->doneCond, &this->lock );
+  this->failed = false;
+  this->error.clear();
+
+  this->task = &task;
+  this->stats = ILAC_Stats::current();
+  this->next = 0;
+  this->size = size;
+  this->done = 0;
+  this->steal = steal;
+  if ( steal )
+  {
+    /* Nobody is stealing now: we waited for active == 0 */
+    size_t n = this->threads.size();
+    for ( size_t i = 0 ; i < n ; i++ )
+    {
+      this->ranges[i]->begin = size * i / n;
+      this->ranges[i]->end = size * (i+1) / n;
+    }
+    this->next = size; /* Nothing for the shared counter */
+  }
+  this->generation++;
+  pthread_cond_broadcast ( &this->workCond );
+
+  /*
+   * With steal a thread can still be looking at the ranges after the last
+   * item is done. It must be out before we reset them for the next run.
+   */
+  while ( this->done < this->size || this->active > 0 )
+    pthread_cond_wait ( &this->doneCond, &this->lock );
+  this->task = NULL;
+  this->stats = NULL;
+  bool failed = this->failed;
+  string error = this->error;
+  pthread_mutex_unlock ( &this->lock );
+
+  if ( failed )
+    throw ILACExTaskFailed ( error );
+}
+
+size_t
+ILAC_ThreadPool::getNumThreads () { return this->threads.size(); }
+
+size_t //static method
+ILAC_ThreadPool::getNumCpus ()
+{
+  long cpus = sysconf ( _SC_NPROCESSORS_ONLN );
+  return cpus > 0 ? (size_t)cpus : 1;
+}
+
+void* //static method
+ILAC_ThreadPool::worker ( void *pool )
+{
+  ((ILAC_ThreadPool*)pool)->work();
+  return NULL;
+}
+
+/* Take items one by one until there are none left, then wait for more. */
+void
+ILAC_ThreadPool::work ()
+{
+  unsigned long seen = 0;
+  pthread_mutex_lock ( &this->lock );
+  size_t me = this->started++;
+  while ( true )
+  {
+    while ( !this->quit
+            && ( this->generation == seen
+                 || ( !this->steal && this->next >= this->size ) ) )
+      pthread_cond_wait ( &this->workCond, &this->lock );
+    if ( this->quit )
+      break;
+
+    seen = this->generation;
+    if ( this->steal )
+    {
+      this->active++;
+      pthread_mutex_unlock ( &this->lock );
+
+      size_t count = this->workStealing ( me );
+
+      pthread_mutex_lock ( &this->lock );
+      this->done += count;
+      this->active--;
+      if ( this->done == this->size && this->active == 0 )
+        pthread_cond_broadcast ( &this->doneCond );
+      continue;
+    }
+
+    while ( this->next < this->size )
+    {
+      size_t item = this->next++;
+      ILAC_Task *task = this->task;
+      pthread_mutex_unlock ( &this->lock );
+
+      this->runItem ( task, item );
+
+      pthread_mutex_lock ( &this->lock );
+      if ( ++this->done == this->size )
+        pthread_cond_broadcast ( &this->doneCond );
+    }
+  }
+  pthread_mutex_unlock ( &this->lock );
+}
+
+/*
+ * Runs items from our range, then stolen ones. Returns how many it took:
+ * after a failure the items are still taken, but not run.
+ */
+size_t
+ILAC_ThreadPool::workStealing ( const size_t me )
+{
+  size_t count = 0, item;
+  while ( this->takeItem ( me, item ) )
+  {
+    this->runItem ( this->task, item );
+    count++;
+  }
+  return count;
+}
+
+/*
+ * Runs one item unless an item of this run already failed. Keeps the
+ * message of the first exception for run to throw. What the item records
+ * is merged into the stats of the caller of run. Called without the lock.
+ */
+void
+ILAC_ThreadPool::runItem ( ILAC_Task *task, const size_t item )
+{
+  pthread_mutex_lock ( &this->lock );
+  bool skip = this->failed;
+  ILAC_Stats *caller = this->stats;
+  pthread_mutex_unlock ( &this->lock );
+  if ( skip )
+    return;
+
+  ILAC_Stats stats;
+  bool threw = false;
+  string error;
+  {
+    ILAC_StatsScope scope ( caller != NULL ? &stats : NULL );
+    try {
+      task->run ( item );
+    }catch(std::exception &e){
+      threw = true;
+      error = e.what();
+    }catch(...){
+      threw = true;
+      error = "Unknown error in a task";
+    }
+  }
+
+  pthread_mutex_lock ( &this->lock );
+  if ( caller != NULL )
+    caller->merge ( stats );
+  if ( threw && !this->failed )
+  {
+    this->failed = true;
+    this->error = error;
+  }
+  pthread_mutex_unlock ( &this->lock );
+}
+
+/*
+ * 1. TAKE THE FIRST ITEM OF OUR OWN RANGE
+ * 2. FIND THE LARGEST RANGE OF THE OTHER THREADS
+ * 3. STEAL ITS SECOND HALF AND MAKE IT OUR RANGE
+ */
+bool
+ILAC_ThreadPool::takeItem ( const size_t me, size_t &item )
+{
+  StealRange *own = this->ranges[me];
+  while ( true )
+  {
+    /* 1. TAKE THE FIRST ITEM OF OUR OWN RANGE */
+    pthread_mutex_lock ( &own->lock );
+    if ( own->begin < own->end )
+    {
+      item = own->begin++;
+      pthread_mutex_unlock ( &own->lock );
+      return true;
+    }
+    pthread_mutex_unlock ( &own->lock );
+
+    /* 2. FIND THE LARGEST RANGE OF THE OTHER THREADS */
+    size_t victim = me, largest = 0;
+    for ( size_t i = 0 ; i < this->ranges.size() ; i++ )
+    {
+      if ( i == me )
+        continue;
+      /* Only a guess, it can change before we lock it again below. */
+      pthread_mutex_lock ( &this->ranges[i]->lock );
+      size_t left = this->ranges[i]->end - this->ranges[i]->begin;
+      pthread_mutex_unlock ( &this->ranges[i]->lock );
+      if ( left > largest )
+      {
+        victim = i;
+        largest = left;
+      }
+    }
+    if ( victim == me )
+      return false; /* Nothing left anywhere */
+
+    /* 3. STEAL ITS SECOND HALF AND MAKE IT OUR RANGE */
+    StealRange *other = this->ranges[victim];
+    pthread_mutex_lock ( &other->lock );
+    size_t begin = other->begin, end = other->end;
+    if ( begin < end )
+    {
+      size_t half = begin + (end - begin) / 2;
+      other->end = half;
+      pthread_mutex_unlock ( &other->lock );
+
+      /* Only we write our own range after the run started */
+      pthread_mutex_lock ( &own->lock );
+      own->begin = half;
+      own->end = end;
+      pthread_mutex_unlock ( &own->lock );
+    }
+    else
+      pthread_mutex_unlock ( &other->lock );
+  }
+}
+/*}}} ILAC_ThreadPool*/
@@ -0,0 +1,168 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "ilacUndistort.h"
+#include <string.h>
+#include <opencv2/opencv.hpp>
+
+/*{{{ ILAC_UndistortCache*/
+vector<ILAC_UndistortCache::MapEntry> ILAC_UndistortCache::maps;
+Mutex ILAC_UndistortCache::mapsLock;
+bool ILAC_UndistortCache::fixedPoint = false;
+
+/*
+ * 1. LOOK FOR A MAP THAT MATCHES THE CAMERA AND SIZE
+ * 2. CREATE THE MAP IF WE HAVE NOT SEEN THE CAMERA
+ * 3. REMAP THE IMAGE
+ */
+void //static method
+ILAC_UndistortCache::undistort ( const Mat &src, Mat &dst,
+                                 const Mat &camMat, const Mat &disMat )
+{
+  Mat map1, map2;
+  {
+    AutoLock lock ( ILAC_UndistortCache::mapsLock );
+
+    /* 1. LOOK FOR A MAP THAT MATCHES THE CAMERA AND SIZE */
+    vector<MapEntry>::iterator entry = maps.begin();
+    for ( ; entry != maps.end() ; ++entry )
+      if ( (*entry).size == src.size()
+           && (*entry).fixedPoint == ILAC_UndistortCache::fixedPoint
+           && sameMat ( (*entry).camMat, camMat )
+           && sameMat ( (*entry).disMat, disMat ) )
+        break;
+
+    /* 2. CREATE THE MAP IF WE HAVE NOT SEEN THE CAMERA */
+    if ( entry == maps.end() )
+    {
+      MapEntry newEntry;
+      newEntry.camMat = camMat.clone();
+      newEntry.disMat = disMat.clone();
+      newEntry.size = src.size();
+      newEntry.fixedPoint = ILAC_UndistortCache::fixedPoint;
+
+      /* Same as cv::undistort: no rectification and camMat as new matrix */
+      initUndistortRectifyMap ( camMat, disMat, Mat(), camMat, src.size(),
+                                newEntry.fixedPoint ? CV_16SC2 : CV_32FC1,
+                                newEntry.map1, newEntry.map2 );
+
+      if ( maps.size() >= ILAC_UndistortCache::maxMaps )
+        maps.erase ( maps.begin() );
+      maps.push_back ( newEntry );
+      entry = maps.end() - 1;
+    }
+
+    /* Mat headers are reference counted. Eviction will not free these. */
+    map1 = (*entry).map1;
+    map2 = (*entry).map2;
+  }
+
+  /* 3. REMAP THE IMAGE */
+  remap ( src, dst, map1, map2, INTER_LINEAR, BORDER_CONSTANT );
+}
+
+void //static method
+ILAC_UndistortCache::setFixedPoint ( const bool fixedPoint )
+{
+  AutoLock lock ( ILAC_UndistortCache::mapsLock );
+  ILAC_UndistortCache::fixedPoint = fixedPoint;
+}
+
+bool //static method
+ILAC_UndistortCache::getFixedPoint ()
+{
+  AutoLock lock ( ILAC_UndistortCache::mapsLock );
+  return ILAC_UndistortCache::fixedPoint;
+}
+
+void //static method
+ILAC_UndistortCache::clear ()
+{
+  AutoLock lock ( ILAC_UndistortCache::mapsLock );
+  maps.clear();
+}
+
+bool //static method
+ILAC_UndistortCache::sameMat ( const Mat &a, const Mat &b )
+{
+  if ( a.size() != b.size() || a.type() != b.type() )
+    return false;
+
+  size_t rowSize = a.cols * a.elemSize();
+  for ( int row = 0 ; row < a.rows ; row++ )
+    if ( memcmp ( a.ptr(row), b.ptr(row), rowSize ) != 0 )
+      return false;
+
+  return true;
+}
+/*}}} ILAC_UndistortCache*/
+
+/*{{{ ILAC_LensModel*/
+ILAC_LensModel::ILAC_LensModel ( const Mat &camMat, const Mat &disMat )
+  :camMat(camMat), disMat(disMat)
+{
+  Mat tmpCam, tmpDis;
+  camMat.convertTo ( tmpCam, CV_64F );
+  disMat.convertTo ( tmpDis, CV_64F );
+
+  this->fx = tmpCam.at<double>(0,0);
+  this->fy = tmpCam.at<double>(1,1);
+  this->cx = tmpCam.at<double>(0,2);
+  this->cy = tmpCam.at<double>(1,2);
+  this->skew = tmpCam.at<double>(0,1);
+
+  /* disMat can be a row or a column with 4, 5 or 8 elements. */
+  tmpDis = tmpDis.reshape ( 1, 1 );
+  for ( int i = 0 ; i < 8 ; i++ )
+    this->k[i] = i < tmpDis.cols ? tmpDis.at<double>(0,i) : 0;
+}
+
+/*
+ * initUndistortRectifyMap takes the undistorted pixel to the camera plane
+ * with the whole inverse of camMat, skew included, and the distorted point
+ * back to the raw image with fx, fy, cx and cy only. undistortPoints does
+ * the opposite, so both directions agree with it.
+ */
+Point2f
+ILAC_LensModel::distort ( const double u, const double v ) const
+{
+  double y = (v - this->cy) / this->fy;
+  double x = (u - this->cx - this->skew*y) / this->fx;
+
+  double x2 = x*x, y2 = y*y, r2 = x2 + y2, _2xy = 2*x*y;
+  double kr = ( 1 + ((this->k[4]*r2 + this->k[1])*r2 + this->k[0])*r2 )
+              / ( 1 + ((this->k[7]*r2 + this->k[6])*r2 + this->k[5])*r2 );
+
+  return Point2f (
+    this->fx*(x*kr + this->k[2]*_2xy + this->k[3]*(r2 + 2*x2)) + this->cx,
+    this->fy*(y*kr + this->k[2]*(r2 + 2*y2) + this->k[3]*_2xy) + this->cy );
+}
+
+vector<Point2f>
+ILAC_LensModel::undistort ( const vector<Point2f> &points ) const
+{
+  vector<Point2f> undistorted;
+  if ( points.size() == 0 )
+    return undistorted;
+
+  /* The last camMat puts the points back into pixel coordinates */
+  undistortPoints ( points, undistorted, this->camMat, this->disMat,
+                    Mat(), this->camMat );
+  return undistorted;
+}
+/*}}} ILAC_LensModel*/
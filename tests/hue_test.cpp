@@ -0,0 +1,93 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * ILAC_Hue must give the same hue as cvtColor with CV_BGR2HSV_FULL. We check
+ * every path the cpu supports against every possible BGR value and against
+ * the test images.
+ */
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+#include "ilacHue.h"
+
+static const char *pathNames[] = { "scalar", "sse4.1", "avx2" };
+
+/* Number of pixels where ILAC_Hue and cvtColor differ */
+static long
+compare ( const Mat &bgr )
+{
+  Mat hsv, hue;
+  vector<Mat> tmp_dim;
+  cvtColor ( bgr, hsv, CV_BGR2HSV_FULL );
+  split ( hsv, tmp_dim );
+  ILAC_Hue::convert ( bgr, hue );
+
+  long diffs = 0;
+  for ( int row = 0 ; row < bgr.rows ; row++ )
+    for ( int col = 0 ; col < bgr.cols ; col++ )
+      if ( hue.at<uchar>(row,col) != tmp_dim[0].at<uchar>(row,col) )
+        diffs++;
+  return diffs;
+}
+
+int
+main ( int argc, char **argv )
+{
+  /* Every BGR value once. 4096x4096 pixels. */
+  Mat all ( 4096, 4096, CV_8UC3 );
+  for ( int i = 0 ; i < 4096*4096 ; i++ )
+  {
+    all.data[3*i] = i & 255;
+    all.data[3*i+1] = (i >> 8) & 255;
+    all.data[3*i+2] = (i >> 16) & 255;
+  }
+
+  /* Odd widths exercise the scalar tails of the vector paths */
+  Mat odd = all ( Rect ( 3, 5, 1001, 97 ) );
+
+  int failed = 0;
+  for ( int path = ILAC_Hue::PATH_SCALAR ; path <= ILAC_Hue::PATH_AVX2 ;
+        path++ )
+  {
+    if ( !ILAC_Hue::setPath ( path ) )
+    {
+      printf ( "hue %s: not supported, skipped\n", pathNames[path] );
+      continue;
+    }
+
+    long diffs = compare ( all ) + compare ( odd );
+    for ( int i = 1 ; i < argc ; i++ )
+    {
+      Mat image = imread ( argv[i] );
+      if ( image.empty() )
+      {
+        printf ( "hue: could not read %s\n", argv[i] );
+        failed = 1;
+        continue;
+      }
+      diffs += compare ( image );
+    }
+
+    printf ( "hue %s: %ld different pixels\n", pathNames[path], diffs );
+    if ( diffs != 0 )
+      failed = 1;
+  }
+
+  return failed;
+}
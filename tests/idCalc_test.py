@@ -59,3 +59,93 @@ class IDCalc_SimpleCalc(unittest.TestCase):
         id = icb.getID()
         self.assertEqual ( id, [4] )
 
+
+    def test_SigmaPyramid (self):
+        import _ilac
+        icb = _ilac.IlacCB(self.ifS10mm20mm, 5, 6,
+                self.camMatS10mm20mm, self.disMatS10mm20mm, 10, 40,
+                lazy = True, pyramid = True)
+        id = icb.getID()
+        self.assertEqual ( id, [24] )
+        self.assertTrue ( "chess_detect" in icb.timings() )
+
+    def test_Batch (self):
+        import _ilac
+        ret = _ilac.process_batch([self.ifS10mm20mm, self.ifLumix,
+                "images/missing.jpg"], 5, 6,
+                self.camMatS10mm20mm, self.disMatS10mm20mm, 10, 40,
+                threads = 2, lazy = False)
+        self.assertEqual ( ret[0], ([24], None) )
+        self.assertEqual ( ret[1], ([4], None) )
+        self.assertEqual ( ret[2][0], None )
+
+    def test_Cache (self):
+        import _ilac
+        import os
+        import tempfile
+        fd, cacheFile = tempfile.mkstemp()
+        os.close(fd)
+        try:
+            _ilac.set_cache(cacheFile)
+            icb = _ilac.IlacCB(self.ifS10mm20mm, 5, 6,
+                    self.camMatS10mm20mm, self.disMatS10mm20mm, 10, 40)
+            self.assertEqual ( icb.getID(), [24] )
+
+            # Reopen so the entry comes from the file. No detection now.
+            _ilac.set_cache(cacheFile)
+            icb = _ilac.IlacCB(self.ifS10mm20mm, 5, 6,
+                    self.camMatS10mm20mm, self.disMatS10mm20mm, 10, 40)
+            self.assertEqual ( icb.getID(), [24] )
+            self.assertFalse ( "chess_detect" in icb.timings() )
+
+            # Another sphere size is another entry
+            icb = _ilac.IlacCB(self.ifS10mm20mm, 5, 6,
+                    self.camMatS10mm20mm, self.disMatS10mm20mm, 10, 30)
+            self.assertEqual ( icb.getID(), [24] )
+            self.assertTrue ( "chess_detect" in icb.timings() )
+        finally:
+            _ilac.set_cache(None)
+            os.remove(cacheFile)
+
+    def test_Stats (self):
+        import _ilac
+        import os
+        import tempfile
+        fd, sinkFile = tempfile.mkstemp(".json")
+        os.close(fd)
+        try:
+            _ilac.collect_stats(True)
+            _ilac.set_stats_sink(sinkFile)
+            icb = _ilac.IlacCB(self.ifS10mm20mm, 5, 6,
+                    self.camMatS10mm20mm, self.disMatS10mm20mm, 10, 40)
+            self.assertEqual ( icb.getID(), [24] )
+            self.assertTrue ( icb.stats()["bytes_read"] > 0 )
+            self.assertTrue ( icb.stats()["frame_allocs"] > 0 )
+            self.assertTrue ( "chess_detect_ms" in icb.stats() )
+            del icb # Published when the image is done
+
+            summary = _ilac.stats_summary()
+            self.assertEqual ( summary["chess_detect_ms"]["n"], 1 )
+            self.assertTrue ( summary["read_ms"]["max"] >= 0 )
+            _ilac.set_stats_sink(None)
+            self.assertTrue ( '"read_ms"' in open(sinkFile).read() )
+        finally:
+            _ilac.collect_stats(False)
+            _ilac.set_stats_sink(None)
+            os.remove(sinkFile)
+
+    def test_SigmaIdOnly (self):
+        import _ilac
+        # The second image is decoded at a reduced size. Its squares are
+        # about 24 pixels wide, 12 at half the size.
+        _ilac.set_min_square_pix ( 12 )
+        try:
+            for i in range(2):
+                icb = _ilac.IlacCB(self.ifS10mm20mm, 5, 6,
+                        self.camMatS10mm20mm, self.disMatS10mm20mm, 10, 40,
+                        lazy = True, idonly = True)
+                self.assertEqual ( icb.getID(), [24] )
+            # Less than the 766x873 pixels of the full image
+            self.assertTrue ( icb.stats()["pixels_decoded"] < 766*873 )
+        finally:
+            _ilac.set_min_square_pix ( 24 )
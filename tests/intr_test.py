@@ -62,3 +62,16 @@ class Intr_SimpleCalc(unittest.TestCase):
         intrinsics = \
             _ilac.calc_intrinsics(self.files, self.size[0], self.size[1])
         self.assertEqual ( self.expectedResult, intrinsics )
+
+    def test_Errors (self):
+        import _ilac
+
+        for i in range(6):
+            self.files.append("images/intr%d.jpg"%(i+1))
+        intrinsics = _ilac.calc_intrinsics(self.files, 7, 10)
+        withErrors = _ilac.calc_intrinsics(self.files, 7, 10,
+                                           errors = 1, threads = 2)
+        self.assertEqual ( intrinsics, withErrors[:2] )
+        self.assertEqual ( len(withErrors[2]), 6 )
+        for err in withErrors[2]:
+            self.assertTrue ( err == -1 or 0 <= err < 2 )
@@ -37,3 +37,226 @@ class NormCalc_SimpleCalc(unittest.TestCase):
           icb.normalize()
         except Exception as err:
           self.assertEqual ( err.message, "Not enough spheres in image" )
+
+    def test_Interpolation (self):
+        import _ilac
+        icb = _ilac.IlacCB("images/chessSpheres1.jpg", 5, 6,
+                self.camMatLumix, self.disMatLumix, 10, 40)
+        self.assertRaises ( Exception, icb.setInterpolation, "sinc" )
+        icb.setNormSize ( 600 )
+        for inter in [ "nearest", "linear", "cubic" ]:
+            icb.setInterpolation ( inter )
+            icb.normalize()
+
+    def test_Encoder (self):
+        import _ilac
+        import shutil
+        import tempfile
+        import os
+        outDir = tempfile.mkdtemp()
+        try:
+            results, ips = _ilac.process_pipeline(
+                    ["images/chessSpheres1.jpg"], outDir, 5, 6,
+                    self.camMatLumix, self.disMatLumix, 10, 40,
+                    width=1500, preset="fast", format="png")
+            self.assertEqual ( results[0][2], None )
+            self.assertTrue ( results[0][1].endswith("chessSpheres1.png") )
+            self.assertTrue ( os.path.getsize(results[0][1]) > 0 )
+
+            icb = _ilac.IlacCB("images/chessSpheres1.jpg", 5, 6,
+                    self.camMatLumix, self.disMatLumix, 10, 40)
+            self.assertRaises ( Exception, icb.setEncoder, "slow" )
+            icb.setEncoder ( "archive", "raw" )
+            icb.setNormSize ( 600 )
+            _ilac.set_encode_threads ( 2 )
+            icb.process_image ( outDir + "/raw.ppm" )
+            self.assertEqual ( _ilac.flush_encodes(), [] )
+            _ilac.set_encode_threads ( 0 )
+            self.assertEqual ( open(outDir + "/raw.ppm", "rb").read(2), "P6" )
+        finally:
+            shutil.rmtree ( outDir )
+
+    def test_Buffers (self):
+        import _ilac
+        import numpy
+        camMat = numpy.array ( self.camMatLumix )
+        disMat = numpy.array ( self.disMatLumix )
+        icb = _ilac.IlacCB("images/chessSpheres1.jpg", 5, 6,
+                camMat, disMat, 10, 40)
+        icb.setNormSize ( 600, 1.5 )
+        norm = numpy.asarray ( icb.getNormalized() )
+        self.assertEqual ( norm.shape, (600, 400, 3) )
+        self.assertEqual ( norm.dtype, numpy.uint8 )
+
+        # An in memory image, without a file
+        icb = _ilac.IlacCB(numpy.zeros((480, 640, 3), numpy.uint8), 5, 6,
+                camMat, disMat, 10, 40)
+        self.assertRaises ( Exception, icb.getID )
+        self.assertRaises ( Exception, _ilac.IlacCB,
+                numpy.zeros((480, 640), numpy.uint8), 5, 6,
+                camMat, disMat, 10, 40 )
+
+        # A unicode file name
+        icb = _ilac.IlacCB(u"images/chessSpheres1.jpg", 5, 6,
+                camMat, disMat, 10, 40)
+        self.assertEqual ( icb.getID(), [24] )
+
+        # The same image decoded by the caller
+        try:
+            import cv2
+        except ImportError:
+            self.skipTest ( "cv2 is needed to decode the image" )
+        img = cv2.imread ( "images/chessSpheres1.jpg" )
+        icb = _ilac.IlacCB(img, 5, 6, camMat, disMat, 10, 40)
+        self.assertEqual ( icb.getID(), [24] )
+
+    def test_Pipeline (self):
+        import _ilac
+        import shutil
+        import tempfile
+        outDir = tempfile.mkdtemp()
+        try:
+            results, ips = _ilac.process_pipeline(
+                    ["images/chessSpheres1.jpg", self.ifLumix], outDir, 5, 6,
+                    self.camMatLumix, self.disMatLumix, 10, 40)
+            self.assertEqual ( results[0][0], [24] )
+            self.assertEqual ( results[0][2], None )
+            self.assertTrue ( results[0][1].startswith(outDir + "/24/") )
+            self.assertEqual ( results[1][0], None )
+            self.assertTrue ( ips > 0 )
+            data = open ( results[0][1], "rb" ).read ( 65536 )
+            self.assertTrue ( "Exif\x00\x00" in data )
+        finally:
+            shutil.rmtree ( outDir )
+
+    def test_Streaming (self):
+        import _ilac
+        import shutil
+        import tempfile
+        import os
+        outDir = tempfile.mkdtemp()
+        try:
+            results, ips = _ilac.process_pipeline(
+                    ["images/chessSpheres1.jpg"], outDir, 5, 6,
+                    self.camMatLumix, self.disMatLumix, 10, 40,
+                    width=1500, streaming=1)
+            self.assertEqual ( results[0][2], None )
+            self.assertTrue ( os.path.getsize(results[0][1]) > 0 )
+            head = open ( results[0][1], "rb" ).read ( 64 )
+            self.assertTrue ( "Exif\x00\x00" in head )
+        finally:
+            shutil.rmtree ( outDir )
+
+    def test_MemoryBounded (self):
+        import _ilac
+        import shutil
+        import tempfile
+        import os
+        outDir = tempfile.mkdtemp()
+        try:
+            results, ips = _ilac.process_pipeline(
+                    ["images/chessSpheres1.jpg"], outDir, 5, 6,
+                    self.camMatLumix, self.disMatLumix, 10, 40,
+                    width=1500, lowmem=1)
+            self.assertEqual ( results[0][0], [24] )
+            self.assertTrue ( os.path.getsize(results[0][1]) > 0 )
+
+            icb = _ilac.IlacCB("images/chessSpheres1.jpg", 5, 6,
+                    self.camMatLumix, self.disMatLumix, 10, 40)
+            icb.setMemoryBounded ( True )
+            icb.setNormSize ( 600 )
+            icb.process_image ( outDir + "/bounded.jpg" )
+            self.assertTrue ( os.path.getsize(outDir + "/bounded.jpg") > 0 )
+            self.assertTrue ( _ilac.peak_rss() > 0 )
+
+            # Several images: every file is decoded once and the arenas do
+            # not grow past the capacity. A 766x873 frame is 2MB.
+            inDir = outDir + "/in"
+            os.mkdir ( inDir )
+            files = []
+            for i in range(4):
+                files.append ( "%s/bounded%d.jpg" % (inDir, i) )
+                shutil.copy ( "images/chessSpheres1.jpg", files[-1] )
+            capacity = 16 << 20
+            _ilac.set_arena_capacity ( capacity )
+            _ilac.collect_stats ( True )
+            results, ips = _ilac.process_pipeline(
+                    files, outDir, 5, 6, self.camMatLumix, self.disMatLumix,
+                    10, 40, width=1500, lowmem=1)
+            _ilac.collect_stats ( False )
+            for result in results:
+                self.assertEqual ( result[0], [24] )
+            decoded = _ilac.stats_summary()["pixels_decoded"]
+            self.assertEqual ( decoded["n"], 4 )
+            self.assertEqual ( decoded["max"], 766*873 )
+            self.assertTrue ( _ilac.arena_bytes() <= capacity )
+
+            # This thread keeps its arena between the images
+            for i in range(4):
+                icb = _ilac.IlacCB(files[i], 5, 6,
+                        self.camMatLumix, self.disMatLumix, 10, 40)
+                icb.setMemoryBounded ( True )
+                icb.setNormSize ( 600 )
+                icb.process_image ( "%s/bounded%d.jpg" % (outDir, i) )
+                self.assertTrue ( _ilac.arena_bytes() <= capacity )
+        finally:
+            _ilac.collect_stats ( False )
+            _ilac.set_arena_capacity ( 256 << 20 )
+            shutil.rmtree ( outDir )
+
+    def test_Scratch (self):
+        import _ilac
+        # After the first image the sphere finder allocates nothing
+        for i in range(2):
+            icb = _ilac.IlacCB("images/chessSpheres1.jpg", 5, 6,
+                    self.camMatLumix, self.disMatLumix, 10, 40)
+            icb.setNormSize ( 600 )
+            icb.normalize()
+        self.assertEqual ( icb.stats().get("scratch_allocs", 0), 0 )
+
+    def test_PipelineCache (self):
+        import _ilac
+        import shutil
+        import tempfile
+        import os
+        outDir = tempfile.mkdtemp()
+        fd, cacheFile = tempfile.mkstemp()
+        os.close(fd)
+        try:
+            # The second run takes the id and plot corners from the cache
+            _ilac.set_cache(cacheFile)
+            for lowmem in [0, 1, 1]:
+                runDir = tempfile.mkdtemp(dir=outDir)
+                results, ips = _ilac.process_pipeline(
+                        ["images/chessSpheres1.jpg"], runDir, 5, 6,
+                        self.camMatLumix, self.disMatLumix, 10, 40,
+                        width=1500, lowmem=lowmem)
+                self.assertEqual ( results[0][0], [24] )
+                self.assertEqual ( results[0][2], None )
+                self.assertTrue ( os.path.getsize(results[0][1]) > 0 )
+        finally:
+            _ilac.set_cache(None)
+            os.remove(cacheFile)
+            shutil.rmtree ( outDir )
+
+    def test_SharedObject (self):
+        import _ilac
+        import threading
+        # The threads take turns on the image, they do not race in it
+        icb = _ilac.IlacCB("images/chessSpheres1.jpg", 5, 6,
+                self.camMatLumix, self.disMatLumix, 10, 40)
+        icb.setNormSize ( 600 )
+        errors = []
+        def work ():
+            try:
+                icb.getID()
+                icb.normalize()
+            except Exception as err:
+                errors.append ( err )
+        threads = [ threading.Thread(target=work) for i in range(4) ]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual ( errors, [] )
+        self.assertEqual ( icb.getID(), [24] )
@@ -0,0 +1,103 @@
+/*
+ * ILAC: Image labeling and Classifying
+ * Copyright (C) 2011 Joel Granados <joel.granados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The ground truth ilac_scene writes next to its images must be what ILAC
+ * finds in them. We render scenes with random ids, keystones and rotations,
+ * go through JPEG like ilac_scene does and check that ILAC_Image::getID and
+ * the ILAC_Chessboard corners equal ILAC_Scene::getID and getCorners.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <opencv2/opencv.hpp>
+#include "ilacScene.h"
+#include "ilacImage.h"
+
+static const Size boardSize ( 5, 6 );
+static const int sqrSideUU = 10;
+static const int sphDiamUU = 40;
+static const int scenes = 8;
+
+/* Furthest corner from the ground truth, in pixels. -1 if they differ */
+static double
+cornerError ( const vector<Point2f> &found, const vector<Point2f> &truth )
+{
+  if ( found.size() != truth.size() )
+    return -1;
+
+  double worst = 0;
+  for ( size_t i = 0 ; i < found.size() ; i++ )
+  {
+    Point2f d = found[i] - truth[i];
+    worst = max ( worst, sqrt ( (double)(d.x*d.x + d.y*d.y) ) );
+  }
+  return worst;
+}
+
+int
+main ()
+{
+  Size size = ILAC_Scene::getSize ( 4 );
+  Mat camMat = Mat::eye ( 3, 3, CV_64F );
+  camMat.at<double>(0,0) = camMat.at<double>(1,1) = size.width;
+  camMat.at<double>(0,2) = size.width / 2.0;
+  camMat.at<double>(1,2) = size.height / 2.0;
+  Mat disMat = Mat::zeros ( 1, 5, CV_64F );
+  Size dimension ( max ( boardSize.width, boardSize.height ),
+                   min ( boardSize.width, boardSize.height ) );
+
+  ILAC_Scene scene ( boardSize, sqrSideUU, sphDiamUU );
+  RNG rng ( 1 );
+  vector<int> params;
+  params.push_back ( CV_IMWRITE_JPEG_QUALITY );
+  params.push_back ( 95 );
+
+  int failed = 0;
+  for ( int i = 0 ; i < scenes ; i++ )
+  {
+    scene.setRandomID ( rng );
+    scene.setKeystone ( rng.uniform ( 0.0, 0.2 ) );
+    scene.setRotation ( rng.uniform ( -5.0, 5.0 ) );
+    scene.setNoise ( 2, i );
+
+    vector<uchar> jpeg;
+    imencode ( ".jpg", scene.render ( size ), jpeg, params );
+    Mat img = imdecode ( jpeg, CV_LOAD_IMAGE_COLOR );
+
+    vector<unsigned short> id;
+    double error = -1;
+    try{
+      ILAC_Image image ( img, "scene", boardSize, camMat, disMat,
+                         sqrSideUU, sphDiamUU, false );
+      id = image.getID();
+      ILAC_Chessboard cb ( img, dimension );
+      error = cornerError ( cb.getPoints(), scene.getCorners ( size ) );
+    }catch(std::exception &e){
+      printf ( "scene %d: %s\n", i, e.what() );
+    }
+
+    bool ok = id == scene.getID() && error >= 0 && error < 1;
+    printf ( "scene %d: id %s, corners off by %.3f pixels\n", i,
+             id == scene.getID() ? "equal" : "different", error );
+    if ( !ok )
+      failed = 1;
+  }
+
+  return failed;
+}